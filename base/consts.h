@@ -51,6 +51,14 @@ typedef enum _Compound_Comp_Flags {
 	 * If set, the components of this compound glyph overlap.
 	 */
 	OVERLAP_COMPOUND			=	(1 << 10),
+	/**
+	 * If set, the component's offset is scaled by its transformation.
+	 */
+	SCALED_COMPONENT_OFFSET		=	(1 << 11),
+	/**
+	 * If set, the component's offset is not scaled (the default).
+	 */
+	UNSCALED_COMPONENT_OFFSET	=	(1 << 12),
 } Compound_Comp_Flags;
 
 typedef enum _Coord_Flags {
@@ -123,6 +131,73 @@ typedef enum _Table_Status {
 	STATUS_FREED
 } Table_Status;
 
+/**
+ * Slots of the known tables in the font's table index.
+ */
+typedef enum _Table_Slot {
+	TABLE_CMAP,
+	TABLE_CVT,
+	TABLE_FPGM,
+	TABLE_GLYF,
+	TABLE_HDMX,
+	TABLE_HEAD,
+	TABLE_HHEA,
+	TABLE_HMTX,
+	TABLE_KERN,
+	TABLE_LOCA,
+	TABLE_LTSH,
+	TABLE_MAXP,
+	TABLE_POST,
+	NUM_TABLE_SLOTS
+} Table_Slot;
+
+/**
+ * TTF_Font data sources.
+ */
+typedef enum _Font_Source {
+	SOURCE_NONE,	/* No font data. */
+	SOURCE_USER,	/* Caller-supplied buffer - not owned by the font. */
+	SOURCE_MMAP,	/* Memory-mapped font file. */
+	SOURCE_HEAP		/* Font file read into a malloc'd buffer. */
+} Font_Source;
+
+/**
+ * TTF_Bitmap pixel formats.
+ */
+typedef enum _Pixel_Format {
+	PIXEL_RGB32,	/* 0x00RRGGBB colour, one uint32_t / pixel. */
+	PIXEL_A8,		/* 8-bit coverage, one byte / pixel. */
+	PIXEL_A1		/* 1-bit coverage, eight pixels / byte, MSB first. */
+} Pixel_Format;
+
+/**
+ * TTF_Output image formats.
+ */
+typedef enum _Output_Format {
+	OUTPUT_AUTO,	/* From the file name's extension, else PNG. */
+	OUTPUT_PNG,
+	OUTPUT_PNM,		/* Binary PGM for grey images, PPM for colour. */
+	OUTPUT_RAW		/* Rows of 8-bit grey or RGB samples, no header. */
+} Output_Format;
+
+/**
+ * PNG row filters tried by the encoder.
+ */
+typedef enum _Output_Filter {
+	FILTER_NONE = 0x01,
+	FILTER_SUB = 0x02,
+	FILTER_UP = 0x04,
+	FILTER_AVG = 0x08,
+	FILTER_PAETH = 0x10,
+	FILTER_ALL = 0x1F
+} Output_Filter;
+
 #define TAG_LENGTH	4
 
+/* Decoded in place of malformed UTF-8. */
+#define REPLACEMENT_CHAR	0xFFFD
+
+/* Hard limit on compound glyph nesting, whatever maxp claims. */
+#define MAX_COMPONENT_DEPTH	16
+
 #endif /* CONSTS_H */
@@ -4,6 +4,7 @@
 #include "../parse/parse.h"
 #include "../utils/utils.h"
 #include <stdlib.h>
+#include <string.h>
 
 TTF_Font *load_font(const char *filename) {
 	TTF_Font *font = (TTF_Font*) malloc(sizeof(TTF_Font));
@@ -14,6 +15,8 @@ TTF_Font *load_font(const char *filename) {
 
 	if (!init_font(font)) {
 		warn("failed to init font");
+		free(font);
+		return NULL;
 	}
 
 	if (!parse_file(font, filename)) {
@@ -25,18 +28,38 @@ TTF_Font *load_font(const char *filename) {
 	return font;
 }
 
+TTF_Font *load_font_buffer(const uint8_t *data, size_t size) {
+	TTF_Font *font = (TTF_Font*) malloc(sizeof(TTF_Font));
+	if (!font) {
+		warnerr("failed to alloc font");
+		return NULL;
+	}
+
+	if (!init_font(font)) {
+		warn("failed to init font");
+		free(font);
+		return NULL;
+	}
+
+	if (!parse_buffer(font, data, size)) {
+		warn("failed to parse font data");
+		free_font(font);
+		return NULL;
+	}
+
+	return font;
+}
+
 int init_font(TTF_Font *font) {
 	CHECKPTR(font);
 
-	font->fd = -1;
+	init_buffer(&font->buf, NULL, 0);
+	font->source = SOURCE_NONE;
 
 	font->num_tables = 0;
 	font->tables = NULL;
+	memset(font->table_index, 0, sizeof(font->table_index));
 
-	/* rasterizer is uninitialized */
-	font->point = -1;
-	font->dpi = 0;
-	font->ppem = 0;
 	font->upem = 0;
 
 	return SUCCESS;
@@ -55,6 +78,7 @@ void free_font(TTF_Font *font) {
 		}
 		free(font->tables);
 	}
+	release_font_data(font);
 	free(font);
 }
 
@@ -81,3 +105,15 @@ int16_t get_font_descent(TTF_Font *font) {
 	}
 	return hhea->descent;
 }
+
+int16_t get_font_line_gap(TTF_Font *font) {
+	if (!font) {
+		return 0;
+	}
+	hhea_Table *hhea = get_hhea_table(font);
+	if (!hhea) {
+		warn("failed to get font line gap");
+		return 0;
+	}
+	return hhea->line_gap;
+}
@@ -4,11 +4,14 @@
 #include "types.h"
 
 TTF_Font *load_font(const char *filename);
+/* data must remain valid until the font is freed. */
+TTF_Font *load_font_buffer(const uint8_t *data, size_t size);
 
 int init_font(TTF_Font *font);
 void free_font(TTF_Font *font);
 
 int16_t get_font_ascent(TTF_Font *font);
 int16_t get_font_descent(TTF_Font *font);
+int16_t get_font_line_gap(TTF_Font *font);
 
 #endif /* FONT_H */
@@ -1,8 +1,34 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include "consts.h"
 #include <stdint.h>
 #include <stddef.h>
+#include <pthread.h>
+
+typedef int32_t F26Dot6;	/* Fixed point with 6 fractional bits (1/64 pixel). */
+typedef int32_t F16Dot16;	/* Fixed point with 16 fractional bits. */
+
+/**
+ * Bounds-checked read cursor over font data held in memory.
+ */
+typedef struct _TTF_Buffer {
+	const uint8_t *data;
+	size_t size;
+	size_t pos;
+	uint8_t overrun;	/* Set once a read past the end has been attempted. */
+} TTF_Buffer;
+
+/**
+ * A contiguous range of character codes. Every supported subtable format
+ * is reduced to a list of segments sorted by end_code.
+ */
+typedef struct _cmap_Segment {
+	uint32_t start_code;
+	uint32_t end_code;
+	uint16_t id_delta;	/* Added (modulo 65536) to the mapped glyph index. */
+	int32_t id_offset;	/* Index of start_code's entry in glyph_ids, < 0 if none. */
+} cmap_Segment;
 
 typedef struct _cmap_subTable {
 	uint16_t platform_id;
@@ -13,8 +39,10 @@ typedef struct _cmap_subTable {
 	uint32_t length;
 	uint32_t language;
 
-	uint16_t num_indices;
-	uint32_t *glyph_index_array;
+	cmap_Segment *segments;
+	uint32_t num_segments;
+	uint16_t *glyph_ids;
+	uint32_t num_glyph_ids;
 } cmap_subTable;
 
 typedef struct _cmap_Table {
@@ -22,6 +50,8 @@ typedef struct _cmap_Table {
 	uint16_t num_subtables;
 
 	cmap_subTable *subtables;
+	cmap_subTable *active;	/* Subtable used for lookups. */
+	uint16_t latin1[256];	/* Glyph indices of U+0000..U+00FF, resolved at load. */
 } cmap_Table;
 
 typedef struct _cvt_Table {
@@ -45,23 +75,210 @@ typedef struct _TTF_Contour {
 	int16_t num_segments;
 } TTF_Contour;
 
+/**
+ * A single block of memory handed out by bump allocation and released
+ * all at once.
+ */
+typedef struct _TTF_Arena {
+	uint8_t *base;
+	size_t size;
+	size_t used;
+} TTF_Arena;
+
+/**
+ * A glyph outline in font units. The outline, its contours, segments and
+ * points all live in one arena, which the outline itself is the first
+ * allocation of. Outlines are shared by every size a glyph is rendered at
+ * and are never modified once built.
+ */
 typedef struct _TTF_Outline {
 	TTF_Contour *contours;
 	int16_t num_contours;
-	float x_min;	/* Scaled outline bounds */
+
+	/* Segment points, stored contiguously; segments point into these. */
+	float *x, *y;
+	int32_t num_points;
+	int32_t max_points;
+
+	/* The glyph's own points, numbered as in the font, for compound glyph
+	 * point matching. */
+	float *glyph_x, *glyph_y;
+	int32_t num_glyph_points;
+
+	float x_min;	/* Outline bounds */
 	float y_min;
 	float x_max;
 	float y_max;
 
-	int16_t point;	/* Size outline is scaled to. < 0 if unscaled. */
+	TTF_Arena arena;
 } TTF_Outline;
 
+/**
+ * An affine transform from font units to 26.6 samples:
+ * 	x' = xx*x + xy*y + dx
+ * 	y' = yx*x + yy*y + dy
+ */
+typedef struct _TTF_Transform {
+	F16Dot16 xx, xy;
+	F16Dot16 yx, yy;
+	F26Dot6 dx, dy;
+} TTF_Transform;
+
+/**
+ * An outline placed on the sample grid of a glyph bitmap. The outline is
+ * not copied: its points are transformed as the outline is scanned.
+ */
+typedef struct _TTF_Scaled_Outline {
+	TTF_Outline *outline;
+	TTF_Transform transform;	/* Font units to bitmap samples, y down. */
+	int x_min, y_max;	/* Bitmap's top-left corner in samples, y up. */
+	int w, h;	/* Bitmap size in samples. */
+} TTF_Scaled_Outline;
+
+/**
+ * A non-horizontal line of a flattened outline, stored top-down.
+ */
+typedef struct _TTF_Edge {
+	F26Dot6 x_top, y_top;
+	F26Dot6 x_bottom, y_bottom;
+	int dir;	/* +1 if the edge pointed downwards, -1 if upwards */
+
+	/* x at the current sample row. Each row down x moves by step, and by
+	 * one more whenever the error term err, raised by lift, reaches dy. */
+	F26Dot6 x;
+	int32_t step, lift, err;
+} TTF_Edge;
+
+typedef struct _TTF_Edge_List {
+	TTF_Edge *edges;
+	int num_edges;
+	int size;
+} TTF_Edge_List;
+
 typedef struct _TTF_Bitmap {
 	int w, h;
-	uint32_t *data;
+	int format;		/* Pixel_Format */
+	int stride;		/* Bytes per row */
+	uint8_t *data;
 	uint32_t c;
 } TTF_Bitmap;
 
+/**
+ * Where a TTF_Output sends encoded bytes. Returns 0 on failure.
+ */
+typedef int (*TTF_Write_Func)(void *data, const uint8_t *buf, size_t size);
+
+typedef struct _TTF_Output_Options {
+	int format;		/* Output_Format */
+	int level;		/* zlib level 0-9 for PNG, or -1 for the default. */
+	int filters;	/* Output_Filter flags for PNG, or 0 for the default. */
+	int grey;		/* Store colour bitmaps as 8-bit grey. */
+	const char *title;
+} TTF_Output_Options;
+
+/**
+ * An image being written out a band of rows at a time.
+ */
+typedef struct _TTF_Output {
+	TTF_Write_Func write;
+	void *data;
+	int owns_file;	/* data is a FILE opened by open_output(). */
+
+	int format;		/* Output_Format */
+	int w, h;
+	int channels;	/* 1 for grey, 3 for RGB. */
+	int y;			/* Next row to be written. */
+	int failed;
+
+	uint8_t *row;	/* One converted row. */
+	void *png;		/* libpng write and info structs. */
+	void *png_info;
+} TTF_Output;
+
+/**
+ * A rasterized glyph bitmap, keyed by glyph index, size and render mode.
+ */
+typedef struct _TTF_Cache_Entry {
+	uint32_t glyph_index;
+	uint16_t ppem;
+	uint32_t raster_flags;
+	uint8_t x_phase;	/* Sub-pixel pen offset, in 1/SUBPIXEL_STEPS pixels. */
+
+	TTF_Bitmap *bitmap;	/* NULL for glyphs without an outline. */
+	int16_t x_offset;	/* Pen position to left edge of bitmap. */
+	int16_t y_offset;	/* Baseline to top edge of bitmap (positive up). */
+
+	size_t size;	/* Bytes charged against the cache budget. */
+	uint32_t pins;	/* Pinned entries are never evicted. */
+	int detached;	/* Cleared from the cache while pinned; freed when unpinned. */
+	struct _TTF_Cache_Entry *prev, *next;	/* LRU list, most recent first. */
+	struct _TTF_Cache_Entry *chain;	/* Next entry in the same hash bucket. */
+} TTF_Cache_Entry;
+
+typedef struct _TTF_Glyph_Cache {
+	TTF_Cache_Entry **buckets;
+	uint32_t num_buckets;
+	uint32_t num_entries;
+
+	TTF_Cache_Entry *head, *tail;
+
+	size_t size;	/* Bytes currently held. */
+	size_t budget;	/* Maximum bytes held before entries are evicted. */
+} TTF_Glyph_Cache;
+
+/**
+ * A glyph placed in an atlas page.
+ */
+typedef struct _TTF_Atlas_Glyph {
+	uint32_t glyph_index;
+	uint16_t ppem;
+	uint32_t raster_flags;
+
+	int x, y, w, h;	/* Pixel rectangle in the page. Empty for blank glyphs. */
+	float u0, v0, u1, v1;	/* Texture coordinates of the rectangle. */
+	int16_t x_offset;	/* Pen position to left edge of bitmap. */
+	int16_t y_offset;	/* Baseline to top edge of bitmap (positive up). */
+	F26Dot6 advance;	/* Pen advance after this glyph, in 26.6 pixels as for draw_string(). */
+
+	int shelf;	/* Shelf holding the glyph, -1 if it takes no space. */
+	int slot_w;	/* Width reserved on the shelf, including padding. */
+	uint32_t frame;	/* Frame the glyph was last used in. */
+	struct _TTF_Atlas_Glyph *prev, *next;	/* LRU list, most recent first. */
+	struct _TTF_Atlas_Glyph *chain;	/* Next glyph in the same hash bucket. */
+} TTF_Atlas_Glyph;
+
+/**
+ * A row of the atlas page. Glyphs are packed left to right from x = 0 up
+ * to the shelf's fill, and holes left by evicted glyphs are reused.
+ */
+typedef struct _TTF_Atlas_Shelf {
+	int y, h;
+	int fill;	/* First free column at the end of the shelf. */
+	int num_glyphs;
+} TTF_Atlas_Shelf;
+
+typedef struct _TTF_Atlas_Hole {
+	int shelf;
+	int x, w;
+} TTF_Atlas_Hole;
+
+typedef struct _TTF_Atlas {
+	TTF_Bitmap *page;
+
+	TTF_Atlas_Shelf *shelves;
+	int num_shelves, max_shelves;
+	TTF_Atlas_Hole *holes;
+	int num_holes, max_holes;
+
+	TTF_Atlas_Glyph **buckets;
+	uint32_t num_buckets;
+	uint32_t num_glyphs;
+	TTF_Atlas_Glyph *head, *tail;
+
+	uint32_t frame;	/* Glyphs used in the current frame are never evicted. */
+	int dirty_x0, dirty_y0, dirty_x1, dirty_y1;	/* Page area changed since the last flush. */
+} TTF_Atlas;
+
 typedef struct _TTF_Simple_Glyph {
 	uint16_t *end_pts_of_contours;
 	uint16_t instruction_length;
@@ -109,15 +326,29 @@ typedef struct _TTF_Glyph {
 
 	uint32_t index;
 
-	TTF_Outline *outline;
-	TTF_Bitmap *bitmap;
+	TTF_Outline *outline;	/* Unscaled outline, built on first use and published atomically. */
 } TTF_Glyph;
 
 typedef struct _glyf_Table {
-	TTF_Glyph *glyphs;
+	TTF_Glyph **glyphs;	/* Decoded on first access and published atomically, NULL until then. */
 	uint16_t num_glyphs; /* Copied from maxp table. */
+	uint32_t offset; /* Offset of the glyf table in the font data. */
 } glyf_Table;
 
+typedef struct _hdmx_Record {
+	uint8_t pixel_size;
+	uint8_t max_width;
+	const uint8_t *widths;	/* num_glyphs advances, in the font data. */
+} hdmx_Record;
+
+typedef struct _hdmx_Table {
+	uint16_t version;
+	uint16_t num_records;
+	uint32_t record_size;
+	uint16_t num_glyphs;
+	hdmx_Record *records;
+} hdmx_Table;
+
 typedef struct _head_Table {
 	uint32_t version;
 	uint32_t font_revision;
@@ -167,11 +398,35 @@ typedef struct _hmtx_Table {
 	uint16_t num_non_horizontal_metrics;
 } hmtx_Table;
 
+typedef struct _kern_Pair {
+	uint32_t key;	/* left << 16 | right */
+	int16_t value;
+} kern_Pair;
+
+/**
+ * Kerning pairs merged from the font's horizontal format 0 subtables,
+ * sorted by key, with an open addressed hash index into them.
+ */
+typedef struct _kern_Table {
+	kern_Pair *pairs;
+	uint32_t num_pairs;
+
+	uint32_t *slots;	/* Index+1 of a pair, or 0 if empty. */
+	uint32_t slot_mask;
+	uint8_t slot_shift;
+} kern_Table;
+
 typedef struct _loca_Table {
 	uint32_t *offsets;
 	uint16_t num_offsets;
 } loca_Table;
 
+typedef struct _ltsh_Table {
+	uint16_t version;
+	uint16_t num_glyphs;
+	const uint8_t *y_pels;	/* ppem from which each glyph scales linearly. */
+} ltsh_Table;
+
 typedef struct _maxp_Table {
 	uint32_t version;
 	uint16_t num_glyphs;
@@ -217,17 +472,21 @@ typedef struct _TTF_Table {
 		cvt_Table cvt;
 		fpgm_Table fpgm;
 		glyf_Table glyf;
+		hdmx_Table hdmx;
 		head_Table head;
 		hhea_Table hhea;
 		hmtx_Table hmtx;
+		kern_Table kern;
 		loca_Table loca;
+		ltsh_Table ltsh;
 		maxp_Table maxp;
 		post_Table post;
 	} data;
 } TTF_Table;
 
 typedef struct _TTF_Font {
-	int fd;
+	TTF_Buffer buf;
+	uint8_t source;	/* Origin of buf.data, see Font_Source. */
 
 	uint32_t scaler_type;
 	uint16_t num_tables;
@@ -236,12 +495,161 @@ typedef struct _TTF_Font {
 	uint16_t range_shift;
 
 	TTF_Table *tables;
+	TTF_Table *table_index[NUM_TABLE_SLOTS];	/* Known tables by Table_Slot. */
+
+	uint16_t upem;
+} TTF_Font;
+
+/**
+ * Size- and mode-dependent render state. A font can be shared between
+ * any number of rasters, but each raster must be used by one thread at
+ * a time.
+ */
+typedef struct _TTF_Raster {
+	TTF_Font *font;
 
 	int16_t point;
 	uint16_t dpi;
 	uint16_t ppem;
-	uint16_t upem;
+	uint32_t flags;
+	uint32_t fg_color;	/* Colour glyphs are drawn in (0xRRGGBB). */
+
+	/* hdmx advances in pixels at ppem, or NULL if the font has none. */
+	const uint8_t *device_widths;
+	uint16_t num_device_widths;
+
+	TTF_Glyph_Cache *cache;
+	struct _TTF_Run_Cache *runs;	/* Recently shaped strings. */
+
+	/* Scratch buffers reused between glyphs. */
+	TTF_Edge_List edges;
+	TTF_Edge **active;	/* Active edge list of fill_edges(). */
+	size_t active_size;
+	int32_t *coverage;
+	size_t coverage_size;
+} TTF_Raster;
+
+/**
+ * A glyph rasterized by a pool worker, waiting to be committed.
+ */
+typedef struct _TTF_Pool_Job {
+	TTF_Glyph *glyph;
+	uint8_t x_phase;
+	TTF_Bitmap *bitmap;
+	int16_t x_offset;
+	int16_t y_offset;
+	int state;	/* 0 while pending, 1 once rasterized, -1 on failure. */
+} TTF_Pool_Job;
+
+typedef struct _TTF_Pool_Worker {
+	struct _TTF_Raster_Pool *pool;
+	pthread_t thread;
+	int id;
+
+	/* Jobs [begin, end) not yet taken. The worker takes jobs from the
+	 * front and idle workers steal from the back. */
+	pthread_mutex_t lock;
+	int begin, end;
+
+	TTF_Raster *raster;	/* Private scratch buffers. */
+} TTF_Pool_Worker;
+
+typedef struct _TTF_Raster_Pool {
+	TTF_Pool_Worker *workers;
+	int num_workers;
+	int deterministic;	/* Commit glyphs in order, whichever worker finishes first. */
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	uint32_t generation;	/* Bumped for each batch. */
+	int running;	/* Workers still busy with the current batch. */
+	int quit;
+
+	/* Current batch. Results are committed under commit_lock. */
+	TTF_Raster *target;
+	TTF_Atlas *atlas;
+	uint32_t *glyph_indices;	/* Glyph and sub-pixel phase of each job. */
+	TTF_Pool_Job *jobs;
+	int num_jobs;
+	pthread_mutex_t commit_lock;
+	int next_commit;
+	int failed;
+} TTF_Raster_Pool;
+
+/**
+ * A glyph of a TTF_Glyph_Run. Pen positions are kept in 26.6 pixels, so
+ * that with RENDER_SUBPIXEL rounding errors do not add up along the run.
+ */
+typedef struct _TTF_Run_Glyph {
+	TTF_Glyph *glyph;
+	uint32_t index;
+	F26Dot6 x_offset;	/* Pen position from the start of the run. */
+	F26Dot6 x_advance;	/* Kerned advance to the next glyph. */
+	int16_t bearing;	/* Pen position to the left edge of the ink, in pixels. */
+} TTF_Run_Glyph;
+
+/**
+ * A line of text shaped once at one font, size and render mode, to be
+ * measured and drawn without decoding or looking it up again.
+ */
+typedef struct _TTF_Glyph_Run {
+	TTF_Run_Glyph *glyphs;
+	int num_glyphs;
+	int size;
+
+	int width;	/* Sum of the advances, in pixels rounded up. */
+	int x_min, y_min, x_max, y_max;	/* Ink bounds in pixels from the start of the baseline, y up. */
+
+	TTF_Font *font;
+	uint16_t ppem;
 	uint32_t raster_flags;
-} TTF_Font;
+} TTF_Glyph_Run;
+
+/**
+ * A glyph run cached under the text it was shaped from.
+ */
+typedef struct _TTF_Run_Cache_Entry {
+	char *text;
+	size_t len;
+	uint32_t hash;
+
+	TTF_Glyph_Run *run;
+
+	struct _TTF_Run_Cache_Entry *prev, *next;	/* LRU list, most recent first. */
+	struct _TTF_Run_Cache_Entry *chain;	/* Next entry in the same hash bucket. */
+} TTF_Run_Cache_Entry;
+
+typedef struct _TTF_Run_Cache {
+	TTF_Run_Cache_Entry **buckets;
+	uint32_t num_buckets;
+	uint32_t num_entries;
+	uint32_t max_entries;
+
+	TTF_Run_Cache_Entry *head, *tail;
+} TTF_Run_Cache;
+
+/**
+ * A glyph placed by layout_text(), in pixels from the top left of the
+ * laid out text.
+ */
+typedef struct _TTF_Layout_Glyph {
+	TTF_Glyph *glyph;
+	int x, y;			/* Pen position on the baseline. */
+	uint8_t x_phase;	/* Sub-pixel part of x, in 1/SUBPIXEL_STEPS pixels. */
+	int top, bottom;	/* Rows the glyph's bitmap may cover (bottom excluded). */
+} TTF_Layout_Glyph;
+
+typedef struct _TTF_Layout {
+	TTF_Layout_Glyph *glyphs;	/* Only glyphs with an outline. */
+	int num_glyphs;
+	int w, h;
+} TTF_Layout;
+
+/**
+ * Receives each band of rows rendered by render_bands(). Returns 0 on
+ * failure.
+ */
+typedef int (*TTF_Band_Func)(void *data, TTF_Bitmap *band, int y, int num_rows);
 
 #endif /* TYPES_H */
@@ -21,7 +21,7 @@ CPPFLAGS :=
 LDFLAGS := -Wl,--as-needed
 
 # Libraries
-LDLIBS := -lm -lpng
+LDLIBS := -lm -lpng -lpthread
 
 # Dependency creation flags
 DEPFLAGS := -MG -MP
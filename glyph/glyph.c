@@ -1,34 +1,32 @@
 #include "glyph.h"
 #include "outline.h"
 #include "../tables/tables.h"
-#include "../raster/bitmap.h"
+#include "../parse/parse.h"
 #include "../utils/utils.h"
 #include <stdlib.h>
 
-int32_t get_glyph_index(TTF_Font *font, int16_t c) {
+/* Published in place of an outline that failed to build, so that a broken
+ * glyph is only tried once. Never handed out. */
+static TTF_Outline no_outline;
+
+int32_t get_glyph_index(TTF_Font *font, uint32_t c) {
 	if (!font) {
 		return -1;
 	}
 	// Get cmap subtables
 	cmap_Table *cmap = get_cmap_table(font);
-	if (!cmap) {
+	if (!cmap || !cmap->active) {
 		warn("failed to get cmap table");
 		return -1;
 	}
 
-	int i;
-	for (i = 0; i < cmap->num_subtables; i++) {
-		cmap_subTable *subtable = &cmap->subtables[i];
-		if (!subtable->glyph_index_array || c < 0 || c >= subtable->num_indices) {
-			continue;
-		}
-		return subtable->glyph_index_array[c];
+	if (c < 256) {
+		return cmap->latin1[c];
 	}
-
-	return -1;
+	return cmap_subtable_lookup(cmap->active, c);
 }
 
-TTF_Glyph *get_glyph(TTF_Font *font, int16_t c) {
+TTF_Glyph *get_glyph(TTF_Font *font, uint32_t c) {
 	if (!font) {
 		return NULL;
 	}
@@ -40,14 +38,178 @@ TTF_Glyph *get_glyph(TTF_Font *font, int16_t c) {
 	}
 
 	// Lookup glyph index in cmap table
-	uint32_t glyph_index = get_glyph_index(font, c);
-	if (glyph_index < glyf->num_glyphs) {
-		TTF_Glyph *glyph = &glyf->glyphs[glyph_index];
-		glyph->index = glyph_index;
+	int32_t glyph_index = get_glyph_index(font, c);
+	if (glyph_index < 0) {
+		return NULL;
+	}
+
+	return get_glyph_by_index(font, glyph_index);
+}
+
+/**
+ * Find a glyph, decoding it on first access. Decoded glyphs are published
+ * with an atomic compare-and-swap, so lookups never lock. Threads that
+ * race to decode the same glyph each decode it, and all but the first to
+ * publish throw their copy away.
+ */
+static TTF_Glyph *find_glyph(TTF_Font *font, glyf_Table *glyf, uint32_t glyph_index) {
+	if (glyph_index >= glyf->num_glyphs) {
+		return NULL;
+	}
+
+	TTF_Glyph *glyph = __atomic_load_n(&glyf->glyphs[glyph_index], __ATOMIC_ACQUIRE);
+	if (glyph) {
 		return glyph;
 	}
 
-	return NULL;
+	/* First access - decode the glyph from the font data. */
+	glyph = calloc(1, sizeof(*glyph));
+	if (!glyph) {
+		warnerr("failed to alloc glyph");
+		return NULL;
+	}
+	glyph->index = glyph_index;
+	if (!load_glyph(font, glyph)) {
+		warn("failed to load glyph %u", glyph_index);
+		free_glyph(glyph);
+		free(glyph);
+		return NULL;
+	}
+
+	TTF_Glyph *published = NULL;
+	if (!__atomic_compare_exchange_n(&glyf->glyphs[glyph_index], &published, glyph, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		/* Another thread decoded it first. */
+		free_glyph(glyph);
+		free(glyph);
+		return published;
+	}
+
+	return glyph;
+}
+
+TTF_Glyph *get_glyph_by_index(TTF_Font *font, uint32_t glyph_index) {
+	if (!font) {
+		return NULL;
+	}
+	// Get glyf table
+	glyf_Table *glyf = get_glyf_table(font);
+	if (!glyf || !glyf->glyphs) {
+		warn("failed to get glyf table");
+		return NULL;
+	}
+
+	return find_glyph(font, glyf, glyph_index);
+}
+
+/**
+ * Publish a glyph's newly built outline, or no_outline if it failed to
+ * build, unless another thread published first. Returns the published
+ * outline, NULL for no_outline.
+ */
+static TTF_Outline *publish_outline(TTF_Glyph *glyph, TTF_Outline *outline) {
+	TTF_Outline *published = NULL;
+	if (!__atomic_compare_exchange_n(&glyph->outline, &published, outline, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		if (outline != &no_outline) {
+			free_outline(outline);
+		}
+		outline = published;
+	}
+	return (outline != &no_outline) ? outline : NULL;
+}
+
+/**
+ * Build a glyph's outline if it has not been built yet. Compound glyphs
+ * are assembled from their components' outlines, which are built (and
+ * kept for reuse by other glyphs) first. Outlines are published like
+ * glyphs, so this never locks.
+ *
+ * A compound glyph reached as a component may be cut short by the depth
+ * limit. Such an outline is only valid below this depth, so *truncated
+ * is set and the outline is not published: the caller owns it.
+ */
+static TTF_Outline *build_glyph_outline(TTF_Font *font, glyf_Table *glyf, TTF_Glyph *glyph, int depth,
+		int *truncated) {
+	TTF_Outline *outline = __atomic_load_n(&glyph->outline, __ATOMIC_ACQUIRE);
+	if (outline == &no_outline) {
+		return NULL;
+	} else if (outline || glyph->number_of_contours == 0) {
+		return outline;
+	} else if (glyph->number_of_contours > 0) {
+		if (!load_simple_glyph_outline(glyph, &outline)) {
+			warn("failed to build outline of glyph %u", glyph->index);
+			outline = &no_outline;
+		}
+		return publish_outline(glyph, outline);
+	}
+
+	/* Compound glyph - nesting is limited by maxp, and never unbounded.
+	 * The limit depends on how deep this glyph was reached, so hitting it
+	 * is not recorded: the glyph may still build from shallower parents. */
+	maxp_Table *maxp = get_maxp_table(font);
+	int max_depth = (maxp && maxp->max_component_depth > 0) ? maxp->max_component_depth : 1;
+	if (depth >= MIN(max_depth, MAX_COMPONENT_DEPTH)) {
+		warn("glyph %u exceeds the maximum component depth", glyph->index);
+		*truncated = 1;
+		return NULL;
+	}
+
+	TTF_Compound_Glyph *comp_glyph = &glyph->descrip.compound;
+	TTF_Outline **components = calloc(comp_glyph->num_comps, sizeof(*components));
+	uint8_t *owned = calloc(comp_glyph->num_comps, sizeof(*owned));
+	if (!components || !owned) {
+		warnerr("failed to alloc compound glyph components");
+		free(components);
+		free(owned);
+		return NULL;
+	}
+
+	for (int i = 0; i < comp_glyph->num_comps; i++) {
+		TTF_Glyph *comp = find_glyph(font, glyf, comp_glyph->comps[i].glyph_index);
+		if (comp) {
+			int comp_truncated = 0;
+			components[i] = build_glyph_outline(font, glyf, comp, depth + 1, &comp_truncated);
+			owned[i] = comp_truncated;
+			*truncated |= comp_truncated;
+		}
+	}
+	if (!load_compound_glyph_outline(glyph, components, &outline)) {
+		warn("failed to build outline of glyph %u", glyph->index);
+		outline = &no_outline;
+	}
+
+	for (int i = 0; i < comp_glyph->num_comps; i++) {
+		if (owned[i] && components[i]) {
+			free_outline(components[i]);
+		}
+	}
+	free(components);
+	free(owned);
+
+	if (*truncated && depth > 0) {
+		/* Only the top level's outline is the glyph's own. */
+		return (outline != &no_outline) ? outline : NULL;
+	}
+	return publish_outline(glyph, outline);
+}
+
+/**
+ * Get the glyph's unscaled outline, building it on first use. The outline
+ * is shared and must not be modified.
+ */
+TTF_Outline *get_glyph_outline(TTF_Font *font, TTF_Glyph *glyph) {
+	if (!font || !glyph) {
+		return NULL;
+	}
+	glyf_Table *glyf = get_glyf_table(font);
+	if (!glyf || !glyf->glyphs) {
+		warn("failed to get glyf table");
+		return NULL;
+	}
+
+	int truncated = 0;
+	return build_glyph_outline(font, glyf, glyph, 0, &truncated);
 }
 
 uint16_t get_glyph_advance_width(TTF_Font *font, TTF_Glyph *glyph) {
@@ -61,7 +223,7 @@ uint16_t get_glyph_advance_width(TTF_Font *font, TTF_Glyph *glyph) {
 		return 0;
 	}
 
-	return hmtx->advance_width[glyph->index];
+	return hmtx_advance_width(hmtx, glyph->index);
 }
 
 int16_t get_glyph_left_side_bearing(TTF_Font *font, TTF_Glyph *glyph) {
@@ -75,9 +237,24 @@ int16_t get_glyph_left_side_bearing(TTF_Font *font, TTF_Glyph *glyph) {
 		return 0;
 	}
 
+	if (glyph->index >= hmtx->num_h_metrics) {
+		uint32_t i = glyph->index - hmtx->num_h_metrics;
+		return (i < hmtx->num_non_horizontal_metrics) ? hmtx->non_horizontal_left_side_bearing[i] : 0;
+	}
 	return hmtx->left_side_bearing[glyph->index];
 }
 
+/**
+ * Get the kerning adjustment in font units to the advance of the left
+ * glyph when it is followed by the right glyph.
+ */
+int16_t get_glyph_kerning(TTF_Font *font, TTF_Glyph *left, TTF_Glyph *right) {
+	if (!font || !left || !right) {
+		return 0;
+	}
+	return kern_lookup(get_kern_table(font), left->index, right->index);
+}
+
 void free_simple_glyph(TTF_Glyph *glyph) {
 	if (!glyph) {
 		return;
@@ -117,10 +294,7 @@ void free_glyph(TTF_Glyph *glyph) {
 	if (glyph->instructions) {
 		free(glyph->instructions);
 	}
-	if (glyph->outline) {
+	if (glyph->outline && glyph->outline != &no_outline) {
 		free_outline(glyph->outline);
 	}
-	if (glyph->bitmap) {
-		free_bitmap(glyph->bitmap);
-	}
 }
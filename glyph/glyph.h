@@ -3,10 +3,13 @@
 
 #include "../base/types.h"
 
-int32_t get_glyph_index(TTF_Font *font, int16_t c);
-TTF_Glyph *get_glyph(TTF_Font *font, int16_t c);
+int32_t get_glyph_index(TTF_Font *font, uint32_t c);
+TTF_Glyph *get_glyph(TTF_Font *font, uint32_t c);
+TTF_Glyph *get_glyph_by_index(TTF_Font *font, uint32_t glyph_index);
+TTF_Outline *get_glyph_outline(TTF_Font *font, TTF_Glyph *glyph);
 uint16_t get_glyph_advance_width(TTF_Font *font, TTF_Glyph *glyph);
 int16_t get_glyph_left_side_bearing(TTF_Font *font, TTF_Glyph *glyph);
+int16_t get_glyph_kerning(TTF_Font *font, TTF_Glyph *left, TTF_Glyph *right);
 void free_glyph(TTF_Glyph *glyph);
 
 #endif /* GLYPH_H */
@@ -1,35 +1,90 @@
 #include "outline.h"
 #include "../utils/utils.h"
 #include <stdlib.h>
+#include <string.h>
 
 static inline uint16_t wrap(uint16_t x, uint16_t start, uint16_t end) {
 	return ((x - start) % (end - start + 1)) + start;
 }
 
-static int load_simple_glyph_contour(TTF_Glyph *glyph, TTF_Contour *contour, uint16_t start_pt, uint16_t end_pt) {
-	CHECKPTR(glyph);
-	CHECKPTR(contour);
+/**
+ * Bytes needed for an outline's arena, including the outline itself.
+ * Each allocation is padded to pointer alignment.
+ */
+static size_t outline_arena_size(int num_contours, int num_segments, int num_points, int num_glyph_points) {
+	size_t align = sizeof(void *) - 1;
+	size_t size = 0;
+	size += (sizeof(TTF_Outline) + align) & ~align;
+	size += (num_contours * sizeof(TTF_Contour) + align) & ~align;
+	size += num_contours * align;	/* Padding after each contour's segments. */
+	size += (num_segments * sizeof(TTF_Segment) + align) & ~align;
+	size += 2 * ((num_points * sizeof(float) + align) & ~align);
+	size += 2 * ((num_glyph_points * sizeof(float) + align) & ~align);
+	return size;
+}
 
-	RETINIT(SUCCESS);
+/**
+ * Allocate an outline and its arrays from a new arena sized for the given
+ * totals. Contour segments are allocated by the caller.
+ */
+static TTF_Outline *create_outline(int num_contours, int num_segments, int max_points, int num_glyph_points) {
+	TTF_Arena arena;
+	size_t size = outline_arena_size(num_contours, num_segments, max_points, num_glyph_points);
+	if (!init_arena(&arena, size)) {
+		return NULL;
+	}
+
+	TTF_Outline *outline = arena_alloc(&arena, sizeof(*outline));
+	outline->arena = arena;
+
+	outline->num_contours = num_contours;
+	outline->contours = arena_alloc(&outline->arena, num_contours * sizeof(*outline->contours));
+	outline->max_points = max_points;
+	outline->num_points = 0;
+	outline->x = arena_alloc(&outline->arena, max_points * sizeof(*outline->x));
+	outline->y = arena_alloc(&outline->arena, max_points * sizeof(*outline->y));
+	outline->num_glyph_points = num_glyph_points;
+	outline->glyph_x = arena_alloc(&outline->arena, num_glyph_points * sizeof(*outline->glyph_x));
+	outline->glyph_y = arena_alloc(&outline->arena, num_glyph_points * sizeof(*outline->glyph_y));
+
+	return outline;
+}
 
+/**
+ * Count the number of segments in a contour:
+ * number of on-curve points + interpolated on-curve points
+ */
+static int16_t count_contour_segments(TTF_Glyph *glyph, uint16_t start_pt, uint16_t end_pt) {
 	TTF_Simple_Glyph *simp_glyph = &glyph->descrip.simple;
-	contour->num_segments = 0;
+	int16_t num_segments = 0;
 
-	/* Count the number of segments in the contour:
-	 * number of on-curve points + interpolated on-curve points */
 	uint16_t i;
 	for (i = start_pt; i <= end_pt; i++) {
 		if ((simp_glyph->flags[i] & ON_CURVE)) {
-			contour->num_segments++;
+			num_segments++;
 		} else if (i > start_pt && !(simp_glyph->flags[i-1] & ON_CURVE)) {
 			/* Points j and j-1 are both off-curve,
 			 * interpolate an on-curve point between them. */
-			contour->num_segments++;
+			num_segments++;
 		}
 	}
 
-	contour->segments = malloc(contour->num_segments * sizeof(*contour->segments));
-	CHECKFAIL(contour->segments, warnerr("failed to alloc contour segments"));
+	return num_segments;
+}
+
+static int load_simple_glyph_contour(TTF_Outline *outline, TTF_Glyph *glyph, TTF_Contour *contour,
+		uint16_t start_pt, uint16_t end_pt) {
+	CHECKPTR(outline);
+	CHECKPTR(glyph);
+	CHECKPTR(contour);
+
+	RETINIT(SUCCESS);
+
+	TTF_Simple_Glyph *simp_glyph = &glyph->descrip.simple;
+	contour->num_segments = count_contour_segments(glyph, start_pt, end_pt);
+
+	contour->segments = arena_alloc(&outline->arena, contour->num_segments * sizeof(*contour->segments));
+	CHECKFAIL(contour->segments, warn("failed to alloc contour segments"));
 
 	uint16_t seg_start = start_pt;
 	uint16_t seg_index;
@@ -40,7 +95,7 @@ static int load_simple_glyph_contour(TTF_Glyph *glyph, TTF_Contour *contour, uin
 			/* Segment is a line */
 			segment->type = LINE_SEGMENT;
 
-			init_segment(segment, 2);
+			CHECKFAIL(init_segment(outline, segment, 2), warn("failed to alloc segment points"));
 
 			uint16_t j;
 			for (j = 0; j < 2; j++) {
@@ -54,7 +109,7 @@ static int load_simple_glyph_contour(TTF_Glyph *glyph, TTF_Contour *contour, uin
 			/* Segment is a curve */
 			segment->type = CURVE_SEGMENT;
 
-			init_segment(segment, 3);
+			CHECKFAIL(init_segment(outline, segment, 3), warn("failed to alloc segment points"));
 
 			uint16_t j;
 			for (j = 0; j < 2; j++) {
@@ -93,7 +148,7 @@ static int load_simple_glyph_contour(TTF_Glyph *glyph, TTF_Contour *contour, uin
 
 					segment->type = CURVE_SEGMENT;
 
-					init_segment(segment, 3);
+					CHECKFAIL(init_segment(outline, segment, 3), warn("failed to alloc segment points"));
 
 					segment->x[0] = contour->segments[seg_index-1].x[2];
 					segment->y[0] = contour->segments[seg_index-1].y[2];
@@ -114,104 +169,244 @@ static int load_simple_glyph_contour(TTF_Glyph *glyph, TTF_Contour *contour, uin
 	RET;
 }
 
-int load_simple_glyph_outline(TTF_Glyph *glyph) {
+int load_simple_glyph_outline(TTF_Glyph *glyph, TTF_Outline **result) {
 	CHECKPTR(glyph);
+	CHECKPTR(result);
 
 	RETINIT(SUCCESS);
 
-	TTF_Outline *outline = malloc(sizeof(*outline));
-	CHECKFAIL(outline, warnerr("failed to alloc glyph outline"));
+	TTF_Outline *outline = NULL;
 
-	glyph->outline = outline;
+	/* Size the arena up front: every segment has at most 3 points. */
+	int32_t num_segments = 0;
+	int i;
+	for (i = 0; i < glyph->number_of_contours; i++) {
+		uint16_t start_pt = (i > 0) ? glyph->descrip.simple.end_pts_of_contours[i-1] + 1 : 0;
+		uint16_t end_pt = glyph->descrip.simple.end_pts_of_contours[i];
+		num_segments += count_contour_segments(glyph, start_pt, end_pt);
+	}
+	int32_t max_points = 3 * num_segments;
+	int32_t num_glyph_points = glyph->descrip.simple.end_pts_of_contours[glyph->number_of_contours-1] + 1;
 
-	outline->num_contours = glyph->number_of_contours;
+	outline = create_outline(glyph->number_of_contours, num_segments, max_points, num_glyph_points);
+	CHECKFAIL(outline, warn("failed to alloc glyph outline"));
 
-	outline->contours = malloc(outline->num_contours * sizeof(*outline->contours));
-	CHECKFAIL(outline->contours, warnerr("failed to alloc outline contours"));
+	for (i = 0; i < num_glyph_points; i++) {
+		outline->glyph_x[i] = glyph->descrip.simple.x_coordinates[i];
+		outline->glyph_y[i] = glyph->descrip.simple.y_coordinates[i];
+	}
 
 	outline->x_min = glyph->x_min;
 	outline->y_min = glyph->y_min;
 	outline->x_max = glyph->x_max;
 	outline->y_max = glyph->y_max;
 
-	int i;
 	for (i = 0; i < glyph->number_of_contours; i++) {
 		TTF_Contour *contour = &outline->contours[i];
 		uint16_t start_pt = (i > 0) ? glyph->descrip.simple.end_pts_of_contours[i-1] + 1 : 0;
 		uint16_t end_pt = glyph->descrip.simple.end_pts_of_contours[i];
 
-		load_simple_glyph_contour(glyph, contour, start_pt, end_pt);
+		CHECKFAIL(load_simple_glyph_contour(outline, glyph, contour, start_pt, end_pt),
+				warn("failed to load glyph contour"));
 	}
 
-	// Outline is unscaled
-	outline->point = -1;
+	*result = outline;
 
 	RETFAIL(free_outline(outline));
 }
 
-int load_glyph_outline(TTF_Glyph *glyph) {
+/**
+ * Apply a component's 2x2 transform (no offset) to a point.
+ */
+static inline void transform_point(TTF_Compound_Comp *comp, float x, float y, float *tx, float *ty) {
+	*tx = comp->xscale * x + comp->scale10 * y;
+	*ty = comp->scale01 * x + comp->yscale * y;
+}
+
+/**
+ * Assemble a compound glyph's outline from its components' outlines.
+ * components[i] is the unscaled outline of component i, or NULL if the
+ * component has no outline. Component outlines are only read.
+ */
+int load_compound_glyph_outline(TTF_Glyph *glyph, TTF_Outline **components, TTF_Outline **result) {
 	CHECKPTR(glyph);
+	CHECKPTR(components);
+	CHECKPTR(result);
 
-	if (glyph->number_of_contours > 0) {
-		load_simple_glyph_outline(glyph);
-	} else {
-		// TODO: handle compound glyph outlines
+	RETINIT(SUCCESS);
+
+	TTF_Outline *outline = NULL;
+	TTF_Compound_Glyph *comp_glyph = &glyph->descrip.compound;
+
+	int num_contours = 0, num_segments = 0, max_points = 0, num_glyph_points = 0;
+	for (int i = 0; i < comp_glyph->num_comps; i++) {
+		TTF_Outline *comp = components[i];
+		if (!comp) {
+			continue;
+		}
+		num_contours += comp->num_contours;
+		for (int j = 0; j < comp->num_contours; j++) {
+			num_segments += comp->contours[j].num_segments;
+		}
+		max_points += comp->num_points;
+		num_glyph_points += comp->num_glyph_points;
 	}
 
-	return SUCCESS;
-}
+	outline = create_outline(num_contours, num_segments, max_points, num_glyph_points);
+	CHECKFAIL(outline, warn("failed to alloc glyph outline"));
 
-int init_segment(TTF_Segment *segment, int num_points) {
-	CHECKPTR(segment);
+	outline->x_min = glyph->x_min;
+	outline->y_min = glyph->y_min;
+	outline->x_max = glyph->x_max;
+	outline->y_max = glyph->y_max;
 
-	RETINIT(SUCCESS);
+	int contour_index = 0, glyph_point = 0;
+	for (int i = 0; i < comp_glyph->num_comps; i++) {
+		TTF_Compound_Comp *comp = &comp_glyph->comps[i];
+		TTF_Outline *src = components[i];
+		if (!src) {
+			continue;
+		}
 
-	segment->x = malloc(num_points * sizeof(*segment->x));
-	CHECKFAIL(segment->x, warnerr("failed to alloc segment x-coordinates"));
+		/* Offset the component either directly or by matching a point of
+		 * the component to a point already placed in the glyph. */
+		float dx, dy;
+		if ((comp->flags & ARGS_ARE_XY_VALUES) &&
+				(comp->flags & (SCALED_COMPONENT_OFFSET | UNSCALED_COMPONENT_OFFSET)) == SCALED_COMPONENT_OFFSET) {
+			transform_point(comp, comp->xtranslate, comp->ytranslate, &dx, &dy);
+		} else if (comp->flags & ARGS_ARE_XY_VALUES) {
+			dx = comp->xtranslate;
+			dy = comp->ytranslate;
+		} else {
+			CHECKFAIL(comp->point1 < glyph_point && comp->point2 < src->num_glyph_points,
+					warn("invalid compound glyph point match %hu, %hu", comp->point1, comp->point2));
+			float px, py;
+			transform_point(comp, src->glyph_x[comp->point2], src->glyph_y[comp->point2], &px, &py);
+			dx = outline->glyph_x[comp->point1] - px;
+			dy = outline->glyph_y[comp->point1] - py;
+		}
+
+		for (int j = 0; j < src->num_contours; j++) {
+			TTF_Contour *from = &src->contours[j];
+			TTF_Contour *to = &outline->contours[contour_index++];
+
+			to->num_segments = from->num_segments;
+			to->segments = arena_alloc(&outline->arena, to->num_segments * sizeof(*to->segments));
+			CHECKFAIL(to->segments, warn("failed to alloc contour segments"));
+
+			for (int k = 0; k < from->num_segments; k++) {
+				TTF_Segment *segment = &to->segments[k];
+				segment->type = from->segments[k].type;
+				CHECKFAIL(init_segment(outline, segment, from->segments[k].num_points),
+						warn("failed to alloc segment points"));
+				for (int n = 0; n < segment->num_points; n++) {
+					transform_point(comp, from->segments[k].x[n], from->segments[k].y[n],
+							&segment->x[n], &segment->y[n]);
+					segment->x[n] += dx;
+					segment->y[n] += dy;
+				}
+			}
+		}
 
-	segment->y = malloc(num_points *sizeof(*segment->y));
-	CHECKFAIL(segment->y, warnerr("failed to alloc segment y-coordinates"));
+		for (int n = 0; n < src->num_glyph_points; n++, glyph_point++) {
+			transform_point(comp, src->glyph_x[n], src->glyph_y[n],
+					&outline->glyph_x[glyph_point], &outline->glyph_y[glyph_point]);
+			outline->glyph_x[glyph_point] += dx;
+			outline->glyph_y[glyph_point] += dy;
+		}
+	}
 
-	segment->num_points = num_points;
+	*result = outline;
 
-	RETFAIL(free_segment(segment));
+	RETFAIL(free_outline(outline));
 }
 
-void free_segment(TTF_Segment *segment) {
-	if (!segment) {
-		return;
+/**
+ * Copy an outline into arena, replacing whatever the arena held and
+ * growing it if needed. The copy lives until the arena is reused or freed,
+ * and must not be passed to free_outline.
+ */
+static TTF_Outline *copy_outline_to(TTF_Outline *outline, TTF_Arena *arena) {
+	if (!outline || !arena) {
+		return NULL;
 	}
-	if (segment->x) {
-		free(segment->x);
+
+	if (arena->size < outline->arena.used) {
+		free_arena(arena);
+		if (!init_arena(arena, outline->arena.used)) {
+			warn("failed to alloc outline copy");
+			return NULL;
+		}
 	}
-	if (segment->y) {
-		free(segment->y);
+	memcpy(arena->base, outline->arena.base, outline->arena.used);
+	arena->used = outline->arena.used;
+
+	/* Rebase the copied pointers from the source block to the new one. */
+#define REBASE(p) ((void *)(arena->base + ((uint8_t *)(p) - outline->arena.base)))
+	TTF_Outline *copy = (TTF_Outline *)arena->base;
+	copy->arena = *arena;
+	copy->contours = REBASE(outline->contours);
+	copy->x = REBASE(outline->x);
+	copy->y = REBASE(outline->y);
+	copy->glyph_x = REBASE(outline->glyph_x);
+	copy->glyph_y = REBASE(outline->glyph_y);
+	for (int i = 0; i < copy->num_contours; i++) {
+		TTF_Contour *contour = &copy->contours[i];
+		contour->segments = REBASE(contour->segments);
+		for (int j = 0; j < contour->num_segments; j++) {
+			contour->segments[j].x = REBASE(contour->segments[j].x);
+			contour->segments[j].y = REBASE(contour->segments[j].y);
+		}
 	}
+#undef REBASE
+
+	return copy;
 }
 
-void free_contour(TTF_Contour *contour) {
-	if (!contour) {
-		return;
+/**
+ * Make a copy of an outline, e.g. to modify it without touching the shared
+ * original. The arena is copied in one go and its pointers rebased.
+ */
+TTF_Outline *copy_outline(TTF_Outline *outline) {
+	if (!outline) {
+		return NULL;
 	}
-	if (contour->segments) {
-		int i;
-		for (i = 0; i < contour->num_segments; i++) {
-			free_segment(&contour->segments[i]);
-		}
-		free(contour->segments);
+
+	TTF_Arena arena = { NULL, 0, 0 };
+	TTF_Outline *copy = copy_outline_to(outline, &arena);
+	if (!copy) {
+		free_arena(&arena);
 	}
+	return copy;
 }
 
+/**
+ * Point a segment at the next num_points unused points of the outline.
+ */
+int init_segment(TTF_Outline *outline, TTF_Segment *segment, int num_points) {
+	CHECKPTR(outline);
+	CHECKPTR(segment);
+
+	if (outline->num_points + num_points > outline->max_points) {
+		return FAILURE;
+	}
+
+	segment->x = &outline->x[outline->num_points];
+	segment->y = &outline->y[outline->num_points];
+	segment->num_points = num_points;
+	outline->num_points += num_points;
+
+	return SUCCESS;
+}
+
+/**
+ * Release an outline with everything it contains in one step.
+ */
 void free_outline(TTF_Outline *outline) {
 	if (!outline) {
 		return;
 	}
-	if (outline->contours) {
-		int i;
-		for (i = 0; i < outline->num_contours; i++) {
-			free_contour(&outline->contours[i]);
-		}
-		free(outline->contours);
-	}
-	free(outline);
+	/* The outline lives inside its own arena. */
+	TTF_Arena arena = outline->arena;
+	free_arena(&arena);
 }
@@ -3,12 +3,13 @@
 
 #include "../base/types.h"
 
-int load_glyph_outline(TTF_Glyph *glyph);
+int load_simple_glyph_outline(TTF_Glyph *glyph, TTF_Outline **result);
+int load_compound_glyph_outline(TTF_Glyph *glyph, TTF_Outline **components, TTF_Outline **result);
 
-int init_segment(TTF_Segment *segment, int num_points);
+TTF_Outline *copy_outline(TTF_Outline *outline);
+
+int init_segment(TTF_Outline *outline, TTF_Segment *segment, int num_points);
 
-void free_segment(TTF_Segment *segment);
-void free_contour(TTF_Contour *contour);
 void free_outline(TTF_Outline *outline);
 
 #endif /* OUTLINE_H */
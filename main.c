@@ -2,24 +2,79 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
-#include <math.h>
+#include <stdio.h>
 
 #define FONT_FILENAME "data/Vera.ttf"
 #define OUTPUT_FILE "data/output.png"
 #define FONT_SIZE 12
 #define SCREEN_DPI 96
+#define BAND_HEIGHT 256
+
+typedef struct _Band_Sink {
+	TTF_Output *output;
+	int apply_gamma;
+	float gamma;
+} Band_Sink;
+
+static int emit_band(void *data, TTF_Bitmap *band, int y, int num_rows) {
+	Band_Sink *sink = data;
+	(void)y;
+	if (sink->apply_gamma) {
+		set_bitmap_gamma(band, sink->gamma);
+	}
+	return output_rows(sink->output, band, 0, num_rows);
+}
+
+static char *read_text_file(const char *filename) {
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) {
+		warnerr("failed to open text file '%s'", filename);
+		return NULL;
+	}
+	char *text = NULL;
+	size_t size = 0, len = 0;
+	for (;;) {
+		if (len + 1 >= size) {
+			size = (size) ? size * 2 : 4096;
+			char *grown = realloc(text, size);
+			if (!grown) {
+				warnerr("failed to alloc text");
+				free(text);
+				fclose(fp);
+				return NULL;
+			}
+			text = grown;
+		}
+		size_t n = fread(&text[len], 1, size - len - 1, fp);
+		if (n == 0) {
+			break;
+		}
+		len += n;
+	}
+	text[len] = '\0';
+	fclose(fp);
+	return text;
+}
 
 int main(int argc, char* argv[]) {
 	char *font_filename = FONT_FILENAME;
 	int font_size = FONT_SIZE;
 	int screen_dpi = SCREEN_DPI;
-	int render_method = RENDER_FP;
+	int render_method = RENDER_AAA;
+	int linear = 0;
+	int subpixel = 0;
+	uint32_t color = 0x000000;
 	int apply_gamma = 0;
 	float gamma = 1.00;
 	char *output_file = OUTPUT_FILE;
+	char *text_file = NULL;
+	int band_height = BAND_HEIGHT;
+	int num_threads = -1;
+	TTF_Output_Options output_options;
+	init_output_options(&output_options);
 
 	int c;
-	while ((c = getopt(argc, argv, "f:s:d:m:g:o:")) != -1) {
+	while ((c = getopt(argc, argv, "f:s:d:m:c:lpg:o:z:Gi:b:j:")) != -1) {
 		switch (c) {
 			case 'f':
 				font_filename = optarg;
@@ -37,11 +92,22 @@ int main(int argc, char* argv[]) {
 					render_method = RENDER_FPAA;
 				} else if (strcmp(optarg, "aspaa") == 0) {
 					render_method = RENDER_ASPAA;
+				} else if (strcmp(optarg, "aaa") == 0) {
+					render_method = RENDER_AAA;
 				} else {
 					warn("invalid rendering method '%s'", optarg);
 					exit(EXIT_FAILURE);
 				}
 				break;
+			case 'c':
+				color = strtoul(optarg, NULL, 16);
+				break;
+			case 'l':
+				linear = 1;
+				break;
+			case 'p':
+				subpixel = 1;
+				break;
 			case 'g':
 				gamma = atof(optarg);
 				apply_gamma = 1;
@@ -49,40 +115,83 @@ int main(int argc, char* argv[]) {
 			case 'o':
 				output_file = optarg;
 				break;
+			case 'z':
+				output_options.level = atoi(optarg);
+				break;
+			case 'G':
+				output_options.grey = 1;
+				break;
+			case 'i':
+				text_file = optarg;
+				break;
+			case 'b':
+				band_height = MAX(atoi(optarg), 1);
+				break;
+			case 'j':
+				num_threads = atoi(optarg);
+				break;
 			default:
 				break;
 		}
 	}
 
-	char *string;
-	if (optind < argc) {
+	char *string = NULL;
+	char *text = NULL;
+	if (text_file) {
+		text = read_text_file(text_file);
+		if (!text) {
+			exit(EXIT_FAILURE);
+		}
+		string = text;
+	} else if (optind < argc) {
 		string = argv[optind];
 	} else {
 		string = "m";
 	}
 
 	TTF_Font *font = load_font(font_filename);
-	raster_init(font, font_size, screen_dpi, render_method);
-
-	/* Calculate required size for output bitmap. */
-	int16_t ascent = funit_to_pixel(font, get_font_ascent(font));
-	int16_t descent = fabsf(funit_to_pixel(font, get_font_descent(font)));
-	int text_width = get_text_width(font, string);
-	int padding = 10;
-
-	TTF_Bitmap *out = create_bitmap(text_width + 2*padding, (ascent + descent) + 2*padding, 0xFFFFFF);
-
-	draw_string(font, out, (out->w - text_width)/2, (out->h - (ascent + descent))/2 + ascent, string);
+	if (!font) {
+		free(text);
+		exit(EXIT_FAILURE);
+	}
+	TTF_Raster *raster = create_raster(font, font_size, screen_dpi,
+			render_method | ((linear) ? RENDER_LINEAR : 0) | ((subpixel) ? RENDER_SUBPIXEL : 0));
+	if (!raster) {
+		free_font(font);
+		free(text);
+		exit(EXIT_FAILURE);
+	}
+	raster_color(raster, color);
 
-	if (apply_gamma) {
-		set_bitmap_gamma(out, gamma);
+	/* -j 0 uses one thread per CPU. */
+	TTF_Raster_Pool *pool = NULL;
+	if (num_threads >= 0) {
+		pool = create_raster_pool(num_threads, 1);
 	}
 
-	if (out) {
-		save_bitmap(out, output_file, NULL);
-		free_bitmap(out);
+	/* Lay the text out once, then draw and write it a band at a time. */
+	int status = EXIT_FAILURE;
+	int padding = 10;
+	TTF_Layout *layout = layout_text(raster, string);
+	if (layout) {
+		int w = layout->w + 2*padding;
+		int h = layout->h + 2*padding;
+		TTF_Bitmap *band = create_bitmap(w, MIN(band_height, h), 0xFFFFFF, PIXEL_RGB32);
+		TTF_Output *output = (band) ? open_output(output_file, w, h, PIXEL_RGB32, &output_options) : NULL;
+		if (output) {
+			Band_Sink sink = { output, apply_gamma, gamma };
+			int rendered = render_bands(raster, pool, layout, padding, padding, band, h, emit_band, &sink);
+			if (close_output(output) && rendered) {
+				status = EXIT_SUCCESS;
+			}
+		}
+		free_bitmap(band);
+		free_layout(layout);
 	}
 
+	free_raster_pool(pool);
+	free_raster(raster);
 	free_font(font);
-	return EXIT_SUCCESS;
+	free(text);
+	return status;
 }
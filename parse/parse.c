@@ -4,6 +4,8 @@
 #include "../utils/utils.h"
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -270,66 +272,113 @@ const char *mac_encoding[258] = {
 	[257] =	"dcroat"
 };
 
-uint8_t read_byte(int fd) {
-	uint8_t b;
-	if (read(fd, &b, sizeof(uint8_t)) < 0) {
-		warnerr("failed to read byte");
+/**
+ * Take n bytes from the buffer at its current position.
+ * Returns NULL (and leaves the cursor at the end of the buffer)
+ * if fewer than n bytes remain.
+ */
+static inline const uint8_t *buffer_take(TTF_Buffer *buf, size_t n) {
+	if (n > buf->size - buf->pos) {
+		if (!buf->overrun) {
+			warn("attempted to read past end of font data");
+		}
+		buf->overrun = 1;
+		buf->pos = buf->size;
+		return NULL;
 	}
-	return b;
+	const uint8_t *p = buf->data + buf->pos;
+	buf->pos += n;
+	return p;
+}
+
+int init_buffer(TTF_Buffer *buf, const uint8_t *data, size_t size) {
+	CHECKPTR(buf);
+
+	buf->data = data;
+	buf->size = (data) ? size : 0;
+	buf->pos = 0;
+	buf->overrun = 0;
+
+	return SUCCESS;
 }
 
-uint16_t read_hword(int fd) {
-	uint16_t hw;
-	if (read(fd, &hw, sizeof(uint16_t)) < 0) {
-		warnerr("failed to read hword");
+int buffer_seek(TTF_Buffer *buf, size_t offset) {
+	CHECKPTR(buf);
+
+	if (offset > buf->size) {
+		warn("failed to seek to offset %zu in font data of size %zu", offset, buf->size);
+		return FAILURE;
+	}
+	buf->pos = offset;
+
+	return SUCCESS;
+}
+
+int buffer_skip(TTF_Buffer *buf, size_t n) {
+	CHECKPTR(buf);
+
+	return (buffer_take(buf, n) != NULL);
+}
+
+uint8_t read_byte(TTF_Buffer *buf) {
+	const uint8_t *p = buffer_take(buf, sizeof(uint8_t));
+	return (p) ? p[0] : 0;
+}
+
+uint16_t read_hword(TTF_Buffer *buf) {
+	uint16_t hw = 0;
+	const uint8_t *p = buffer_take(buf, sizeof(uint16_t));
+	if (p) {
+		memcpy(&hw, p, sizeof(hw));
 	}
 	return hw;
 }
 
-uint32_t read_word(int fd) {
-	uint32_t w;
-	if (read(fd, &w, sizeof(uint32_t)) < 0) {
-		warnerr("failed to read word");
+uint32_t read_word(TTF_Buffer *buf) {
+	uint32_t w = 0;
+	const uint8_t *p = buffer_take(buf, sizeof(uint32_t));
+	if (p) {
+		memcpy(&w, p, sizeof(w));
 	}
 	return w;
 }
 
-uint64_t read_dword(int fd) {
-	uint64_t dw;
-	if (read(fd, &dw, sizeof(uint64_t)) < 0) {
-		warnerr("failed to read dword");
+uint64_t read_dword(TTF_Buffer *buf) {
+	uint64_t dw = 0;
+	const uint8_t *p = buffer_take(buf, sizeof(uint64_t));
+	if (p) {
+		memcpy(&dw, p, sizeof(dw));
 	}
 	return dw;
 }
 
-uint16_t read_ushort(int fd) {
-	uint16_t hw = read_hword(fd);
-	uint8_t *b = (uint8_t *)&hw;
-	return (b[0] << 8) | (b[1] << 0);
+uint16_t read_ushort(TTF_Buffer *buf) {
+	const uint8_t *b = buffer_take(buf, sizeof(uint16_t));
+	return (b) ? (b[0] << 8) | (b[1] << 0) : 0;
 }
 
-int16_t read_short(int fd) {
-	uint16_t us = read_ushort(fd);
-	return (us >= 0x8000) ? us - 0x10000 : us;
+int16_t read_short(TTF_Buffer *buf) {
+	return (int16_t) read_ushort(buf);
 }
 
-uint32_t read_ulong(int fd) {
-	uint32_t w = read_word(fd);
-	uint8_t *b = (uint8_t *)&w;
-	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | (b[3] << 0);
+uint32_t read_ulong(TTF_Buffer *buf) {
+	const uint8_t *b = buffer_take(buf, sizeof(uint32_t));
+	return (b) ? ((uint32_t)b[0] << 24) | (b[1] << 16) | (b[2] << 8) | (b[3] << 0) : 0;
 }
 
-uint32_t read_fixed(int fd) {
-	return read_ulong(fd);
+uint32_t read_fixed(TTF_Buffer *buf) {
+	return read_ulong(buf);
 }
 
-uint32_t read_tag(int fd) {
-	return read_word(fd);
+uint32_t read_tag(TTF_Buffer *buf) {
+	return read_word(buf);
 }
 
-int64_t read_longdatetime(int fd) {
-	uint64_t dw = read_dword(fd);
-	uint8_t *b = (uint8_t *)&dw;
+int64_t read_longdatetime(TTF_Buffer *buf) {
+	const uint8_t *b = buffer_take(buf, sizeof(uint64_t));
+	if (!b) {
+		return 0;
+	}
 	return ((int64_t)b[0] << 56) | ((int64_t)b[1] << 48) |
 		   ((int64_t)b[2] << 40) | ((int64_t)b[3] << 32) |
 		   ((int64_t)b[4] << 24) | ((int64_t)b[5] << 16) |
@@ -349,21 +398,21 @@ uint32_t s_to_tag(const char *s) {
 }
 
 int read_font_dir(TTF_Font *font) {
-	// Seek to start of file
-	if (lseek(font->fd, 0, SEEK_SET) < 0) {
-		warnerr("failed to seek to font dir");
+	// Seek to start of font data
+	if (!buffer_seek(&font->buf, 0)) {
+		warn("failed to seek to font dir");
 		return 0;
 	}
 
 	// Read offset subtable
-	font->scaler_type = read_fixed(font->fd);
-	font->num_tables = read_ushort(font->fd);
-	font->search_range = read_ushort(font->fd);
-	font->entry_selector = read_ushort(font->fd);
-	font->range_shift = read_ushort(font->fd);
+	font->scaler_type = read_fixed(&font->buf);
+	font->num_tables = read_ushort(&font->buf);
+	font->search_range = read_ushort(&font->buf);
+	font->entry_selector = read_ushort(&font->buf);
+	font->range_shift = read_ushort(&font->buf);
 
 	// Ensure that 12 bytes have been read
-	if (lseek(font->fd, 0, SEEK_CUR) != 12) {
+	if (font->buf.overrun || font->buf.pos != 12) {
 		warn("incorrect number of bytes in offset subtable");
 		return 0;
 	}
@@ -383,12 +432,18 @@ int read_font_dir(TTF_Font *font) {
 	for (i = 0; i < font->num_tables; i++) {
 		TTF_Table *table = &font->tables[i];
 
-		table->tag = read_tag(font->fd);
-		table->check_sum = read_ulong(font->fd);
-		table->offset = read_ulong(font->fd);
-		table->length = read_ulong(font->fd);
+		table->tag = read_tag(&font->buf);
+		table->check_sum = read_ulong(&font->buf);
+		table->offset = read_ulong(&font->buf);
+		table->length = read_ulong(&font->buf);
 
 		table->status = STATUS_NONE;
+
+		/* Index known tables so that they can be found without a search. */
+		int slot = get_table_slot(table->tag);
+		if (slot >= 0 && !font->table_index[slot]) {
+			font->table_index[slot] = table;
+		}
 	}
 
 	return 1;
@@ -396,27 +451,20 @@ int read_font_dir(TTF_Font *font) {
 
 int read_table_raw(TTF_Font *font, TTF_Table *table, uint32_t *buf) {
 	// Seek to start of table
-	if (lseek(font->fd, table->offset, SEEK_SET) < 0) {
-		warnerr("failed to seek to font table");
+	if (!buffer_seek(&font->buf, table->offset)) {
+		warn("failed to seek to font table");
 		return 0;
 	}
 
-	uint32_t *p = buf;
-	size_t n_bytes = table->length;
-	size_t bytes_left = n_bytes;
-	ssize_t bytes_read = 0;
-
-	// Read n_bytes from the font file descriptor
-	while (bytes_read < (ssize_t)n_bytes) {
-		if ((bytes_read = read(font->fd, p, bytes_left)) < 0) {
-			warnerr("failed to read raw table");
-			break;
-		}
-		p += bytes_read;
-		bytes_left -= bytes_read;
+	// Copy the table's bytes out of the font data
+	const uint8_t *p = buffer_take(&font->buf, table->length);
+	if (!p) {
+		warn("failed to read raw table");
+		return 0;
 	}
+	memcpy(buf, p, table->length);
 
-	return (bytes_read == (ssize_t)n_bytes);
+	return 1;
 }
 
 uint32_t calc_table_check_sum(uint32_t *data, uint32_t length) {
@@ -459,200 +507,237 @@ int validate_check_sums(TTF_Font *font) {
 	return 1;
 }
 
-int load_cmap_subtable(TTF_Font *font, cmap_subTable *subtable) {
-	maxp_Table *maxp = get_maxp_table(font);
-	if (!maxp) {
-		warn("failed to get maxp table");
+static int alloc_cmap_segments(cmap_subTable *subtable, uint32_t num_segments, uint32_t num_glyph_ids) {
+	subtable->num_segments = num_segments;
+	subtable->segments = (cmap_Segment *) calloc(num_segments, sizeof(*subtable->segments));
+	if (!subtable->segments) {
+		warnerr("failed to alloc cmap segments");
 		return 0;
 	}
+	subtable->num_glyph_ids = num_glyph_ids;
+	if (num_glyph_ids > 0) {
+		subtable->glyph_ids = (uint16_t *) malloc(num_glyph_ids * sizeof(*subtable->glyph_ids));
+		if (!subtable->glyph_ids) {
+			warnerr("failed to alloc cmap glyph ids");
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int load_cmap_subtable(TTF_Font *font, cmap_subTable *subtable) {
+	TTF_Buffer *buf = &font->buf;
+	size_t start = buf->pos;
 
-	subtable->format = read_ushort(font->fd);
+	subtable->format = read_ushort(buf);
 	if (subtable->format < 8) {
-		subtable->length = read_ushort(font->fd);
-		subtable->language = read_ushort(font->fd);
+		subtable->length = read_ushort(buf);
+		subtable->language = read_ushort(buf);
 	} else {
-		read_ushort(font->fd); // format was actually a Fixed, this is the .X part
-		subtable->length = read_ulong(font->fd);
-		subtable->language = read_ulong(font->fd);
+		read_ushort(buf); // format was actually a Fixed, this is the .X part
+		subtable->length = read_ulong(buf);
+		subtable->language = read_ulong(buf);
 	}
 	switch (subtable->format) {
 		case 0:
 			{
-				subtable->num_indices = 256;
-
-				subtable->glyph_index_array = (uint32_t *) malloc(256 * sizeof(*subtable->glyph_index_array));
-				if (!subtable->glyph_index_array) {
-					warnerr("failed to alloc cmap format 0 glyph index array");
+				/* Byte encoding table: one segment covering 0..255. */
+				if (!alloc_cmap_segments(subtable, 1, 256)) {
 					return 0;
 				}
+				subtable->segments[0].start_code = 0;
+				subtable->segments[0].end_code = 255;
+				subtable->segments[0].id_offset = 0;
+
 				int i;
 				for (i = 0; i < 256; i++) {
-					uint8_t glyph_mapping = read_byte(font->fd);
-					subtable->glyph_index_array[i] = (glyph_mapping + 256) % 256;
+					subtable->glyph_ids[i] = read_byte(buf);
 				}
 			}
 			break;
 		case 4:
 			{
-				int i;
-				uint16_t seg_count = read_ushort(font->fd) / 2;
-//				uint16_t search_range = read_ushort(font->fd);
-//				uint16_t entry_selector = read_ushort(font->fd);
-//				uint16_t range_shift = read_ushort(font->fd);
-
-				// Skip next 3 hwords
-				if (lseek(font->fd, 3 * sizeof(uint16_t), SEEK_CUR) < 0) {
-					warnerr("failed to seek in cmap subtable format 4");
-					return 0;
-				}
+				uint16_t seg_count = read_ushort(buf) / 2;
 
-				// Alloc arrays
-				uint16_t *end_code = (uint16_t *) malloc(seg_count * sizeof(*end_code));
-				if (!end_code) {
-					warnerr("failed to alloc cmap format 4 endCode array");
-					return 0;
-				}
-				uint16_t *start_code = (uint16_t *) malloc(seg_count * sizeof(*start_code));
-				if (!start_code) {
-					warnerr("failed to alloc cmap format 4 startCode array");
-					return 0;
-				}
-				uint16_t *id_delta = (uint16_t *) malloc(seg_count * sizeof(*id_delta));
-				if (!id_delta) {
-					warnerr("failed to alloc cmap format 4 idDelta array");
+				// Skip searchRange, entrySelector and rangeShift
+				if (!buffer_skip(buf, 3 * sizeof(uint16_t))) {
+					warn("failed to seek in cmap subtable format 4");
 					return 0;
 				}
-				uint16_t *id_range_offset = (uint16_t *) malloc(seg_count * sizeof(*id_range_offset));
-				if (!id_range_offset) {
-					warnerr("failed to alloc cmap format 4 idRangeOffset array");
+
+				/* The glyphIdArray fills the rest of the subtable. */
+				uint32_t header_length = 16 + 8 * seg_count;
+				uint32_t num_glyph_ids = (subtable->length > header_length) ?
+					(subtable->length - header_length) / 2 : 0;
+
+				if (!alloc_cmap_segments(subtable, seg_count, num_glyph_ids)) {
 					return 0;
 				}
 
 				// Read arrays
+				int i;
 				for (i = 0; i < seg_count; i++) {
-					end_code[i] = read_ushort(font->fd);
+					subtable->segments[i].end_code = read_ushort(buf);
 				}
-//				uint16_t reserved_pad = read_ushort(font->fd);
-				// Skip one hword
-				if (lseek(font->fd, sizeof(uint16_t), SEEK_CUR) < 0) {
-					warnerr("failed to seek in cmap subtable");
+				// Skip reservedPad
+				if (!buffer_skip(buf, sizeof(uint16_t))) {
+					warn("failed to seek in cmap subtable");
 					return 0;
 				}
 				for (i = 0; i < seg_count; i++) {
-					start_code[i] = read_ushort(font->fd);
+					subtable->segments[i].start_code = read_ushort(buf);
 				}
 				for (i = 0; i < seg_count; i++) {
-					id_delta[i] = read_ushort(font->fd);
+					subtable->segments[i].id_delta = read_ushort(buf);
 				}
 				for (i = 0; i < seg_count; i++) {
-					id_range_offset[i] = read_ushort(font->fd);
+					uint16_t range_offset = read_ushort(buf);
+					if (range_offset == 0) {
+						subtable->segments[i].id_offset = -1;
+					} else {
+						/* idRangeOffset is relative to its own position in the
+						 * idRangeOffset array - rebase it onto glyphIdArray. */
+						subtable->segments[i].id_offset = (range_offset / 2) - (seg_count - i);
+					}
+				}
+				for (i = 0; i < (int)num_glyph_ids; i++) {
+					subtable->glyph_ids[i] = read_ushort(buf);
 				}
 
-				subtable->num_indices = maxp->num_glyphs;
+				/* The final 0xFFFF segment only terminates the list. */
+				if (seg_count > 0 && subtable->segments[seg_count-1].start_code == 0xFFFF) {
+					subtable->num_segments--;
+				}
+			}
+			break;
+		case 6:
+			{
+				/* Trimmed table mapping: one dense segment. */
+				uint16_t first_code = read_ushort(buf);
+				uint16_t entry_count = read_ushort(buf);
 
-				/* Alloc with calloc to ensure that all glyphs point to 0 by default. */
-				subtable->glyph_index_array = (uint32_t *) calloc(maxp->num_glyphs, sizeof(*subtable->glyph_index_array));
-				if (!subtable->glyph_index_array) {
-					warnerr("failed to alloc cmap format 4 glyph index array");
+				if (entry_count == 0) {
+					subtable->num_segments = 0;
+					break;
+				}
+				if (!alloc_cmap_segments(subtable, 1, entry_count)) {
 					return 0;
 				}
+				subtable->segments[0].start_code = first_code;
+				subtable->segments[0].end_code = first_code + entry_count - 1;
+				subtable->segments[0].id_offset = 0;
 
-				off_t cur_pos;
-				if ((cur_pos = lseek(font->fd, 0, SEEK_CUR)) < 0) {
-					warnerr("failed to get file position");
+				int i;
+				for (i = 0; i < entry_count; i++) {
+					subtable->glyph_ids[i] = read_ushort(buf);
+				}
+			}
+			break;
+		case 12:
+			{
+				/* Segmented coverage: groups map linearly onto glyph indices. */
+				uint32_t num_groups = read_ulong(buf);
+				if (num_groups > (buf->size - buf->pos) / 12) {
+					warn("cmap format 12 group count exceeds font data");
 					return 0;
 				}
-
-				for (i = 0; i < seg_count; i++) {
-					uint16_t start = start_code[i];
-					uint16_t end = end_code[i];
-					uint16_t delta = id_delta[i];
-					uint16_t range_offset = id_range_offset[i];
-					
-					if (start != (65536-1) && end != (65536-1)) {
-						int j;
-						for (j = start; j <= end; j++) {
-							if (range_offset == 0) {
-								subtable->glyph_index_array[(j + delta) % 65536] = j;
-							} else {
-								uint32_t glyph_offset = cur_pos +
-									((range_offset/2) + (j-start) + (i-seg_count))*2;
-								if (lseek(font->fd, glyph_offset, SEEK_SET) < 0) {
-									warnerr("failed to seek to glyph offset");
-									return 0;
-								}
-								uint16_t glyph_index = read_ushort(font->fd);
-								if (glyph_index != 0) {
-									glyph_index = (glyph_index + delta) % 65536;
-									if (subtable->glyph_index_array[glyph_index] == 0) {
-										subtable->glyph_index_array[glyph_index] = j;
-									}
-								}
-							}
-						}
-					}
+				if (!alloc_cmap_segments(subtable, num_groups, 0)) {
+					return 0;
 				}
 
-//				search_range = 0;
-//				entry_selector = 0;
-//				range_shift = 0;
-//				reserved_pad = 0;
-
-				free(end_code);
-				free(start_code);
-				free(id_delta);
-				free(id_range_offset);
+				uint32_t i;
+				for (i = 0; i < num_groups; i++) {
+					cmap_Segment *segment = &subtable->segments[i];
+					segment->start_code = read_ulong(buf);
+					segment->end_code = read_ulong(buf);
+					segment->id_delta = (uint16_t)(read_ulong(buf) - segment->start_code);
+					segment->id_offset = -1;
+				}
 			}
 			break;
 		default:
 			warn("unsupported cmap subtable format: %u", subtable->format);
-			subtable->num_indices = 0;
+			subtable->num_segments = 0;
 			return 0;
 	}
 
+	/* Leave the cursor at the end of the subtable. */
+	buffer_seek(buf, MIN(start + subtable->length, buf->size));
+
+	return 1;
+}
+
+/**
+ * Rank a cmap subtable by how much of Unicode it can map.
+ * Returns 0 if the subtable cannot be used for lookups.
+ */
+static int rank_cmap_subtable(cmap_subTable *subtable) {
+	if (!subtable->segments) {
+		return 0;
+	}
+	int unicode = (subtable->platform_id == 0) ||
+		(subtable->platform_id == 3 &&
+		 (subtable->platform_specifid_id == 1 || subtable->platform_specifid_id == 10));
+	if (unicode) {
+		/* Prefer tables that cover the supplementary planes. */
+		return (subtable->format == 12) ? 3 : 2;
+	}
 	return 1;
 }
 
 int load_cmap_table(TTF_Font *font, TTF_Table *table) {
 	cmap_Table *cmap = &table->data.cmap;
 
-	cmap->version = read_ushort(font->fd);
-	cmap->num_subtables = read_ushort(font->fd);
+	cmap->version = read_ushort(&font->buf);
+	cmap->num_subtables = read_ushort(&font->buf);
+	cmap->active = NULL;
 
-	cmap->subtables = (cmap_subTable *) malloc(cmap->num_subtables * sizeof(*cmap->subtables));
+	/* Alloc with calloc so that unsupported subtables have no segments. */
+	cmap->subtables = (cmap_subTable *) calloc(cmap->num_subtables, sizeof(*cmap->subtables));
 	if (!cmap->subtables) {
 		warnerr("failed to alloc cmap subtables");
 		return 0;
 	}
 
-	off_t pos;
-	int i;
+	size_t pos;
+	int i, best_rank = 0;
 	for (i = 0; i < cmap->num_subtables; i++) {
 		cmap_subTable *subtable = &cmap->subtables[i];
 
-		subtable->platform_id = read_ushort(font->fd);
-		subtable->platform_specifid_id = read_ushort(font->fd);
-		subtable->offset = read_ulong(font->fd);
+		subtable->platform_id = read_ushort(&font->buf);
+		subtable->platform_specifid_id = read_ushort(&font->buf);
+		subtable->offset = read_ulong(&font->buf);
 
-		// Save current file position
-		if ((pos = lseek(font->fd, 0, SEEK_CUR)) < 0) {
-			warnerr("failed to save file position");
-			return 0;
-		}
+		// Save current position
+		pos = font->buf.pos;
 
 		// Seek to start of mapping subtable (relative to cmap table offset)
-		if (lseek(font->fd, table->offset + subtable->offset, SEEK_SET) < 0) {
-			warnerr("failed to seek to cmap mapping subtable");
+		if (!buffer_seek(&font->buf, table->offset + subtable->offset)) {
+			warn("failed to seek to cmap mapping subtable");
 			return 0;
 		}
 
 		load_cmap_subtable(font, subtable);
 
-		// Restore file position
-		if (lseek(font->fd, pos, SEEK_SET) < 0) {
-			warnerr("failed to restore file position");
-			return 0;
+		int rank = rank_cmap_subtable(subtable);
+		if (rank > best_rank) {
+			best_rank = rank;
+			cmap->active = subtable;
 		}
+
+		// Restore position
+		buffer_seek(&font->buf, pos);
+	}
+
+	if (!cmap->active) {
+		warn("no supported cmap subtable found");
+		return 0;
+	}
+
+	/* Resolve the most frequently used code points up front. */
+	uint32_t c;
+	for (c = 0; c < 256; c++) {
+		cmap->latin1[c] = cmap_subtable_lookup(cmap->active, c);
 	}
 
 	return 1;
@@ -670,7 +755,7 @@ int load_cvt_table(TTF_Font *font, TTF_Table *table) {
 
 	int i;
 	for (i = 0; i < cvt->num_values; i++) {
-		cvt->control_values[i] = read_short(font->fd);
+		cvt->control_values[i] = read_short(&font->buf);
 	}
 
 	return 1;
@@ -688,14 +773,14 @@ int load_fpgm_table(TTF_Font *font, TTF_Table *table) {
 
 	int i;
 	for (i = 0; i < fpgm->num_instructions; i++) {
-		fpgm->instructions[i] = read_byte(font->fd);
+		fpgm->instructions[i] = read_byte(&font->buf);
 	}
 
 	return 1;
 }
 
-int load_glyph_instructions(TTF_Font *font, TTF_Glyph *glyph) {
-	glyph->instruction_length = read_ushort(font->fd);
+static int load_glyph_instructions(TTF_Buffer *buf, TTF_Glyph *glyph) {
+	glyph->instruction_length = read_ushort(buf);
 
 	glyph->instructions = (uint8_t *) malloc(glyph->instruction_length * sizeof(*glyph->instructions));
 	if (!glyph->instructions) {
@@ -705,13 +790,13 @@ int load_glyph_instructions(TTF_Font *font, TTF_Glyph *glyph) {
 
 	int i;
 	for (i = 0; i < glyph->instruction_length; i++) {
-		glyph->instructions[i] = read_byte(font->fd);
+		glyph->instructions[i] = read_byte(buf);
 	}
 
 	return 1;
 }
 
-int load_simple_glyph(TTF_Font *font, TTF_Glyph *glyph) {
+static int load_simple_glyph(TTF_Buffer *buf, TTF_Glyph *glyph) {
 	TTF_Simple_Glyph *simp_glyph = &glyph->descrip.simple;
 
 	simp_glyph->end_pts_of_contours = (uint16_t *) malloc(glyph->number_of_contours * sizeof(*simp_glyph->end_pts_of_contours));
@@ -721,7 +806,7 @@ int load_simple_glyph(TTF_Font *font, TTF_Glyph *glyph) {
 	}
 	int i;
 	for (i = 0; i < glyph->number_of_contours; i++) {
-		simp_glyph->end_pts_of_contours[i] = read_ushort(font->fd);
+		simp_glyph->end_pts_of_contours[i] = read_ushort(buf);
 	}
 
 	// Get the last contour's end point index
@@ -734,7 +819,7 @@ int load_simple_glyph(TTF_Font *font, TTF_Glyph *glyph) {
 	// Last end point index indicates the number of points
 	simp_glyph->num_points = last_end_pt + 1;
 
-	load_glyph_instructions(font, glyph);
+	load_glyph_instructions(buf, glyph);
 
 	simp_glyph->flags = (uint8_t *) malloc(simp_glyph->num_points * sizeof(*simp_glyph->flags));
 	if (!simp_glyph->flags) {
@@ -754,10 +839,14 @@ int load_simple_glyph(TTF_Font *font, TTF_Glyph *glyph) {
 
 	// Read glyph flags
 	for (i = 0; i < simp_glyph->num_points; i++) {
-		simp_glyph->flags[i] = read_byte(font->fd);
+		simp_glyph->flags[i] = read_byte(buf);
 		if ((simp_glyph->flags[i] & REPEAT) != 0) {
 			// Last flag should be repeated some number of times
-			uint8_t repeats = read_byte(font->fd);
+			uint8_t repeats = read_byte(buf);
+			if (i + repeats >= simp_glyph->num_points) {
+				warn("glyph flag repeat count exceeds number of points");
+				repeats = simp_glyph->num_points - i - 1;
+			}
 			int j;
 			for (j = 1; j <= repeats; j++) {
 				simp_glyph->flags[i + j] = simp_glyph->flags[i];
@@ -771,13 +860,13 @@ int load_simple_glyph(TTF_Font *font, TTF_Glyph *glyph) {
 	for (i = 0; i < simp_glyph->num_points; i++) {
 		if ((simp_glyph->flags[i] & X_DUAL) != 0) {
 			if ((simp_glyph->flags[i] & X_SHORT_VECTOR) != 0) {
-				x += (int16_t) read_byte(font->fd);
+				x += (int16_t) read_byte(buf);
 			}
 		} else {
 			if ((simp_glyph->flags[i] & X_SHORT_VECTOR) != 0) {
-				x += -((int16_t) read_byte(font->fd));
+				x += -((int16_t) read_byte(buf));
 			} else {
-				x += read_short(font->fd);
+				x += read_short(buf);
 			}
 		}
 		simp_glyph->x_coordinates[i] = x;
@@ -785,13 +874,13 @@ int load_simple_glyph(TTF_Font *font, TTF_Glyph *glyph) {
 	for (i = 0; i < simp_glyph->num_points; i++) {
 		if ((simp_glyph->flags[i] & Y_DUAL) != 0) {
 			if ((simp_glyph->flags[i] & Y_SHORT_VECTOR) != 0) {
-				y += (int16_t) read_byte(font->fd);
+				y += (int16_t) read_byte(buf);
 			}
 		} else {
 			if ((simp_glyph->flags[i] & Y_SHORT_VECTOR) != 0) {
-				y += -((int16_t) read_byte(font->fd));
+				y += -((int16_t) read_byte(buf));
 			} else {
-				y += read_short(font->fd);
+				y += read_short(buf);
 			}
 		}
 		simp_glyph->y_coordinates[i] = y;
@@ -800,19 +889,28 @@ int load_simple_glyph(TTF_Font *font, TTF_Glyph *glyph) {
 	return 1;
 }
 
-int load_compound_glyph_comp(TTF_Font *font, TTF_Compound_Comp *comp) {
-	comp->flags = read_short(font->fd);
-	comp->glyph_index = read_ushort(font->fd);
+static int load_compound_glyph_comp(TTF_Buffer *buf, TTF_Compound_Comp *comp) {
+	comp->flags = read_ushort(buf);
+	comp->glyph_index = read_ushort(buf);
 
-	// Read arguments as words or bytes
+	// Read arguments as words or bytes (signed offsets, unsigned point numbers)
 	if (comp->flags & ARG_1_AND_2_ARE_WORDS) {
-		comp->arg1 = read_short(font->fd);
-		comp->arg2 = read_short(font->fd);
+		comp->arg1 = read_short(buf);
+		comp->arg2 = read_short(buf);
+	} else if (comp->flags & ARGS_ARE_XY_VALUES) {
+		comp->arg1 = (int8_t) read_byte(buf);
+		comp->arg2 = (int8_t) read_byte(buf);
 	} else {
-		comp->arg1 = (int16_t) read_byte(font->fd);
-		comp->arg2 = (int16_t) read_byte(font->fd);
+		comp->arg1 = (int16_t) read_byte(buf);
+		comp->arg2 = (int16_t) read_byte(buf);
 	}
 
+	// Identity transform unless scaling information follows
+	comp->xscale = comp->yscale = 1;
+	comp->scale01 = comp->scale10 = 0;
+	comp->xtranslate = comp->ytranslate = 0;
+	comp->point1 = comp->point2 = 0;
+
 	// Assign arguments depending on type
 	if (comp->flags & ARGS_ARE_XY_VALUES) {
 		comp->xtranslate = comp->arg1;
@@ -824,21 +922,21 @@ int load_compound_glyph_comp(TTF_Font *font, TTF_Compound_Comp *comp) {
 
 	// Read scaling information
 	if (comp->flags & WE_HAVE_A_SCALE) {
-		comp->xscale = comp->yscale = (float) read_short(font->fd) / (float) 0x4000;
+		comp->xscale = comp->yscale = (float) read_short(buf) / (float) 0x4000;
 	} else if (comp->flags & WE_HAVE_AN_X_AND_Y_VALUE) {
-		comp->xscale = (float) read_short(font->fd) / (float) 0x4000;
-		comp->yscale = (float) read_short(font->fd) / (float) 0x4000;
+		comp->xscale = (float) read_short(buf) / (float) 0x4000;
+		comp->yscale = (float) read_short(buf) / (float) 0x4000;
 	} else if (comp->flags & WE_HAVE_A_TWO_BY_TWO) {
-		comp->xscale = (float) read_short(font->fd) / (float) 0x4000;
-		comp->scale01 = (float) read_short(font->fd) / (float) 0x4000;
-		comp->scale10 = (float) read_short(font->fd) / (float) 0x4000;
-		comp->yscale = (float) read_short(font->fd) / (float) 0x4000;
+		comp->xscale = (float) read_short(buf) / (float) 0x4000;
+		comp->scale01 = (float) read_short(buf) / (float) 0x4000;
+		comp->scale10 = (float) read_short(buf) / (float) 0x4000;
+		comp->yscale = (float) read_short(buf) / (float) 0x4000;
 	}
 
 	return 1;
 }
 
-int load_compound_glyph(TTF_Font *font, TTF_Glyph *glyph) {
+static int load_compound_glyph(TTF_Buffer *buf, TTF_Glyph *glyph) {
 	TTF_Compound_Glyph *comp_glyph = &glyph->descrip.compound;
 	comp_glyph->num_comps = 0;
 
@@ -849,34 +947,65 @@ int load_compound_glyph(TTF_Font *font, TTF_Glyph *glyph) {
 			warnerr("failed to alloc compound glyph component %hd", comp_glyph->num_comps);
 			return 0;
 		}
-		load_compound_glyph_comp(font, &comp_glyph->comps[comp_glyph->num_comps]);
+		load_compound_glyph_comp(buf, &comp_glyph->comps[comp_glyph->num_comps]);
 		comp_glyph->num_comps++;
 	} while (comp_glyph->comps && (comp_glyph->comps[comp_glyph->num_comps-1].flags & MORE_COMPONENTS));
 
 	// Instructions (if provided) follow the the last component
 	if (comp_glyph->comps && (comp_glyph->comps[comp_glyph->num_comps-1].flags & WE_HAVE_INSTRUCTIONS)) {
-		load_glyph_instructions(font, glyph);
+		load_glyph_instructions(buf, glyph);
 	}
 
 	return 1;
 }
 
 int load_glyph(TTF_Font *font, TTF_Glyph *glyph) {
-	glyph->number_of_contours = read_short(font->fd);
-	glyph->x_min = read_short(font->fd);
-	glyph->y_min = read_short(font->fd);
-	glyph->x_max = read_short(font->fd);
-	glyph->y_max = read_short(font->fd);
+	glyf_Table *glyf = get_glyf_table(font);
+	if (!glyf) {
+		warn("failed to get glyf table");
+		return 0;
+	}
+	loca_Table *loca = get_loca_table(font);
+	if (!loca) {
+		warn("failed to get loca table");
+		return 0;
+	}
+	if (glyph->index >= glyf->num_glyphs || glyph->index+1 >= loca->num_offsets) {
+		warn("glyph index %u out of range", glyph->index);
+		return 0;
+	}
+
+	uint32_t start = loca->offsets[glyph->index];
+	uint32_t end = loca->offsets[glyph->index+1];
+	if (end <= start) {
+		/* A zero-length glyph does not contain an outline. */
+		glyph->number_of_contours = 0;
+		return 1;
+	}
+
+	/* Decode from a private cursor so that glyphs can be loaded at any time. */
+	TTF_Buffer buf;
+	init_buffer(&buf, font->buf.data, font->buf.size);
+	if (!buffer_seek(&buf, glyf->offset + start)) {
+		warn("failed to seek to glyph %u", glyph->index);
+		return 0;
+	}
+
+	glyph->number_of_contours = read_short(&buf);
+	glyph->x_min = read_short(&buf);
+	glyph->y_min = read_short(&buf);
+	glyph->x_max = read_short(&buf);
+	glyph->y_max = read_short(&buf);
 
 	if (glyph->number_of_contours == 0) {
 		// Empty glyph
 		return 1;
 	} else if (glyph->number_of_contours > 0) {
 		// Simple glyph
-		return load_simple_glyph(font, glyph);
+		return load_simple_glyph(&buf, glyph);
 	} else {
 		// Compound glyph
-		return load_compound_glyph(font, glyph);
+		return load_compound_glyph(&buf, glyph);
 	}
 
 	return 1;
@@ -899,30 +1028,69 @@ int load_glyf_table(TTF_Font *font, TTF_Table *table) {
 
 	// Save number of glyphs in glyf table so that the glyph array can be easily accessed
 	glyf->num_glyphs = maxp->num_glyphs;
+	glyf->offset = table->offset;
 
 	/**
-	 * Alloc glyph array with calloc:
-	 * This ensures that all pointers are initialized to NULL
+	 * Glyphs are decoded on first access (see get_glyph_by_index()).
+	 * Alloc the glyph slots with calloc: a NULL slot has not been decoded yet.
 	 */
-	glyf->glyphs = (TTF_Glyph *) calloc(glyf->num_glyphs, sizeof(*glyf->glyphs));
+	glyf->glyphs = (TTF_Glyph **) calloc(glyf->num_glyphs, sizeof(*glyf->glyphs));
 	if (!glyf->glyphs) {
 		warnerr("failed to alloc glyphs");
 		return 0;
 	}
 
+	return 1;
+}
+
+/**
+ * Load the hdmx device records. The widths are left in the font data,
+ * which lives as long as the font.
+ */
+int load_hdmx_table(TTF_Font *font, TTF_Table *table) {
+	hdmx_Table *hdmx = &table->data.hdmx;
+	TTF_Buffer *buf = &font->buf;
+
+	maxp_Table *maxp = get_maxp_table(font);
+	if (!maxp) {
+		warn("failed to get maxp table");
+		return 0;
+	}
+
+	hdmx->version = read_ushort(buf);
+	hdmx->num_records = read_short(buf);
+	hdmx->record_size = read_ulong(buf);
+	hdmx->num_glyphs = maxp->num_glyphs;
+
+	if (hdmx->version != 0) {
+		warn("unsupported hdmx table version %u", hdmx->version);
+		hdmx->num_records = 0;
+		return 0;
+	}
+
+	/* Each record is the pixel size and max width, then the widths. */
+	size_t end = MIN((size_t)table->offset + table->length, buf->size);
+	if (hdmx->record_size < 2 + (uint32_t)hdmx->num_glyphs ||
+			buf->pos + (size_t)hdmx->num_records * hdmx->record_size > end) {
+		warn("malformed hdmx table");
+		hdmx->num_records = 0;
+		return 0;
+	}
+
+	hdmx->records = malloc(hdmx->num_records * sizeof(*hdmx->records));
+	if (!hdmx->records) {
+		warnerr("failed to alloc hdmx records");
+		hdmx->num_records = 0;
+		return 0;
+	}
+
 	int i;
-	for (i = 0; i < glyf->num_glyphs; i++) {
-		TTF_Glyph *glyph = &glyf->glyphs[i];
-		/* Calculate the glyph length. */
-		if ((loca->offsets[i+1] - loca->offsets[i]) == 0) {
-			/* A zero-length glyph does not contain an outline. */
-			continue;
-		}
-		if (lseek(font->fd, table->offset + loca->offsets[i], SEEK_SET) < 0) {
-			warnerr("failed to seek to glyph %d: %s", i);
-			return 0;
-		}
-		load_glyph(font, glyph);
+	for (i = 0; i < hdmx->num_records; i++) {
+		size_t start = buf->pos;
+		hdmx->records[i].pixel_size = read_byte(buf);
+		hdmx->records[i].max_width = read_byte(buf);
+		hdmx->records[i].widths = buf->data + buf->pos;
+		buffer_seek(buf, start + hdmx->record_size);
 	}
 
 	return 1;
@@ -931,23 +1099,23 @@ int load_glyf_table(TTF_Font *font, TTF_Table *table) {
 int load_head_table(TTF_Font *font, TTF_Table *table) {
 	head_Table *head = &table->data.head;
 
-	head->version = read_fixed(font->fd);
-	head->font_revision = read_fixed(font->fd);
-	head->check_sum_adjustment = read_ulong(font->fd);
-	head->magic_number = read_ulong(font->fd);
-	head->flags = read_ushort(font->fd);
-	head->units_per_em = read_ushort(font->fd);
-	head->created = read_longdatetime(font->fd);
-	head->modified = read_longdatetime(font->fd);
-	head->x_min = read_short(font->fd);
-	head->y_min = read_short(font->fd);
-	head->x_max = read_short(font->fd);
-	head->y_max = read_short(font->fd);
-	head->mac_style = read_ushort(font->fd);
-	head->lowest_rec_ppem = read_ushort(font->fd);
-	head->font_direction_hint = read_short(font->fd);
-	head->index_to_loc_format = read_short(font->fd);
-	head->glyph_data_format = read_short(font->fd);
+	head->version = read_fixed(&font->buf);
+	head->font_revision = read_fixed(&font->buf);
+	head->check_sum_adjustment = read_ulong(&font->buf);
+	head->magic_number = read_ulong(&font->buf);
+	head->flags = read_ushort(&font->buf);
+	head->units_per_em = read_ushort(&font->buf);
+	head->created = read_longdatetime(&font->buf);
+	head->modified = read_longdatetime(&font->buf);
+	head->x_min = read_short(&font->buf);
+	head->y_min = read_short(&font->buf);
+	head->x_max = read_short(&font->buf);
+	head->y_max = read_short(&font->buf);
+	head->mac_style = read_ushort(&font->buf);
+	head->lowest_rec_ppem = read_ushort(&font->buf);
+	head->font_direction_hint = read_short(&font->buf);
+	head->index_to_loc_format = read_short(&font->buf);
+	head->glyph_data_format = read_short(&font->buf);
 
 	return 1;
 }
@@ -955,23 +1123,23 @@ int load_head_table(TTF_Font *font, TTF_Table *table) {
 int load_hhea_table(TTF_Font *font, TTF_Table *table) {
 	hhea_Table *hhea = &table->data.hhea;
 
-	hhea->version = read_fixed(font->fd);
-	hhea->ascent = read_short(font->fd);
-	hhea->descent = read_short(font->fd);
-	hhea->line_gap = read_short(font->fd);
-	hhea->advance_width_max = read_ushort(font->fd);
-	hhea->min_left_side_bearing = read_short(font->fd);
-	hhea->min_right_side_bearing = read_short(font->fd);
-	hhea->x_max_extent = read_short(font->fd);
-	hhea->caret_slope_rise = read_short(font->fd);
-	hhea->caret_slope_run = read_short(font->fd);
-	hhea->caret_offset = read_short(font->fd);
-	hhea->reserved1 = read_short(font->fd);
-	hhea->reserved2 = read_short(font->fd);
-	hhea->reserved3 = read_short(font->fd);
-	hhea->reserved4 = read_short(font->fd);
-	hhea->metric_data_format = read_short(font->fd);
-	hhea->num_of_long_hor_metrics = read_ushort(font->fd);
+	hhea->version = read_fixed(&font->buf);
+	hhea->ascent = read_short(&font->buf);
+	hhea->descent = read_short(&font->buf);
+	hhea->line_gap = read_short(&font->buf);
+	hhea->advance_width_max = read_ushort(&font->buf);
+	hhea->min_left_side_bearing = read_short(&font->buf);
+	hhea->min_right_side_bearing = read_short(&font->buf);
+	hhea->x_max_extent = read_short(&font->buf);
+	hhea->caret_slope_rise = read_short(&font->buf);
+	hhea->caret_slope_run = read_short(&font->buf);
+	hhea->caret_offset = read_short(&font->buf);
+	hhea->reserved1 = read_short(&font->buf);
+	hhea->reserved2 = read_short(&font->buf);
+	hhea->reserved3 = read_short(&font->buf);
+	hhea->reserved4 = read_short(&font->buf);
+	hhea->metric_data_format = read_short(&font->buf);
+	hhea->num_of_long_hor_metrics = read_ushort(&font->buf);
 
 	return 1;
 }
@@ -991,6 +1159,10 @@ int load_hmtx_table(TTF_Font *font, TTF_Table *table) {
 		return 0;
 	}
 
+	if (hhea->num_of_long_hor_metrics == 0 || hhea->num_of_long_hor_metrics > maxp->num_glyphs) {
+		warn("invalid number of hmtx long metrics: %hu", hhea->num_of_long_hor_metrics);
+		return 0;
+	}
 	hmtx->num_h_metrics = hhea->num_of_long_hor_metrics;
 
 	hmtx->advance_width = malloc(hmtx->num_h_metrics * sizeof(*hmtx->advance_width));
@@ -1006,8 +1178,8 @@ int load_hmtx_table(TTF_Font *font, TTF_Table *table) {
 
 	int i;
 	for (i = 0; i < hmtx->num_h_metrics; i++) {
-		hmtx->advance_width[i] = read_ushort(font->fd);
-		hmtx->left_side_bearing[i] = read_short(font->fd);
+		hmtx->advance_width[i] = read_ushort(&font->buf);
+		hmtx->left_side_bearing[i] = read_short(&font->buf);
 	}
 
 	hmtx->num_non_horizontal_metrics = maxp->num_glyphs - hhea->num_of_long_hor_metrics;
@@ -1018,12 +1190,161 @@ int load_hmtx_table(TTF_Font *font, TTF_Table *table) {
 	}
 
 	for (i = 0; i < hmtx->num_non_horizontal_metrics; i++) {
-		hmtx->non_horizontal_left_side_bearing[i] = read_short(font->fd);
+		hmtx->non_horizontal_left_side_bearing[i] = read_short(&font->buf);
 	}
 
 	return 1;
 }
 
+typedef struct _Kern_Entry {
+	uint32_t key;	/* left << 16 | right */
+	uint32_t order;	/* Position in the table, for a stable sort. */
+	int16_t value;
+	uint8_t override;
+} Kern_Entry;
+
+static int cmp_kern_entries(const void *p1, const void *p2) {
+	const Kern_Entry *a = p1;
+	const Kern_Entry *b = p2;
+	if (a->key != b->key) {
+		return (a->key > b->key) - (a->key < b->key);
+	}
+	return (a->order > b->order) - (a->order < b->order);
+}
+
+/**
+ * Load the horizontal format 0 subtables of a Microsoft (version 0) or
+ * Apple (version 1) kern table. Pairs found in several subtables are
+ * summed, unless a later subtable overrides them.
+ */
+int load_kern_table(TTF_Font *font, TTF_Table *table) {
+	kern_Table *kern = &table->data.kern;
+	TTF_Buffer *buf = &font->buf;
+
+	maxp_Table *maxp = get_maxp_table(font);
+	if (!maxp) {
+		warn("failed to get maxp table");
+		return 0;
+	}
+
+	size_t end = MIN((size_t)table->offset + table->length, buf->size);
+
+	int apple = 0;
+	uint32_t num_subtables;
+	uint16_t version = read_ushort(buf);
+	if (version == 0) {
+		num_subtables = read_ushort(buf);
+	} else if (version == 1) {
+		read_ushort(buf); // version was actually a Fixed, this is the .X part
+		num_subtables = read_ulong(buf);
+		apple = 1;
+	} else {
+		warn("unsupported kern table version %u", version);
+		return 0;
+	}
+
+	/* Each pair takes 6 bytes, which bounds the number of pairs. */
+	Kern_Entry *entries = malloc((table->length / 6 + 1) * sizeof(*entries));
+	if (!entries) {
+		warnerr("failed to alloc kern pairs");
+		return 0;
+	}
+	uint32_t num_entries = 0;
+
+	uint32_t t;
+	for (t = 0; t < num_subtables && !buf->overrun; t++) {
+		size_t start = buf->pos;
+		uint32_t length;
+		uint16_t coverage;
+		int format, horizontal, skip, override;
+		if (!apple) {
+			read_ushort(buf); // subtable version
+			length = read_ushort(buf);
+			coverage = read_ushort(buf);
+			format = coverage >> 8;
+			horizontal = coverage & 0x1;
+			skip = coverage & 0x6;	/* Minimum or cross-stream values. */
+			override = (coverage & 0x8) != 0;
+		} else {
+			length = read_ulong(buf);
+			coverage = read_ushort(buf);
+			read_ushort(buf); // tuple index
+			format = coverage & 0xFF;
+			horizontal = !(coverage & 0x8000);
+			skip = coverage & 0x6000;	/* Cross-stream or variation values. */
+			override = 0;
+		}
+
+		size_t next = start + length;
+		if (format == 0) {
+			uint16_t num_pairs = read_ushort(buf);
+			buffer_skip(buf, 3 * sizeof(uint16_t));
+
+			/* The 16 bit subtable length of large version 0 tables overflows,
+			 * so a format 0 subtable ends after its pairs. */
+			next = buf->pos + (size_t)num_pairs * 6;
+			if (horizontal && !skip) {
+				uint32_t i;
+				for (i = 0; i < num_pairs && buf->pos + 6 <= end; i++) {
+					Kern_Entry *entry = &entries[num_entries];
+					uint16_t left = read_ushort(buf);
+					uint16_t right = read_ushort(buf);
+					entry->key = (uint32_t)left << 16 | right;
+					entry->order = num_entries++;
+					entry->value = read_short(buf);
+					entry->override = override;
+				}
+			}
+		}
+		if (length == 0 && format != 0) {
+			break;
+		}
+		if (next > end || !buffer_seek(buf, next)) {
+			break;
+		}
+	}
+
+	/* Merge the subtables' pairs into one sorted list. */
+	qsort(entries, num_entries, sizeof(*entries), cmp_kern_entries);
+	uint32_t num_pairs = 0;
+	uint32_t i;
+	for (i = 0; i < num_entries; i++) {
+		if ((entries[i].key >> 16) >= maxp->num_glyphs) {
+			continue;
+		}
+		if (num_pairs > 0 && entries[num_pairs-1].key == entries[i].key) {
+			Kern_Entry *pair = &entries[num_pairs-1];
+			int32_t value = entries[i].override ? entries[i].value : pair->value + entries[i].value;
+			pair->value = (int16_t)MAX(MIN(value, INT16_MAX), INT16_MIN);
+		} else {
+			entries[num_pairs++] = entries[i];
+		}
+	}
+
+	kern->num_pairs = 0;
+	if (num_pairs > 0) {
+		kern->pairs = malloc(num_pairs * sizeof(*kern->pairs));
+		if (!kern->pairs) {
+			warnerr("failed to alloc kern pairs");
+			free(entries);
+			return 0;
+		}
+		for (i = 0; i < num_pairs; i++) {
+			kern->pairs[i].key = entries[i].key;
+			kern->pairs[i].value = entries[i].value;
+		}
+		kern->num_pairs = num_pairs;
+
+		if (!build_kern_index(kern)) {
+			free(entries);
+			return 0;
+		}
+	}
+
+	free(entries);
+	return 1;
+}
+
 int load_loca_table(TTF_Font *font, TTF_Table *table) {
 	loca_Table *loca = &table->data.loca;
 
@@ -1053,10 +1374,10 @@ int load_loca_table(TTF_Font *font, TTF_Table *table) {
 	for (i = 0; i < loca->num_offsets; i++) {
 		switch (head->index_to_loc_format) {
 			case SHORT_OFFSETS:
-				loca->offsets[i] = read_ushort(font->fd) * 2;
+				loca->offsets[i] = read_ushort(&font->buf) * 2;
 				break;
 			case LONG_OFFSETS:
-				loca->offsets[i] = read_ulong(font->fd);
+				loca->offsets[i] = read_ulong(&font->buf);
 				break;
 			default:
 				warn("unknown loca offset format: %hd", head->index_to_loc_format);
@@ -1067,24 +1388,42 @@ int load_loca_table(TTF_Font *font, TTF_Table *table) {
 	return 1;
 }
 
+int load_ltsh_table(TTF_Font *font, TTF_Table *table) {
+	ltsh_Table *ltsh = &table->data.ltsh;
+	TTF_Buffer *buf = &font->buf;
+
+	ltsh->version = read_ushort(buf);
+	ltsh->num_glyphs = read_ushort(buf);
+
+	size_t end = MIN((size_t)table->offset + table->length, buf->size);
+	if (buf->pos + ltsh->num_glyphs > end) {
+		warn("malformed LTSH table");
+		ltsh->num_glyphs = 0;
+		return 0;
+	}
+	ltsh->y_pels = buf->data + buf->pos;
+
+	return 1;
+}
+
 int load_maxp_table(TTF_Font *font, TTF_Table *table) {
 	maxp_Table *maxp = &table->data.maxp;
 
-	maxp->version = read_fixed(font->fd);
-	maxp->num_glyphs = read_ushort(font->fd);
-	maxp->max_points = read_ushort(font->fd);
-	maxp->max_contours = read_ushort(font->fd);
-	maxp->max_component_points = read_ushort(font->fd);
-	maxp->max_component_contours = read_ushort(font->fd);
-	maxp->max_zones = read_ushort(font->fd);
-	maxp->max_twilight_points = read_ushort(font->fd);
-	maxp->max_storage = read_ushort(font->fd);
-	maxp->max_function_defs = read_ushort(font->fd);
-	maxp->max_instruction_defs = read_ushort(font->fd);
-	maxp->max_stack_elements = read_ushort(font->fd);
-	maxp->max_size_of_instructions = read_ushort(font->fd);
-	maxp->max_component_elements = read_ushort(font->fd);
-	maxp->max_component_depth = read_ushort(font->fd);
+	maxp->version = read_fixed(&font->buf);
+	maxp->num_glyphs = read_ushort(&font->buf);
+	maxp->max_points = read_ushort(&font->buf);
+	maxp->max_contours = read_ushort(&font->buf);
+	maxp->max_component_points = read_ushort(&font->buf);
+	maxp->max_component_contours = read_ushort(&font->buf);
+	maxp->max_zones = read_ushort(&font->buf);
+	maxp->max_twilight_points = read_ushort(&font->buf);
+	maxp->max_storage = read_ushort(&font->buf);
+	maxp->max_function_defs = read_ushort(&font->buf);
+	maxp->max_instruction_defs = read_ushort(&font->buf);
+	maxp->max_stack_elements = read_ushort(&font->buf);
+	maxp->max_size_of_instructions = read_ushort(&font->buf);
+	maxp->max_component_elements = read_ushort(&font->buf);
+	maxp->max_component_depth = read_ushort(&font->buf);
 
 	return 1;
 }
@@ -1099,15 +1438,15 @@ int load_post_table(TTF_Font *font, TTF_Table *table) {
 		return 0;
 	}
 
-	post->format = read_fixed(font->fd);
-	post->italic_angle = read_fixed(font->fd);
-	post->underline_position = read_short(font->fd);
-	post->underline_thickness = read_short(font->fd);
-	post->is_fixed_pitch = read_ulong(font->fd);
-	post->min_mem_type_42 = read_ulong(font->fd);
-	post->max_mem_type_42 = read_ulong(font->fd);
-	post->min_mem_type_1 = read_ulong(font->fd);
-	post->max_mem_type_1 = read_ulong(font->fd);
+	post->format = read_fixed(&font->buf);
+	post->italic_angle = read_fixed(&font->buf);
+	post->underline_position = read_short(&font->buf);
+	post->underline_thickness = read_short(&font->buf);
+	post->is_fixed_pitch = read_ulong(&font->buf);
+	post->min_mem_type_42 = read_ulong(&font->buf);
+	post->max_mem_type_42 = read_ulong(&font->buf);
+	post->min_mem_type_1 = read_ulong(&font->buf);
+	post->max_mem_type_1 = read_ulong(&font->buf);
 
 	switch (post->format) {
 		case 0x00010000:
@@ -1134,7 +1473,7 @@ int load_post_table(TTF_Font *font, TTF_Table *table) {
 		case 0x00020000:
 			{
 				// Font contains some glyphs not in the standard set or its glyph ordering is non-standard.
-				post->num_glyphs = read_ushort(font->fd);
+				post->num_glyphs = read_ushort(&font->buf);
 
 				uint16_t *glyph_name_index = (uint16_t *) malloc(post->num_glyphs * sizeof(*glyph_name_index));
 				if (!glyph_name_index) {
@@ -1144,7 +1483,7 @@ int load_post_table(TTF_Font *font, TTF_Table *table) {
 				uint16_t max_index = 0;
 				int i;
 				for (i = 0; i < post->num_glyphs; i++) {
-					glyph_name_index[i] = read_ushort(font->fd);
+					glyph_name_index[i] = read_ushort(&font->buf);
 					max_index = (int) fmax(max_index, glyph_name_index[i]);
 				}
 
@@ -1157,7 +1496,7 @@ int load_post_table(TTF_Font *font, TTF_Table *table) {
 					}
 					int i;
 					for (i = 0; i < max_index-258 + 1; i++) {
-						uint8_t name_length = read_byte(font->fd);
+						uint8_t name_length = read_byte(&font->buf);
 
 						names[i] = (char *) malloc((name_length + 1) * sizeof(*names[i]));
 						if (!names[i]) {
@@ -1167,7 +1506,7 @@ int load_post_table(TTF_Font *font, TTF_Table *table) {
 
 						int j;
 						for (j = 0; j < name_length; j++) {
-							names[i][j] = (char) read_byte(font->fd);
+							names[i][j] = (char) read_byte(&font->buf);
 						}
 						names[i][j] = '\0';
 					}
@@ -1212,7 +1551,7 @@ int load_post_table(TTF_Font *font, TTF_Table *table) {
 
 				int i;
 				for (i = 0; i < post->num_glyphs; i++) {
-					int8_t offset = (int8_t) read_byte(font->fd);
+					int8_t offset = (int8_t) read_byte(&font->buf);
 					glyph_name_index[i] = offset + (i+1);
 				}
 
@@ -1249,13 +1588,15 @@ int load_table(TTF_Font *font, TTF_Table *table) {
 		return 0;
 	}
 	// Seek to start of table
-	if (lseek(font->fd, table->offset, SEEK_SET) < 0) {
-		warnerr("failed to seek to %.*s table: %s", TAG_LENGTH, (char *)&(table->tag));
+	if (!buffer_seek(&font->buf, table->offset)) {
+		warn("failed to seek to %.*s table", TAG_LENGTH, (char *)&(table->tag));
 		return 0;
 	}
 	switch (table->tag) {
 		case 0x322f534f:	/* OS/2 */
 			break;
+		case 0x4853544c:	/* LTSH */
+			return load_ltsh_table(font, table);
 		case 0x544c4350:	/* PCLT */
 			break;
 		case 0x70616d63:	/* cmap */
@@ -1269,7 +1610,7 @@ int load_table(TTF_Font *font, TTF_Table *table) {
 		case 0x66796c67:	/* glyf */
 			return load_glyf_table(font, table);
 		case 0x786d6468:	/* hdmx */
-			break;
+			return load_hdmx_table(font, table);
 		case 0x64616568:	/* head */
 			return load_head_table(font, table);
 		case 0x61656868:	/* hhea */
@@ -1277,7 +1618,7 @@ int load_table(TTF_Font *font, TTF_Table *table) {
 		case 0x78746d68:	/* hmtx */
 			return load_hmtx_table(font, table);
 		case 0x6e72656b:	/* kern */
-			break;
+			return load_kern_table(font, table);
 		case 0x61636f6c:	/* loca */
 			return load_loca_table(font, table);
 		case 0x7078616d:	/* maxp */
@@ -1338,6 +1679,62 @@ int load_tables(TTF_Font *font) {
 	return 1;
 }
 
+static int parse_font_data(TTF_Font *font) {
+	if (!read_font_dir(font)) {
+		warn("failed to read font dir");
+		return FAILURE;
+	}
+	if (!load_tables(font)) {
+		warn("failed to load font tables");
+	}
+
+	/* Copy units per em from head table */
+	head_Table *head = get_head_table(font);
+	if (!head || head->units_per_em == 0) {
+		warn("failed to get font units per em");
+		return FAILURE;
+	}
+	font->upem = head->units_per_em;
+
+	return SUCCESS;
+}
+
+/**
+ * Read an entire file into a malloc'd buffer. Used when the file cannot be
+ * memory-mapped (e.g. pipes and other special files).
+ */
+static uint8_t *read_whole_file(int fd, size_t *size) {
+	size_t capacity = 64 * 1024, length = 0;
+	uint8_t *data = malloc(capacity);
+	if (!data) {
+		warnerr("failed to alloc font data");
+		return NULL;
+	}
+
+	ssize_t n;
+	while ((n = read(fd, data + length, capacity - length)) != 0) {
+		if (n < 0) {
+			warnerr("failed to read font file");
+			free(data);
+			return NULL;
+		}
+		length += n;
+		if (length == capacity) {
+			uint8_t *grown = realloc(data, capacity * 2);
+			if (!grown) {
+				warnerr("failed to grow font data");
+				free(data);
+				return NULL;
+			}
+			data = grown;
+			capacity *= 2;
+		}
+	}
+
+	*size = length;
+	return data;
+}
+
 int parse_file(TTF_Font *font, const char *filename) {
 	CHECKPTR(font);
 	
@@ -1347,25 +1744,79 @@ int parse_file(TTF_Font *font, const char *filename) {
 	}
 
 	/* open font file */
-	if ((font->fd = open(filename, O_RDONLY)) < 0) {
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
 		warnerr("failed to open font file");
 		return FAILURE;
 	}
 
-	if (!read_font_dir(font)) {
-		warn("failed to read font dir");
+	/* Map the whole file - every table is then parsed from memory. */
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED) {
+			init_buffer(&font->buf, data, st.st_size);
+			font->source = SOURCE_MMAP;
+		}
 	}
-	if (!load_tables(font)) {
-		warn("failed to load font tables");
+	if (font->source == SOURCE_NONE) {
+		/* Fall back to reading the file into a single buffer. */
+		size_t size = 0;
+		uint8_t *data = read_whole_file(fd, &size);
+		if (data) {
+			init_buffer(&font->buf, data, size);
+			font->source = SOURCE_HEAP;
+		}
 	}
 
-	/* close font file and reset font fd */
-	if (close(font->fd) < 0) {
+	/* The mapping (if any) remains valid after the file is closed. */
+	if (close(fd) < 0) {
 		warnerr("failed to close font file");
 	}
-	font->fd = -1;
 
-	return SUCCESS;
+	if (font->source == SOURCE_NONE) {
+		warn("failed to read font file '%s'", filename);
+		return FAILURE;
+	}
+
+	return parse_font_data(font);
+}
+
+int parse_buffer(TTF_Font *font, const uint8_t *data, size_t size) {
+	CHECKPTR(font);
+
+	if (!data || size == 0) {
+		warn("invalid font data");
+		return FAILURE;
+	}
+
+	init_buffer(&font->buf, data, size);
+	font->source = SOURCE_USER;
+
+	return parse_font_data(font);
+}
+
+void release_font_data(TTF_Font *font) {
+	if (!font) {
+		return;
+	}
+	switch (font->source) {
+		case SOURCE_MMAP:
+			if (munmap((void *)font->buf.data, font->buf.size) < 0) {
+				warnerr("failed to unmap font file");
+			}
+			break;
+		case SOURCE_HEAP:
+			free((void *)font->buf.data);
+			break;
+		case SOURCE_USER:
+		case SOURCE_NONE:
+		default:
+			/* Font does not own its data. */
+			break;
+	}
+	init_buffer(&font->buf, NULL, 0);
+	font->source = SOURCE_NONE;
 }
 
 void print_cmap_table(cmap_Table *cmap) {
@@ -1413,7 +1864,11 @@ void print_glyf_table(glyf_Table *glyf) {
 
 	int i;
 	for (i = 0; i < glyf->num_glyphs; i++) {
-		TTF_Glyph *glyph = &glyf->glyphs[i];
+		TTF_Glyph *glyph = glyf->glyphs[i];
+		if (!glyph) {
+			/* Glyph has not been decoded. */
+			continue;
+		}
 		print_glyph(glyph);
 	}
 }
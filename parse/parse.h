@@ -3,16 +3,20 @@
 
 #include "../base/types.h"
 
-uint8_t read_byte(int fd);
-uint16_t read_hword(int fd);
-uint32_t read_word(int fd);
-uint64_t read_dword(int fd);
-uint16_t read_ushort(int fd);
-int16_t read_short(int fd);
-uint32_t read_ulong(int fd);
-uint32_t read_fixed(int fd);
-uint32_t read_tag(int fd);
-int64_t read_longdatetime(int fd);
+int init_buffer(TTF_Buffer *buf, const uint8_t *data, size_t size);
+int buffer_seek(TTF_Buffer *buf, size_t offset);
+int buffer_skip(TTF_Buffer *buf, size_t n);
+
+uint8_t read_byte(TTF_Buffer *buf);
+uint16_t read_hword(TTF_Buffer *buf);
+uint32_t read_word(TTF_Buffer *buf);
+uint64_t read_dword(TTF_Buffer *buf);
+uint16_t read_ushort(TTF_Buffer *buf);
+int16_t read_short(TTF_Buffer *buf);
+uint32_t read_ulong(TTF_Buffer *buf);
+uint32_t read_fixed(TTF_Buffer *buf);
+uint32_t read_tag(TTF_Buffer *buf);
+int64_t read_longdatetime(TTF_Buffer *buf);
 
 float fixed_to_float(uint32_t fixed);
 uint32_t s_to_tag(const char *s);
@@ -23,9 +27,13 @@ int validate_check_sums(TTF_Font *font);
 int read_font_dir(TTF_Font *font);
 
 int read_table_raw(TTF_Font *font, TTF_Table *table, uint32_t *buf);
+int load_cmap_subtable(TTF_Font *font, cmap_subTable *subtable);
+int load_glyph(TTF_Font *font, TTF_Glyph *glyph);
 int load_tables(TTF_Font *font);
 
 int parse_file(TTF_Font *font, const char *filename);
+int parse_buffer(TTF_Font *font, const uint8_t *data, size_t size);
+void release_font_data(TTF_Font *font);
 
 void print_cmap_table(cmap_Table *cmap);
 void print_head_table(head_Table *head);
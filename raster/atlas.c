@@ -0,0 +1,509 @@
+#include "atlas.h"
+#include "raster.h"
+#include "scale.h"
+#include "bitmap.h"
+#include "config.h"
+#include "../utils/utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#define INITIAL_BUCKETS 64
+#define INITIAL_SHELVES 16
+#define INITIAL_HOLES 16
+
+static inline uint32_t hash_key(uint32_t glyph_index, uint16_t ppem, uint32_t raster_flags) {
+	uint32_t h = glyph_index * 0x9E3779B1u;
+	h ^= (ppem * 0x85EBCA77u) + (h << 6) + (h >> 2);
+	h ^= (raster_flags * 0xC2B2AE3Du) + (h << 6) + (h >> 2);
+	return h;
+}
+
+static void mark_dirty(TTF_Atlas *atlas, int x0, int y0, int x1, int y1) {
+	if (atlas->dirty_x1 <= atlas->dirty_x0) {
+		atlas->dirty_x0 = x0;
+		atlas->dirty_y0 = y0;
+		atlas->dirty_x1 = x1;
+		atlas->dirty_y1 = y1;
+	} else {
+		atlas->dirty_x0 = MIN(atlas->dirty_x0, x0);
+		atlas->dirty_y0 = MIN(atlas->dirty_y0, y0);
+		atlas->dirty_x1 = MAX(atlas->dirty_x1, x1);
+		atlas->dirty_y1 = MAX(atlas->dirty_y1, y1);
+	}
+}
+
+static void lru_unlink(TTF_Atlas *atlas, TTF_Atlas_Glyph *glyph) {
+	if (glyph->prev) {
+		glyph->prev->next = glyph->next;
+	} else {
+		atlas->head = glyph->next;
+	}
+	if (glyph->next) {
+		glyph->next->prev = glyph->prev;
+	} else {
+		atlas->tail = glyph->prev;
+	}
+	glyph->prev = glyph->next = NULL;
+}
+
+static void lru_push_front(TTF_Atlas *atlas, TTF_Atlas_Glyph *glyph) {
+	glyph->prev = NULL;
+	glyph->next = atlas->head;
+	if (atlas->head) {
+		atlas->head->prev = glyph;
+	} else {
+		atlas->tail = glyph;
+	}
+	atlas->head = glyph;
+}
+
+static int push_hole(TTF_Atlas *atlas, int shelf, int x, int w) {
+	if (atlas->num_holes == atlas->max_holes) {
+		int max_holes = atlas->max_holes * 2;
+		TTF_Atlas_Hole *holes = realloc(atlas->holes, max_holes * sizeof(*holes));
+		if (!holes) {
+			warnerr("failed to grow atlas holes");
+			return FAILURE;
+		}
+		atlas->holes = holes;
+		atlas->max_holes = max_holes;
+	}
+	atlas->holes[atlas->num_holes++] = (TTF_Atlas_Hole){shelf, x, w};
+	return SUCCESS;
+}
+
+static inline void remove_hole(TTF_Atlas *atlas, int i) {
+	atlas->holes[i] = atlas->holes[--atlas->num_holes];
+}
+
+static int push_shelf(TTF_Atlas *atlas, int y, int h) {
+	if (atlas->num_shelves == atlas->max_shelves) {
+		int max_shelves = atlas->max_shelves * 2;
+		TTF_Atlas_Shelf *shelves = realloc(atlas->shelves, max_shelves * sizeof(*shelves));
+		if (!shelves) {
+			warnerr("failed to grow atlas shelves");
+			return FAILURE;
+		}
+		atlas->shelves = shelves;
+		atlas->max_shelves = max_shelves;
+	}
+	atlas->shelves[atlas->num_shelves++] = (TTF_Atlas_Shelf){y, h, 0, 0};
+	return SUCCESS;
+}
+
+/**
+ * Find the hole or shelf end with room for a w*h slot that wastes the
+ * least shelf height, ignoring shelves more than max_waste taller than
+ * the slot. Reserves the slot and returns its shelf, or -1 if none fit.
+ */
+static int take_space(TTF_Atlas *atlas, int w, int h, int max_waste, int *x) {
+	int best_waste = INT_MAX;
+	int best_hole = -1;
+	int best_shelf = -1;
+
+	for (int i = 0; i < atlas->num_holes; i++) {
+		TTF_Atlas_Hole *hole = &atlas->holes[i];
+		int waste = atlas->shelves[hole->shelf].h - h;
+		if (hole->w >= w && waste >= 0 && waste <= max_waste && waste < best_waste) {
+			best_waste = waste;
+			best_hole = i;
+		}
+	}
+	for (int i = 0; i < atlas->num_shelves; i++) {
+		TTF_Atlas_Shelf *shelf = &atlas->shelves[i];
+		int waste = shelf->h - h;
+		if (atlas->page->w - shelf->fill >= w && waste >= 0 && waste <= max_waste && waste < best_waste) {
+			best_waste = waste;
+			best_hole = -1;
+			best_shelf = i;
+		}
+	}
+
+	if (best_hole >= 0) {
+		TTF_Atlas_Hole *hole = &atlas->holes[best_hole];
+		best_shelf = hole->shelf;
+		*x = hole->x;
+		hole->x += w;
+		hole->w -= w;
+		if (hole->w == 0) {
+			remove_hole(atlas, best_hole);
+		}
+	} else if (best_shelf >= 0) {
+		*x = atlas->shelves[best_shelf].fill;
+		atlas->shelves[best_shelf].fill += w;
+	}
+	return best_shelf;
+}
+
+/**
+ * Reserve a w*h slot in the page. Prefers shelves of a similar height,
+ * then opens a new shelf, and only then settles for a taller shelf.
+ */
+static int place_slot(TTF_Atlas *atlas, int w, int h, int *x) {
+	int shelf = take_space(atlas, w, h, h / 2, x);
+	if (shelf >= 0) {
+		return shelf;
+	}
+
+	int top = 0;
+	if (atlas->num_shelves > 0) {
+		TTF_Atlas_Shelf *last = &atlas->shelves[atlas->num_shelves-1];
+		top = last->y + last->h;
+	}
+	if (top + h <= atlas->page->h) {
+		if (!push_shelf(atlas, top, h)) {
+			return -1;
+		}
+		*x = 0;
+		atlas->shelves[atlas->num_shelves-1].fill = w;
+		return atlas->num_shelves - 1;
+	}
+
+	return take_space(atlas, w, h, INT_MAX, x);
+}
+
+/**
+ * Return a glyph's slot to its shelf, merging it with neighbouring
+ * holes. Empty shelves are reset, and dropped from the bottom of the page.
+ */
+static void release_slot(TTF_Atlas *atlas, TTF_Atlas_Glyph *glyph) {
+	TTF_Atlas_Shelf *shelf = &atlas->shelves[glyph->shelf];
+	int x = glyph->x;
+	int w = glyph->slot_w;
+
+	if (--shelf->num_glyphs == 0) {
+		shelf->fill = 0;
+		for (int i = atlas->num_holes-1; i >= 0; i--) {
+			if (atlas->holes[i].shelf == glyph->shelf) {
+				remove_hole(atlas, i);
+			}
+		}
+		while (atlas->num_shelves > 0 && atlas->shelves[atlas->num_shelves-1].num_glyphs == 0) {
+			atlas->num_shelves--;
+		}
+		return;
+	}
+
+	/* Coalesce with holes on either side. */
+	for (int i = atlas->num_holes-1; i >= 0; i--) {
+		TTF_Atlas_Hole *hole = &atlas->holes[i];
+		if (hole->shelf != glyph->shelf) {
+			continue;
+		}
+		if (hole->x + hole->w == x) {
+			x = hole->x;
+			w += hole->w;
+			remove_hole(atlas, i);
+		} else if (x + w == hole->x) {
+			w += hole->w;
+			remove_hole(atlas, i);
+		}
+	}
+
+	if (x + w == shelf->fill) {
+		shelf->fill = x;
+	} else if (!push_hole(atlas, glyph->shelf, x, w)) {
+		/* The space is lost until the shelf empties. */
+		warn("failed to free atlas space");
+	}
+}
+
+static void remove_glyph(TTF_Atlas *atlas, TTF_Atlas_Glyph *glyph) {
+	/* Unlink from hash bucket. */
+	uint32_t b = hash_key(glyph->glyph_index, glyph->ppem, glyph->raster_flags) & (atlas->num_buckets - 1);
+	TTF_Atlas_Glyph **p = &atlas->buckets[b];
+	while (*p && *p != glyph) {
+		p = &(*p)->chain;
+	}
+	if (*p) {
+		*p = glyph->chain;
+	}
+
+	lru_unlink(atlas, glyph);
+	if (glyph->shelf >= 0) {
+		release_slot(atlas, glyph);
+	}
+	atlas->num_glyphs--;
+
+	free(glyph);
+}
+
+static int grow_buckets(TTF_Atlas *atlas) {
+	uint32_t num_buckets = atlas->num_buckets * 2;
+	TTF_Atlas_Glyph **buckets = calloc(num_buckets, sizeof(*buckets));
+	if (!buckets) {
+		warnerr("failed to grow atlas");
+		return FAILURE;
+	}
+
+	/* Rehash every glyph into the new buckets. */
+	for (TTF_Atlas_Glyph *glyph = atlas->head; glyph; glyph = glyph->next) {
+		uint32_t b = hash_key(glyph->glyph_index, glyph->ppem, glyph->raster_flags) & (num_buckets - 1);
+		glyph->chain = buckets[b];
+		buckets[b] = glyph;
+	}
+
+	free(atlas->buckets);
+	atlas->buckets = buckets;
+	atlas->num_buckets = num_buckets;
+
+	return SUCCESS;
+}
+
+/**
+ * Copy a glyph bitmap into its slot as coverage, clearing the slot's
+ * padding. RGB32 glyph bitmaps are black on white, so they are inverted
+ * into per-channel coverage, or averaged for an A8 page.
+ */
+static void write_slot(TTF_Atlas *atlas, TTF_Atlas_Glyph *glyph, TTF_Bitmap *bitmap) {
+	TTF_Bitmap *page = atlas->page;
+	TTF_Atlas_Shelf *shelf = &atlas->shelves[glyph->shelf];
+	int x1 = MIN(glyph->x + glyph->slot_w, page->w);
+	int y1 = MIN(shelf->y + shelf->h, page->h);
+	int bpp = (page->format == PIXEL_A8) ? 1 : 4;
+
+	for (int y = shelf->y; y < y1; y++) {
+		memset(&page->data[y * page->stride + glyph->x * bpp], 0, (x1 - glyph->x) * bpp);
+	}
+
+	for (int y = 0; y < bitmap->h; y++) {
+		uint8_t *dst = &page->data[(glyph->y + y) * page->stride + glyph->x * bpp];
+		if (page->format == PIXEL_A8 && bitmap->format == PIXEL_A8) {
+			memcpy(dst, &bitmap->data[y * bitmap->stride], bitmap->w);
+			continue;
+		}
+		for (int x = 0; x < bitmap->w; x++) {
+			uint32_t c = bitmap_get(bitmap, x, y);
+			if (bitmap->format == PIXEL_RGB32) {
+				c = ~c & 0xFFFFFF;
+				if (page->format == PIXEL_A8) {
+					c = (((c >> 16) & 0xFF) + ((c >> 8) & 0xFF) + (c & 0xFF) + 1) / 3;
+				}
+			} else if (page->format == PIXEL_RGB32) {
+				c *= 0x010101;
+			}
+			if (page->format == PIXEL_A8) {
+				dst[x] = c;
+			} else {
+				((uint32_t *)dst)[x] = c;
+			}
+		}
+	}
+
+	mark_dirty(atlas, glyph->x, shelf->y, x1, y1);
+}
+
+/**
+ * Create an empty w*h atlas page. The format is PIXEL_A8 for coverage
+ * or PIXEL_RGB32 for per-channel (sub-pixel) coverage.
+ */
+TTF_Atlas *create_atlas(int w, int h, Pixel_Format format) {
+	if (w <= 0 || h <= 0 || (format != PIXEL_A8 && format != PIXEL_RGB32)) {
+		warn("invalid atlas size or format");
+		return NULL;
+	}
+
+	TTF_Atlas *atlas = calloc(1, sizeof(*atlas));
+	if (!atlas) {
+		warnerr("failed to alloc atlas");
+		return NULL;
+	}
+
+	atlas->page = create_bitmap(w, h, 0x00, format);
+	atlas->max_shelves = INITIAL_SHELVES;
+	atlas->shelves = malloc(atlas->max_shelves * sizeof(*atlas->shelves));
+	atlas->max_holes = INITIAL_HOLES;
+	atlas->holes = malloc(atlas->max_holes * sizeof(*atlas->holes));
+	atlas->num_buckets = INITIAL_BUCKETS;
+	atlas->buckets = calloc(atlas->num_buckets, sizeof(*atlas->buckets));
+	if (!atlas->page || !atlas->shelves || !atlas->holes || !atlas->buckets) {
+		warnerr("failed to alloc atlas");
+		free_atlas(atlas);
+		return NULL;
+	}
+
+	/* The new page has to be uploaded in full. */
+	atlas->frame = 1;
+	mark_dirty(atlas, 0, 0, w, h);
+
+	return atlas;
+}
+
+void free_atlas(TTF_Atlas *atlas) {
+	if (!atlas) {
+		return;
+	}
+	TTF_Atlas_Glyph *glyph = atlas->head;
+	while (glyph) {
+		TTF_Atlas_Glyph *next = glyph->next;
+		free(glyph);
+		glyph = next;
+	}
+	free(atlas->buckets);
+	free(atlas->holes);
+	free(atlas->shelves);
+	free_bitmap(atlas->page);
+	free(atlas);
+}
+
+/**
+ * Remove every glyph and blank the page.
+ */
+void clear_atlas(TTF_Atlas *atlas) {
+	if (!atlas) {
+		return;
+	}
+	while (atlas->head) {
+		remove_glyph(atlas, atlas->head);
+	}
+	atlas->num_shelves = 0;
+	atlas->num_holes = 0;
+	memset(atlas->page->data, 0, atlas->page->stride * atlas->page->h);
+	mark_dirty(atlas, 0, 0, atlas->page->w, atlas->page->h);
+}
+
+/**
+ * Start a new frame. Glyphs looked up or inserted during a frame keep their
+ * place in the page until the next frame begins, so their texture
+ * coordinates stay valid while the frame is drawn.
+ */
+void atlas_begin_frame(TTF_Atlas *atlas) {
+	if (atlas) {
+		atlas->frame++;
+	}
+}
+
+/**
+ * Find a glyph already in the atlas, marking it as used in this frame.
+ */
+TTF_Atlas_Glyph *atlas_lookup(TTF_Atlas *atlas, uint32_t glyph_index, uint16_t ppem, uint32_t raster_flags) {
+	if (!atlas) {
+		return NULL;
+	}
+
+	uint32_t b = hash_key(glyph_index, ppem, raster_flags) & (atlas->num_buckets - 1);
+	for (TTF_Atlas_Glyph *glyph = atlas->buckets[b]; glyph; glyph = glyph->chain) {
+		if (glyph->glyph_index == glyph_index && glyph->ppem == ppem && glyph->raster_flags == raster_flags) {
+			lru_unlink(atlas, glyph);
+			lru_push_front(atlas, glyph);
+			glyph->frame = atlas->frame;
+			return glyph;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Add a glyph, rasterized at the raster's size and mode, to the atlas.
+ * The bitmap is placed at a whole pixel; the advance is unrounded with
+ * RENDER_SUBPIXEL, so callers can position glyphs at fractional pens.
+ * Glyphs not used in the current frame are evicted, least recently used
+ * first, to make room. Returns NULL if the glyph does not fit.
+ */
+TTF_Atlas_Glyph *atlas_insert(TTF_Atlas *atlas, TTF_Raster *raster, TTF_Glyph *glyph) {
+	if (!atlas || !raster || !glyph) {
+		return NULL;
+	}
+
+	TTF_Atlas_Glyph *placed = atlas_lookup(atlas, glyph->index, raster->ppem, raster->flags);
+	if (placed) {
+		return placed;
+	}
+
+	TTF_Cache_Entry *entry = raster_glyph(raster, glyph);
+	if (!entry) {
+		return NULL;
+	}
+	TTF_Bitmap *bitmap = entry->bitmap;
+
+	if (bitmap && (bitmap->w + ATLAS_PADDING > atlas->page->w || bitmap->h + ATLAS_PADDING > atlas->page->h)) {
+		warn("glyph %u is too large for the atlas", glyph->index);
+		return NULL;
+	}
+
+	placed = calloc(1, sizeof(*placed));
+	if (!placed) {
+		warnerr("failed to alloc atlas glyph");
+		return NULL;
+	}
+	placed->glyph_index = glyph->index;
+	placed->ppem = raster->ppem;
+	placed->raster_flags = raster->flags;
+	placed->x_offset = entry->x_offset;
+	placed->y_offset = entry->y_offset;
+	placed->advance = advance_to_f26dot6(raster, glyph->index, 0);
+	placed->shelf = -1;
+	placed->frame = atlas->frame;
+
+	if (bitmap && bitmap->w > 0 && bitmap->h > 0) {
+		int w = bitmap->w + ATLAS_PADDING;
+		int h = bitmap->h + ATLAS_PADDING;
+		int x = 0;
+		int shelf;
+		while ((shelf = place_slot(atlas, w, h, &x)) < 0) {
+			/* Make room by evicting the least recently used glyph. */
+			if (!atlas->tail || atlas->tail->frame == atlas->frame) {
+				warn("atlas is full");
+				free(placed);
+				return NULL;
+			}
+			remove_glyph(atlas, atlas->tail);
+		}
+
+		placed->shelf = shelf;
+		placed->slot_w = w;
+		placed->x = x;
+		placed->y = atlas->shelves[shelf].y;
+		placed->w = bitmap->w;
+		placed->h = bitmap->h;
+		placed->u0 = (float)placed->x / atlas->page->w;
+		placed->v0 = (float)placed->y / atlas->page->h;
+		placed->u1 = (float)(placed->x + placed->w) / atlas->page->w;
+		placed->v1 = (float)(placed->y + placed->h) / atlas->page->h;
+		atlas->shelves[shelf].num_glyphs++;
+
+		write_slot(atlas, placed, bitmap);
+	}
+
+	if (atlas->num_glyphs >= atlas->num_buckets) {
+		grow_buckets(atlas);
+	}
+	uint32_t b = hash_key(placed->glyph_index, placed->ppem, placed->raster_flags) & (atlas->num_buckets - 1);
+	placed->chain = atlas->buckets[b];
+	atlas->buckets[b] = placed;
+	lru_push_front(atlas, placed);
+	atlas->num_glyphs++;
+
+	return placed;
+}
+
+/**
+ * Remove a glyph from the atlas, freeing its space for other glyphs.
+ */
+void atlas_evict(TTF_Atlas *atlas, TTF_Atlas_Glyph *glyph) {
+	if (atlas && glyph) {
+		remove_glyph(atlas, glyph);
+	}
+}
+
+/**
+ * Get the area of the page changed since the last flush, e.g. to upload
+ * to a texture, and reset it. Returns 0 if nothing has changed.
+ */
+int atlas_flush(TTF_Atlas *atlas, int *x, int *y, int *w, int *h) {
+	if (!atlas || atlas->dirty_x1 <= atlas->dirty_x0) {
+		return 0;
+	}
+
+	if (x) *x = atlas->dirty_x0;
+	if (y) *y = atlas->dirty_y0;
+	if (w) *w = atlas->dirty_x1 - atlas->dirty_x0;
+	if (h) *h = atlas->dirty_y1 - atlas->dirty_y0;
+
+	atlas->dirty_x0 = atlas->dirty_y0 = 0;
+	atlas->dirty_x1 = atlas->dirty_y1 = 0;
+
+	return 1;
+}
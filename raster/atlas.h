@@ -0,0 +1,18 @@
+#ifndef ATLAS_H
+#define ATLAS_H
+
+#include "../base/types.h"
+
+TTF_Atlas *create_atlas(int w, int h, Pixel_Format format);
+void free_atlas(TTF_Atlas *atlas);
+void clear_atlas(TTF_Atlas *atlas);
+
+void atlas_begin_frame(TTF_Atlas *atlas);
+
+TTF_Atlas_Glyph *atlas_lookup(TTF_Atlas *atlas, uint32_t glyph_index, uint16_t ppem, uint32_t raster_flags);
+TTF_Atlas_Glyph *atlas_insert(TTF_Atlas *atlas, TTF_Raster *raster, TTF_Glyph *glyph);
+void atlas_evict(TTF_Atlas *atlas, TTF_Atlas_Glyph *glyph);
+
+int atlas_flush(TTF_Atlas *atlas, int *x, int *y, int *w, int *h);
+
+#endif /* ATLAS_H */
@@ -0,0 +1,121 @@
+#include "band.h"
+#include "raster.h"
+#include "bitmap.h"
+#include "pool.h"
+#include "../utils/utils.h"
+#include <stdlib.h>
+
+static int cmp_layout_tops(const void *p1, const void *p2) {
+	const TTF_Layout_Glyph *a = *(TTF_Layout_Glyph * const *)p1;
+	const TTF_Layout_Glyph *b = *(TTF_Layout_Glyph * const *)p2;
+	return (a->top > b->top) - (a->top < b->top);
+}
+
+static int cmp_layout_order(const void *p1, const void *p2) {
+	const TTF_Layout_Glyph *a = *(TTF_Layout_Glyph * const *)p1;
+	const TTF_Layout_Glyph *b = *(TTF_Layout_Glyph * const *)p2;
+	return (a > b) - (a < b);
+}
+
+/**
+ * Render laid out text onto an image h rows tall, a band at a time. The
+ * band bitmap sets the image's width, the height of a band and the
+ * background; the text's top left goes at (x, y). Each finished band is
+ * handed to emit() and then reused, so only the glyphs reaching into the
+ * current band are ever drawn. If pool is not NULL those glyphs are
+ * rasterized in parallel first; the bands themselves are still drawn
+ * and emitted one after another.
+ */
+int render_bands(TTF_Raster *raster, TTF_Raster_Pool *pool, TTF_Layout *layout, int x, int y,
+		TTF_Bitmap *band, int h, TTF_Band_Func emit, void *data) {
+	CHECKPTR(raster);
+	CHECKPTR(layout);
+	CHECKPTR(band);
+	CHECKPTR(emit);
+
+	RETINIT(SUCCESS);
+
+	int n = layout->num_glyphs;
+	TTF_Layout_Glyph **order = NULL;
+	TTF_Layout_Glyph **active = NULL;
+	uint32_t *indices = NULL;
+	uint8_t *phases = NULL;
+
+	order = malloc((n + 1) * sizeof(*order));
+	CHECKFAIL(order, warnerr("failed to alloc band glyphs"));
+	active = malloc((n + 1) * sizeof(*active));
+	CHECKFAIL(active, warnerr("failed to alloc band glyphs"));
+	if (pool) {
+		indices = malloc((n + 1) * sizeof(*indices));
+		CHECKFAIL(indices, warnerr("failed to alloc band glyphs"));
+		phases = malloc((n + 1) * sizeof(*phases));
+		CHECKFAIL(phases, warnerr("failed to alloc band glyphs"));
+	}
+
+	/* Glyphs enter the bands in order of their top row. */
+	for (int i = 0; i < n; i++) {
+		order[i] = &layout->glyphs[i];
+	}
+	qsort(order, n, sizeof(*order), cmp_layout_tops);
+
+	int next = 0, num_active = 0;
+	for (int y0 = 0; y0 < h; y0 += band->h) {
+		int rows = MIN(band->h, h - y0);
+
+		/* Drop the glyphs that ended above this band, and pick up those
+		 * that start in it. */
+		int k = 0;
+		for (int i = 0; i < num_active; i++) {
+			if (y + active[i]->bottom > y0) {
+				active[k++] = active[i];
+			}
+		}
+		num_active = k;
+		int entered = 0;
+		while (next < n && y + order[next]->top < y0 + rows) {
+			if (y + order[next]->bottom > y0) {
+				active[num_active++] = order[next];
+				entered = 1;
+			}
+			next++;
+		}
+		if (entered) {
+			/* Draw in text order, so that overlapping glyphs round
+			 * exactly as they do in draw_string(). */
+			qsort(active, num_active, sizeof(*active), cmp_layout_order);
+		}
+
+		if (pool && num_active > 0) {
+			for (int i = 0; i < num_active; i++) {
+				indices[i] = active[i]->glyph->index;
+				phases[i] = active[i]->x_phase;
+			}
+			CHECKFAIL(pool_raster_glyphs(pool, raster, NULL, indices, phases, num_active),
+					warn("failed to raster band glyphs"));
+		}
+
+		clear_bitmap(band);
+		for (int i = 0; i < num_active; i++) {
+			TTF_Layout_Glyph *placed = active[i];
+			TTF_Cache_Entry *entry = raster_glyph_at(raster, placed->glyph, placed->x_phase);
+			if (!entry) {
+				warn("failed to raster glyph");
+				continue;
+			}
+			if (entry->bitmap) {
+				blend_bitmap(band, entry->bitmap, x + placed->x + entry->x_offset, y + placed->y - entry->y_offset - y0,
+						raster->fg_color, raster->flags & RENDER_LINEAR);
+			}
+		}
+
+		CHECKFAIL(emit(data, band, y0, rows), warn("failed to emit band at row %d", y0));
+	}
+
+	RETRELEASE(
+		/* RELEASE */
+		if (order) free(order);
+		if (active) free(active);
+		if (indices) free(indices);
+		if (phases) free(phases);
+	);
+}
@@ -0,0 +1,9 @@
+#ifndef BAND_H
+#define BAND_H
+
+#include "../base/types.h"
+
+int render_bands(TTF_Raster *raster, TTF_Raster_Pool *pool, TTF_Layout *layout, int x, int y,
+		TTF_Bitmap *band, int h, TTF_Band_Func emit, void *data);
+
+#endif /* BAND_H */
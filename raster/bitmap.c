@@ -1,10 +1,27 @@
 #include "bitmap.h"
+#include "blend.h"
+#include "output.h"
 #include "../utils/utils.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
-#include <png.h>
 
-TTF_Bitmap *create_bitmap(int w, int h, uint32_t c) {
+/**
+ * Number of bytes in one row of a w-pixel wide bitmap.
+ */
+static inline int bitmap_stride(int w, Pixel_Format format) {
+	switch (format) {
+		case PIXEL_A1:
+			return (w + 7) / 8;
+		case PIXEL_A8:
+			return w;
+		case PIXEL_RGB32:
+		default:
+			return w * 4;
+	}
+}
+
+TTF_Bitmap *create_bitmap(int w, int h, uint32_t c, Pixel_Format format) {
 	TTF_Bitmap *bitmap = (TTF_Bitmap *) malloc(sizeof(*bitmap));
 	if (!bitmap) {
 		warn("failed to alloc bitmap");
@@ -13,22 +30,47 @@ TTF_Bitmap *create_bitmap(int w, int h, uint32_t c) {
 
 	bitmap->w = w;
 	bitmap->h = h;
-	bitmap->data = (uint32_t *) malloc((bitmap->w * bitmap->h) * sizeof(*bitmap->data));
+	bitmap->format = format;
+	bitmap->stride = bitmap_stride(w, format);
+	bitmap->data = (uint8_t *) malloc((bitmap->stride * bitmap->h) * sizeof(*bitmap->data));
 	if (!bitmap->data) {
 		warn("failed to alloc bitmap data");
 		free(bitmap);
 		return NULL;
 	}
-
-	int i;
-	for (i = 0; i < (bitmap->w * bitmap->h); i++) {
-		bitmap->data[i] = c;
-	}
 	bitmap->c = c;
 
+	clear_bitmap(bitmap);
+
 	return bitmap;
 }
 
+/**
+ * Fill a bitmap with its background colour.
+ */
+void clear_bitmap(TTF_Bitmap *bitmap) {
+	if (!bitmap) {
+		return;
+	}
+	switch (bitmap->format) {
+		case PIXEL_A1:
+			memset(bitmap->data, (bitmap->c) ? 0xFF : 0x00, bitmap->stride * bitmap->h);
+			break;
+		case PIXEL_A8:
+			memset(bitmap->data, bitmap->c & 0xFF, bitmap->stride * bitmap->h);
+			break;
+		case PIXEL_RGB32:
+		default:
+			for (int y = 0; y < bitmap->h; y++) {
+				uint32_t *row = (uint32_t *)&bitmap->data[y * bitmap->stride];
+				for (int x = 0; x < bitmap->w; x++) {
+					row[x] = bitmap->c;
+				}
+			}
+			break;
+	}
+}
+
 void free_bitmap(TTF_Bitmap *bitmap) {
 	if (!bitmap) {
 		return;
@@ -39,18 +81,53 @@ void free_bitmap(TTF_Bitmap *bitmap) {
 	free(bitmap);
 }
 
+/**
+ * Set a pixel. Alpha formats take a coverage value (0x00-0xFF) and RGB32
+ * takes a colour. A1 pixels are set if the coverage is at least half.
+ */
 void bitmap_set(TTF_Bitmap *bitmap, int x, int y, uint32_t c) {
 	if (!bitmap || !IN(x, 0, bitmap->w-1) || !IN(y, 0, bitmap->h-1)) {
 		return;
 	}
-	bitmap->data[y*bitmap->w + x] = c;
+	uint8_t *row = &bitmap->data[y * bitmap->stride];
+	switch (bitmap->format) {
+		case PIXEL_A1:
+			if ((c & 0xFF) >= 0x80) {
+				row[x >> 3] |= 0x80 >> (x & 7);
+			} else {
+				row[x >> 3] &= ~(0x80 >> (x & 7));
+			}
+			break;
+		case PIXEL_A8:
+			row[x] = c & 0xFF;
+			break;
+		case PIXEL_RGB32:
+		default:
+			((uint32_t *)row)[x] = c;
+			break;
+	}
 }
 
+/**
+ * Get a pixel, in the same form as bitmap_set(). A1 pixels read back as
+ * 0x00 or 0xFF. Pixels outside the bitmap have the background value.
+ */
 uint32_t bitmap_get(TTF_Bitmap *bitmap, int x, int y) {
-	if (!bitmap || !IN(x, 0, bitmap->w-1) || !IN(y, 0, bitmap->h-1)) {
+	if (!bitmap) {
+		return 0;
+	} else if (!IN(x, 0, bitmap->w-1) || !IN(y, 0, bitmap->h-1)) {
 		return bitmap->c;
 	}
-	return bitmap->data[y*bitmap->w + x];
+	uint8_t *row = &bitmap->data[y * bitmap->stride];
+	switch (bitmap->format) {
+		case PIXEL_A1:
+			return (row[x >> 3] & (0x80 >> (x & 7))) ? 0xFF : 0x00;
+		case PIXEL_A8:
+			return row[x];
+		case PIXEL_RGB32:
+		default:
+			return ((uint32_t *)row)[x];
+	}
 }
 
 TTF_Bitmap *copy_bitmap(TTF_Bitmap *bitmap) {
@@ -58,38 +135,102 @@ TTF_Bitmap *copy_bitmap(TTF_Bitmap *bitmap) {
 		return NULL;
 	}
 
-	TTF_Bitmap *copy = create_bitmap(bitmap->w, bitmap->h, bitmap->c);
-
-	int y;
-	for (y = 0; y < bitmap->h; y++) {
-		int x;
-		for (x = 0; x < bitmap->w; x++) {
-			bitmap_set(copy, x, y, bitmap_get(bitmap, x, y));
-		}
+	TTF_Bitmap *copy = create_bitmap(bitmap->w, bitmap->h, bitmap->c, bitmap->format);
+	if (!copy) {
+		return NULL;
 	}
+	memcpy(copy->data, bitmap->data, bitmap->stride * bitmap->h);
 
 	return copy;
 }
 
-int draw_bitmap(TTF_Bitmap *canvas, TTF_Bitmap *bitmap, int x, int y) {
+/**
+ * Draw bitmap onto canvas with its top-left corner at x, y.
+ *
+ * Alpha bitmaps are composited: onto an RGB32 canvas in colour c, onto an
+ * alpha canvas with the "over" operator. RGB32 bitmaps are sub-pixel
+ * glyphs, black on white, whose channels are composited in colour c as
+ * separate coverage values; onto an alpha canvas they are averaged.
+ * If linear is set, RGB32 blending is done in linear light.
+ * The bitmap is clipped to the canvas.
+ */
+int blend_bitmap(TTF_Bitmap *canvas, TTF_Bitmap *bitmap, int x, int y, uint32_t c, int linear) {
 	CHECKPTR(canvas);
 	CHECKPTR(bitmap);
 
-	if (!IN(x, 0, canvas->w-1) || !IN(y, 0, canvas->h-1)) {
-		warn("failed to draw bitmap out of bounds");
-		return FAILURE;
+	/* Clip the bitmap rectangle to the canvas once up front. */
+	int x0 = MAX(x, 0), x1 = MIN(x + bitmap->w, canvas->w);
+	int y0 = MAX(y, 0), y1 = MIN(y + bitmap->h, canvas->h);
+	if (x0 >= x1 || y0 >= y1) {
+		/* Nothing visible. */
+		return SUCCESS;
+	}
+	int n = x1 - x0;
+
+	if (linear) {
+		init_linear_blend();
 	}
 
-	/* Out of bounds checking is also done in bitmap_set,_get() */
-	for (int yb = 0; yb < bitmap->h; yb++) {
-		for (int xb = 0; xb < bitmap->w; xb++) {
-			bitmap_set(canvas, x+xb, y+yb, bitmap_get(bitmap, xb, yb));
+	for (int yc = y0; yc < y1; yc++) {
+		uint8_t *dst = &canvas->data[yc * canvas->stride];
+		uint8_t *src = &bitmap->data[(yc - y) * bitmap->stride];
+		int xs = x0 - x;
+
+		if (bitmap->format == PIXEL_RGB32 && canvas->format == PIXEL_RGB32) {
+			if (linear) {
+				blend_row_rgb32_linear((uint32_t *)&dst[x0 * 4], (uint32_t *)&src[xs * 4], n, c);
+			} else {
+				blend_row_rgb32((uint32_t *)&dst[x0 * 4], (uint32_t *)&src[xs * 4], n, c);
+			}
+		} else if (bitmap->format == PIXEL_A8 && canvas->format == PIXEL_RGB32) {
+			if (linear) {
+				blend_row_a8_linear((uint32_t *)&dst[x0 * 4], &src[xs], n, c);
+			} else {
+				blend_row_a8((uint32_t *)&dst[x0 * 4], &src[xs], n, c);
+			}
+		} else if (bitmap->format == PIXEL_A8 && canvas->format == PIXEL_A8) {
+			blend_row_a8_a8(&dst[x0], &src[xs], n);
+		} else {
+			/* Uncommon format pairs go pixel by pixel. */
+			for (int xc = x0; xc < x1; xc++) {
+				uint32_t pixel = bitmap_get(bitmap, xc - x, yc - y);
+				if (bitmap->format == PIXEL_RGB32) {
+					/* Average the channels' coverage. */
+					pixel = ~pixel;
+					pixel = (((pixel >> 16) & 0xFF) + ((pixel >> 8) & 0xFF) + (pixel & 0xFF) + 1) / 3;
+				}
+				if (canvas->format == PIXEL_A1) {
+					bitmap_set(canvas, xc, yc, MAX(pixel, bitmap_get(canvas, xc, yc)));
+				} else if (canvas->format == PIXEL_RGB32) {
+					uint32_t d = bitmap_get(canvas, xc, yc);
+					uint8_t a = pixel;
+					if (linear) {
+						blend_row_a8_linear(&d, &a, 1, c);
+					} else {
+						blend_row_a8(&d, &a, 1, c);
+					}
+					bitmap_set(canvas, xc, yc, d);
+				} else {
+					uint8_t d = bitmap_get(canvas, xc, yc);
+					uint8_t a = pixel;
+					blend_row_a8_a8(&d, &a, 1);
+					bitmap_set(canvas, xc, yc, d);
+				}
+			}
 		}
 	}
 
 	return SUCCESS;
 }
 
+/**
+ * Draw bitmap onto canvas with its top-left corner at x, y, compositing
+ * alpha bitmaps in black.
+ */
+int draw_bitmap(TTF_Bitmap *canvas, TTF_Bitmap *bitmap, int x, int y) {
+	return blend_bitmap(canvas, bitmap, x, y, 0x000000, 0);
+}
+
 int set_bitmap_gamma(TTF_Bitmap *bitmap, float gamma) {
 	CHECKPTR(bitmap);
 
@@ -98,9 +239,20 @@ int set_bitmap_gamma(TTF_Bitmap *bitmap, float gamma) {
 	}
 	float correction = 1 / gamma;
 
+	if (bitmap->format == PIXEL_A1) {
+		/* Nothing to correct in a bilevel bitmap. */
+		return SUCCESS;
+	}
+
 	for (int y = 0; y < bitmap->h; y++) {
 		for (int x = 0; x < bitmap->w; x++) {
 			uint32_t pixel = bitmap_get(bitmap, x, y);
+			if (bitmap->format == PIXEL_A8) {
+				/* Coverage is the complement of the shade it's drawn with. */
+				float shade = 1 - pixel / (float)255;
+				bitmap_set(bitmap, x, y, 255 * (1 - powf(shade, correction)));
+				continue;
+			}
 			uint8_t *b = (uint8_t *)&pixel;
 			b[0] = 255 * powf((b[0] / (float)255), correction);
 			b[1] = 255 * powf((b[1] / (float)255), correction);
@@ -117,8 +269,8 @@ TTF_Bitmap *combine_bitmaps(TTF_Bitmap *a, TTF_Bitmap *b, uint32_t c) {
 		return NULL;
 	}
 
-	TTF_Bitmap *out = create_bitmap(a->w + b->w, MAX(a->h, b->h), c);
-	if (!c) {
+	TTF_Bitmap *out = create_bitmap(a->w + b->w, MAX(a->h, b->h), c, a->format);
+	if (!out) {
 		warn("failed to combine bitmaps");
 		return NULL;
 	}
@@ -141,75 +293,24 @@ TTF_Bitmap *combine_bitmaps(TTF_Bitmap *a, TTF_Bitmap *b, uint32_t c) {
 	return out;
 }
 
-static inline void set_rgb(png_byte *ptr, uint32_t value) {
-	uint8_t *b = (uint8_t *)&value;
-	ptr[0] = b[2]; ptr[1] = b[1]; ptr[2] = b[0];
-}
-
+/**
+ * Save a bitmap in one go. The file format comes from the file name,
+ * see open_output().
+ */
 int save_bitmap(TTF_Bitmap *bitmap, const char *filename, const char *title) {
-	FILE *fp = NULL;
-	png_structp png_ptr = NULL;
-	png_infop info_ptr = NULL;
-	png_byte *row = NULL;
-
-	RETINIT(SUCCESS);
-
-	CHECKFAIL(bitmap, warn("failed to save uninitialized bitmap"));
-
-	// Open file for writing (binary mode)
-	fp = fopen(filename, "wb");
-	CHECKFAIL(fp, warnerr("failed to open file '%s' for saving bitmap", filename));
-
-	// Initialize the write structure
-	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-	CHECKFAIL(png_ptr, warn("failed to alloc png write struct"));
-
-	// Initialize the info structure
-	info_ptr = png_create_info_struct(png_ptr);
-	CHECKFAIL(info_ptr, warn("failed to alloc png info struct"));
-
-	// Setup libpng exception handling
-	CHECKFAIL(setjmp(png_jmpbuf(png_ptr)) == 0, warn("error occurred during png creation"));
-
-	png_init_io(png_ptr, fp);
-
-	// Write header (8 bit colour depth)
-	png_set_IHDR(png_ptr, info_ptr, bitmap->w, bitmap->h, 8,
-			PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
-			PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
-
-	// Set png title
-	if (title) {
-		png_text png_title;
-		png_title.compression = PNG_TEXT_COMPRESSION_NONE;
-		png_title.key = (png_charp) "Title";
-		png_title.text = (png_charp) title;
-		png_set_text(png_ptr, info_ptr, &png_title, 1);
+	if (!bitmap) {
+		warn("failed to save uninitialized bitmap");
+		return FAILURE;
 	}
 
-	png_write_info(png_ptr, info_ptr);
-
-	// Allocate memory for one row (RBG = 3 bytes / pixel)
-	row = (png_byte *) malloc((bitmap->w * 3) * sizeof(*row));
-	CHECKFAIL(row, warnerr("failed to alloc png row"));
+	TTF_Output_Options options;
+	init_output_options(&options);
+	options.title = title;
 
-	// Write image data
-	int x, y;
-	for (y = 0; y < bitmap->h; y++) {
-		for (x = 0; x < bitmap->w; x++) {
-			set_rgb(&(row[x*3]), bitmap->data[y*bitmap->w + x]);
-		}
-		png_write_row(png_ptr, (png_bytep)row);
+	TTF_Output *output = open_output(filename, bitmap->w, bitmap->h, bitmap->format, &options);
+	if (!output) {
+		return FAILURE;
 	}
-
-	// End write
-	png_write_end(png_ptr, NULL);
-
-	RETRELEASE(
-		/* RELEASE */
-		if (row) free(row);
-		if (info_ptr) png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
-		if (png_ptr) png_destroy_write_struct(&png_ptr, &info_ptr);
-		if (fp) fclose(fp);
-	);
+	output_rows(output, bitmap, 0, bitmap->h);
+	return close_output(output);
 }
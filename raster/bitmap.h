@@ -3,13 +3,15 @@
 
 #include "../base/types.h"
 
-TTF_Bitmap *create_bitmap(int w, int h, uint32_t);
+TTF_Bitmap *create_bitmap(int w, int h, uint32_t c, Pixel_Format format);
 void free_bitmap(TTF_Bitmap *bitmap);
+void clear_bitmap(TTF_Bitmap *bitmap);
 
 void bitmap_set(TTF_Bitmap *bitmap, int x, int y, uint32_t c);
 uint32_t bitmap_get(TTF_Bitmap *bitmap, int x, int y);
 
 int draw_bitmap(TTF_Bitmap *canvas, TTF_Bitmap *bitmap, int x, int y);
+int blend_bitmap(TTF_Bitmap *canvas, TTF_Bitmap *bitmap, int x, int y, uint32_t c, int linear);
 int set_bitmap_gamma(TTF_Bitmap *bitmap, float gamma);
 
 TTF_Bitmap *copy_bitmap(TTF_Bitmap *bitmap);
@@ -0,0 +1,363 @@
+#include "blend.h"
+#include <math.h>
+#include <pthread.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* Bits of precision of linear-light channel values. */
+#define LINEAR_BITS 12
+#define LINEAR_MAX ((1 << LINEAR_BITS) - 1)
+
+static uint16_t srgb_to_linear[256];
+static uint8_t linear_to_srgb[LINEAR_MAX + 1];
+static pthread_once_t linear_tables_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Divide x (<= 255 * 255) by 255, rounding to nearest. The SIMD kernels
+ * use the same arithmetic, so every path gives identical results.
+ */
+static inline uint32_t div255(uint32_t x) {
+	x += 0x80;
+	return (x + (x >> 8)) >> 8;
+}
+
+/**
+ * Blend colour c over a pixel with coverage a. All four bytes are blended
+ * so that this matches the SIMD kernels exactly.
+ */
+static inline uint32_t blend_pixel(uint32_t d, uint32_t c, uint32_t a) {
+	uint32_t out = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		uint32_t dc = (d >> shift) & 0xFF;
+		uint32_t fc = (c >> shift) & 0xFF;
+		out |= div255(dc * (0xFF - a) + fc * a) << shift;
+	}
+	return out;
+}
+
+#if defined(__AVX2__)
+/**
+ * Blend 8 pixels at a time. Within each 128-bit lane, pixels are widened to
+ * 16 bits per channel, blended, and packed back in their original order.
+ */
+static int blend_row_a8_simd(uint32_t *dst, const uint8_t *src, int n, uint32_t c) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i k255 = _mm256_set1_epi16(0xFF);
+	const __m256i k128 = _mm256_set1_epi16(0x80);
+	const __m256i fg = _mm256_unpacklo_epi8(_mm256_set1_epi32(c), zero);
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)&src[i]));
+		a = _mm256_mullo_epi32(a, _mm256_set1_epi32(0x01010101));
+		__m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);
+
+		__m256i d_lo = _mm256_unpacklo_epi8(d, zero);
+		__m256i d_hi = _mm256_unpackhi_epi8(d, zero);
+		__m256i a_lo = _mm256_unpacklo_epi8(a, zero);
+		__m256i a_hi = _mm256_unpackhi_epi8(a, zero);
+
+		__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(d_lo, _mm256_sub_epi16(k255, a_lo)),
+				_mm256_mullo_epi16(fg, a_lo));
+		__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(d_hi, _mm256_sub_epi16(k255, a_hi)),
+				_mm256_mullo_epi16(fg, a_hi));
+		lo = _mm256_add_epi16(lo, k128);
+		hi = _mm256_add_epi16(hi, k128);
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+		_mm256_storeu_si256((__m256i *)&dst[i], _mm256_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+/**
+ * Blend 8 pixels of per-channel coverage at a time, as above.
+ */
+static int blend_row_rgb32_simd(uint32_t *dst, const uint32_t *src, int n, uint32_t c) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i k255 = _mm256_set1_epi16(0xFF);
+	const __m256i k128 = _mm256_set1_epi16(0x80);
+	const __m256i rgb = _mm256_set1_epi32(0x00FFFFFF);
+	const __m256i fg = _mm256_unpacklo_epi8(_mm256_set1_epi32(c), zero);
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		/* Coverage is the inverted channel; the top byte is left alone. */
+		__m256i a = _mm256_andnot_si256(_mm256_loadu_si256((const __m256i *)&src[i]), rgb);
+		__m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);
+
+		__m256i d_lo = _mm256_unpacklo_epi8(d, zero);
+		__m256i d_hi = _mm256_unpackhi_epi8(d, zero);
+		__m256i a_lo = _mm256_unpacklo_epi8(a, zero);
+		__m256i a_hi = _mm256_unpackhi_epi8(a, zero);
+
+		__m256i lo = _mm256_add_epi16(_mm256_mullo_epi16(d_lo, _mm256_sub_epi16(k255, a_lo)),
+				_mm256_mullo_epi16(fg, a_lo));
+		__m256i hi = _mm256_add_epi16(_mm256_mullo_epi16(d_hi, _mm256_sub_epi16(k255, a_hi)),
+				_mm256_mullo_epi16(fg, a_hi));
+		lo = _mm256_add_epi16(lo, k128);
+		hi = _mm256_add_epi16(hi, k128);
+		lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+		hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+
+		_mm256_storeu_si256((__m256i *)&dst[i], _mm256_packus_epi16(lo, hi));
+	}
+	return i;
+}
+#elif defined(__SSE2__)
+/**
+ * Blend 4 pixels at a time, widened to 16 bits per channel.
+ */
+static int blend_row_a8_simd(uint32_t *dst, const uint8_t *src, int n, uint32_t c) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i k255 = _mm_set1_epi16(0xFF);
+	const __m128i k128 = _mm_set1_epi16(0x80);
+	const __m128i fg = _mm_unpacklo_epi8(_mm_set1_epi32(c), zero);
+
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		/* Spread each coverage byte over its pixel's four channels. */
+		uint32_t a4 = src[i] | (src[i+1] << 8) | (src[i+2] << 16) | ((uint32_t)src[i+3] << 24);
+		__m128i a = _mm_cvtsi32_si128(a4);
+		a = _mm_unpacklo_epi8(a, a);
+		a = _mm_unpacklo_epi16(a, a);
+		__m128i d = _mm_loadu_si128((const __m128i *)&dst[i]);
+
+		__m128i d_lo = _mm_unpacklo_epi8(d, zero);
+		__m128i d_hi = _mm_unpackhi_epi8(d, zero);
+		__m128i a_lo = _mm_unpacklo_epi8(a, zero);
+		__m128i a_hi = _mm_unpackhi_epi8(a, zero);
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(d_lo, _mm_sub_epi16(k255, a_lo)),
+				_mm_mullo_epi16(fg, a_lo));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(d_hi, _mm_sub_epi16(k255, a_hi)),
+				_mm_mullo_epi16(fg, a_hi));
+		lo = _mm_add_epi16(lo, k128);
+		hi = _mm_add_epi16(hi, k128);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+
+/**
+ * Blend 4 pixels of per-channel coverage at a time, as above.
+ */
+static int blend_row_rgb32_simd(uint32_t *dst, const uint32_t *src, int n, uint32_t c) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i k255 = _mm_set1_epi16(0xFF);
+	const __m128i k128 = _mm_set1_epi16(0x80);
+	const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+	const __m128i fg = _mm_unpacklo_epi8(_mm_set1_epi32(c), zero);
+
+	int i = 0;
+	for (; i + 4 <= n; i += 4) {
+		/* Coverage is the inverted channel; the top byte is left alone. */
+		__m128i a = _mm_andnot_si128(_mm_loadu_si128((const __m128i *)&src[i]), rgb);
+		__m128i d = _mm_loadu_si128((const __m128i *)&dst[i]);
+
+		__m128i d_lo = _mm_unpacklo_epi8(d, zero);
+		__m128i d_hi = _mm_unpackhi_epi8(d, zero);
+		__m128i a_lo = _mm_unpacklo_epi8(a, zero);
+		__m128i a_hi = _mm_unpackhi_epi8(a, zero);
+
+		__m128i lo = _mm_add_epi16(_mm_mullo_epi16(d_lo, _mm_sub_epi16(k255, a_lo)),
+				_mm_mullo_epi16(fg, a_lo));
+		__m128i hi = _mm_add_epi16(_mm_mullo_epi16(d_hi, _mm_sub_epi16(k255, a_hi)),
+				_mm_mullo_epi16(fg, a_hi));
+		lo = _mm_add_epi16(lo, k128);
+		hi = _mm_add_epi16(hi, k128);
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+		_mm_storeu_si128((__m128i *)&dst[i], _mm_packus_epi16(lo, hi));
+	}
+	return i;
+}
+#elif defined(__ARM_NEON)
+/**
+ * Blend 8 pixels at a time, with the channels de-interleaved into lanes.
+ */
+static int blend_row_a8_simd(uint32_t *dst, const uint8_t *src, int n, uint32_t c) {
+	uint8x8_t fg[4];
+	for (int k = 0; k < 4; k++) {
+		fg[k] = vdup_n_u8((c >> (8*k)) & 0xFF);
+	}
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		uint8x8_t a = vld1_u8(&src[i]);
+		uint8x8_t inv = vmvn_u8(a);
+		uint8x8x4_t d = vld4_u8((const uint8_t *)&dst[i]);
+		for (int k = 0; k < 4; k++) {
+			uint16x8_t x = vmlal_u8(vmull_u8(d.val[k], inv), fg[k], a);
+			/* (x + 128 + ((x + 128) >> 8)) >> 8 */
+			d.val[k] = vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+		}
+		vst4_u8((uint8_t *)&dst[i], d);
+	}
+	return i;
+}
+
+/**
+ * Blend 8 pixels of per-channel coverage at a time, as above.
+ */
+static int blend_row_rgb32_simd(uint32_t *dst, const uint32_t *src, int n, uint32_t c) {
+	uint8x8_t fg[3];
+	for (int k = 0; k < 3; k++) {
+		fg[k] = vdup_n_u8((c >> (8*k)) & 0xFF);
+	}
+
+	int i = 0;
+	for (; i + 8 <= n; i += 8) {
+		uint8x8x4_t s = vld4_u8((const uint8_t *)&src[i]);
+		uint8x8x4_t d = vld4_u8((const uint8_t *)&dst[i]);
+		/* Coverage is the inverted channel; the top byte is left alone. */
+		for (int k = 0; k < 3; k++) {
+			uint16x8_t x = vmlal_u8(vmull_u8(d.val[k], s.val[k]), fg[k], vmvn_u8(s.val[k]));
+			d.val[k] = vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+		}
+		vst4_u8((uint8_t *)&dst[i], d);
+	}
+	return i;
+}
+#else
+static int blend_row_a8_simd(uint32_t *dst, const uint8_t *src, int n, uint32_t c) {
+	(void)dst; (void)src; (void)n; (void)c;
+	return 0;
+}
+
+static int blend_row_rgb32_simd(uint32_t *dst, const uint32_t *src, int n, uint32_t c) {
+	(void)dst; (void)src; (void)n; (void)c;
+	return 0;
+}
+#endif
+
+/**
+ * Composite a row of n A8 coverage values in colour c over RGB32 pixels.
+ */
+void blend_row_a8(uint32_t *dst, const uint8_t *src, int n, uint32_t c) {
+	int i = blend_row_a8_simd(dst, src, n, c);
+	for (; i < n; i++) {
+		if (src[i] == 0xFF) {
+			dst[i] = c;
+		} else if (src[i]) {
+			dst[i] = blend_pixel(dst[i], c, src[i]);
+		}
+	}
+}
+
+/**
+ * Composite a row of n RGB32 sub-pixel glyph pixels in colour c over RGB32
+ * pixels. Each channel of a glyph pixel holds 0xFF minus the coverage of
+ * that channel, as the glyph would appear in black on white. The top byte
+ * of the destination is kept.
+ */
+void blend_row_rgb32(uint32_t *dst, const uint32_t *src, int n, uint32_t c) {
+	int i = blend_row_rgb32_simd(dst, src, n, c);
+	for (; i < n; i++) {
+		uint32_t s = src[i] & 0xFFFFFF;
+		if (s == 0xFFFFFF) {
+			continue;
+		} else if (s == 0) {
+			dst[i] = (c & 0xFFFFFF) | (dst[i] & 0xFF000000);
+			continue;
+		}
+
+		uint32_t out = dst[i] & 0xFF000000;
+		for (int shift = 0; shift < 24; shift += 8) {
+			uint32_t a = 0xFF - ((s >> shift) & 0xFF);
+			uint32_t dc = (dst[i] >> shift) & 0xFF;
+			uint32_t fc = (c >> shift) & 0xFF;
+			out |= div255(dc * (0xFF - a) + fc * a) << shift;
+		}
+		dst[i] = out;
+	}
+}
+
+static void init_linear_tables(void) {
+	for (int i = 0; i < 256; i++) {
+		float s = i / 255.0f;
+		float l = (s <= 0.04045f) ? s / 12.92f : powf((s + 0.055f) / 1.055f, 2.4f);
+		srgb_to_linear[i] = l * LINEAR_MAX + 0.5f;
+	}
+	for (int i = 0; i <= LINEAR_MAX; i++) {
+		float l = i / (float)LINEAR_MAX;
+		float s = (l <= 0.0031308f) ? l * 12.92f : 1.055f * powf(l, 1 / 2.4f) - 0.055f;
+		linear_to_srgb[i] = s * 255 + 0.5f;
+	}
+}
+
+/**
+ * Build the sRGB/linear tables used by blend_row_a8_linear(). Safe to
+ * call from any number of threads; the tables are built once.
+ */
+void init_linear_blend(void) {
+	pthread_once(&linear_tables_once, init_linear_tables);
+}
+
+/**
+ * Composite a row of A8 coverage values in colour c over RGB32 pixels,
+ * blending in linear light rather than directly on sRGB values.
+ * init_linear_blend() must have been called.
+ */
+void blend_row_a8_linear(uint32_t *dst, const uint8_t *src, int n, uint32_t c) {
+	for (int i = 0; i < n; i++) {
+		uint32_t a = src[i];
+		if (a == 0) {
+			continue;
+		} else if (a == 0xFF) {
+			dst[i] = c;
+			continue;
+		}
+
+		uint32_t out = 0;
+		for (int shift = 0; shift < 24; shift += 8) {
+			uint32_t dl = srgb_to_linear[(dst[i] >> shift) & 0xFF];
+			uint32_t fl = srgb_to_linear[(c >> shift) & 0xFF];
+			uint32_t l = (dl * (0xFF - a) + fl * a + 0x7F) / 0xFF;
+			out |= (uint32_t)linear_to_srgb[l] << shift;
+		}
+		dst[i] = out | (dst[i] & 0xFF000000);
+	}
+}
+
+/**
+ * Composite a row of RGB32 sub-pixel glyph pixels, as for
+ * blend_row_rgb32(), in linear light.
+ * init_linear_blend() must have been called.
+ */
+void blend_row_rgb32_linear(uint32_t *dst, const uint32_t *src, int n, uint32_t c) {
+	for (int i = 0; i < n; i++) {
+		uint32_t s = src[i] & 0xFFFFFF;
+		if (s == 0xFFFFFF) {
+			continue;
+		}
+
+		uint32_t out = dst[i] & 0xFF000000;
+		for (int shift = 0; shift < 24; shift += 8) {
+			uint32_t a = 0xFF - ((s >> shift) & 0xFF);
+			uint32_t dl = srgb_to_linear[(dst[i] >> shift) & 0xFF];
+			uint32_t fl = srgb_to_linear[(c >> shift) & 0xFF];
+			uint32_t l = (dl * (0xFF - a) + fl * a + 0x7F) / 0xFF;
+			out |= (uint32_t)linear_to_srgb[l] << shift;
+		}
+		dst[i] = out;
+	}
+}
+
+/**
+ * Composite a row of A8 coverage values over A8 coverage ("over" operator).
+ */
+void blend_row_a8_a8(uint8_t *dst, const uint8_t *src, int n) {
+	for (int i = 0; i < n; i++) {
+		dst[i] = src[i] + div255(dst[i] * (0xFF - src[i]));
+	}
+}
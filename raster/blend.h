@@ -0,0 +1,13 @@
+#ifndef BLEND_H
+#define BLEND_H
+
+#include <stdint.h>
+
+void blend_row_a8(uint32_t *dst, const uint8_t *src, int n, uint32_t c);
+void init_linear_blend(void);
+void blend_row_a8_linear(uint32_t *dst, const uint8_t *src, int n, uint32_t c);
+void blend_row_rgb32(uint32_t *dst, const uint32_t *src, int n, uint32_t c);
+void blend_row_rgb32_linear(uint32_t *dst, const uint32_t *src, int n, uint32_t c);
+void blend_row_a8_a8(uint8_t *dst, const uint8_t *src, int n);
+
+#endif /* BLEND_H */
@@ -0,0 +1,272 @@
+#include "cache.h"
+#include "bitmap.h"
+#include "../utils/utils.h"
+#include <stdlib.h>
+
+#define INITIAL_BUCKETS 64
+
+static inline uint32_t hash_key(uint32_t glyph_index, uint16_t ppem, uint32_t raster_flags, uint8_t x_phase) {
+	uint32_t h = (glyph_index ^ ((uint32_t)x_phase << 24)) * 0x9E3779B1u;
+	h ^= (ppem * 0x85EBCA77u) + (h << 6) + (h >> 2);
+	h ^= (raster_flags * 0xC2B2AE3Du) + (h << 6) + (h >> 2);
+	return h;
+}
+
+static inline size_t entry_size(TTF_Bitmap *bitmap) {
+	size_t size = sizeof(TTF_Cache_Entry);
+	if (bitmap) {
+		size += sizeof(*bitmap) + bitmap->stride * bitmap->h;
+	}
+	return size;
+}
+
+static void lru_unlink(TTF_Glyph_Cache *cache, TTF_Cache_Entry *entry) {
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+	entry->prev = entry->next = NULL;
+}
+
+static void lru_push_front(TTF_Glyph_Cache *cache, TTF_Cache_Entry *entry) {
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head) {
+		cache->head->prev = entry;
+	} else {
+		cache->tail = entry;
+	}
+	cache->head = entry;
+}
+
+/**
+ * Take an entry out of the cache's buckets, LRU list and budget.
+ */
+static void detach_entry(TTF_Glyph_Cache *cache, TTF_Cache_Entry *entry) {
+	/* Unlink from hash bucket. */
+	uint32_t b = hash_key(entry->glyph_index, entry->ppem, entry->raster_flags, entry->x_phase) & (cache->num_buckets - 1);
+	TTF_Cache_Entry **p = &cache->buckets[b];
+	while (*p && *p != entry) {
+		p = &(*p)->chain;
+	}
+	if (*p) {
+		*p = entry->chain;
+	}
+
+	lru_unlink(cache, entry);
+
+	cache->size -= entry->size;
+	cache->num_entries--;
+}
+
+static void free_entry(TTF_Cache_Entry *entry) {
+	free_bitmap(entry->bitmap);
+	free(entry);
+}
+
+static void remove_entry(TTF_Glyph_Cache *cache, TTF_Cache_Entry *entry) {
+	detach_entry(cache, entry);
+	free_entry(entry);
+}
+
+/**
+ * Evict least recently used entries until at least `needed` more bytes
+ * fit within the budget.
+ */
+static void evict(TTF_Glyph_Cache *cache, size_t needed) {
+	TTF_Cache_Entry *entry = cache->tail;
+	while (entry && cache->size + needed > cache->budget) {
+		TTF_Cache_Entry *prev = entry->prev;
+		if (entry->pins == 0) {
+			remove_entry(cache, entry);
+		}
+		entry = prev;
+	}
+}
+
+static int grow_buckets(TTF_Glyph_Cache *cache) {
+	uint32_t num_buckets = cache->num_buckets * 2;
+	TTF_Cache_Entry **buckets = calloc(num_buckets, sizeof(*buckets));
+	if (!buckets) {
+		warnerr("failed to grow glyph cache");
+		return FAILURE;
+	}
+
+	/* Rehash every entry into the new buckets. */
+	for (TTF_Cache_Entry *entry = cache->head; entry; entry = entry->next) {
+		uint32_t b = hash_key(entry->glyph_index, entry->ppem, entry->raster_flags, entry->x_phase) & (num_buckets - 1);
+		entry->chain = buckets[b];
+		buckets[b] = entry;
+	}
+
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->num_buckets = num_buckets;
+
+	return SUCCESS;
+}
+
+TTF_Glyph_Cache *create_glyph_cache(size_t budget) {
+	TTF_Glyph_Cache *cache = malloc(sizeof(*cache));
+	if (!cache) {
+		warnerr("failed to alloc glyph cache");
+		return NULL;
+	}
+
+	cache->num_buckets = INITIAL_BUCKETS;
+	cache->buckets = calloc(cache->num_buckets, sizeof(*cache->buckets));
+	if (!cache->buckets) {
+		warnerr("failed to alloc glyph cache buckets");
+		free(cache);
+		return NULL;
+	}
+	cache->num_entries = 0;
+	cache->head = cache->tail = NULL;
+	cache->size = 0;
+	cache->budget = budget;
+
+	return cache;
+}
+
+void free_glyph_cache(TTF_Glyph_Cache *cache) {
+	if (!cache) {
+		return;
+	}
+	clear_glyph_cache(cache);
+	if (cache->buckets) {
+		free(cache->buckets);
+	}
+	free(cache);
+}
+
+int set_glyph_cache_budget(TTF_Glyph_Cache *cache, size_t budget) {
+	CHECKPTR(cache);
+
+	cache->budget = budget;
+	evict(cache, 0);
+
+	return SUCCESS;
+}
+
+/**
+ * Remove every entry. Pinned entries can no longer be looked up, but stay
+ * valid until they are unpinned.
+ */
+void clear_glyph_cache(TTF_Glyph_Cache *cache) {
+	if (!cache) {
+		return;
+	}
+	while (cache->tail) {
+		TTF_Cache_Entry *entry = cache->tail;
+		if (entry->pins > 0) {
+			detach_entry(cache, entry);
+			entry->detached = 1;
+		} else {
+			remove_entry(cache, entry);
+		}
+	}
+}
+
+TTF_Cache_Entry *cache_lookup(TTF_Glyph_Cache *cache, uint32_t glyph_index, uint16_t ppem, uint32_t raster_flags,
+		uint8_t x_phase) {
+	if (!cache) {
+		return NULL;
+	}
+
+	uint32_t b = hash_key(glyph_index, ppem, raster_flags, x_phase) & (cache->num_buckets - 1);
+	for (TTF_Cache_Entry *entry = cache->buckets[b]; entry; entry = entry->chain) {
+		if (entry->glyph_index == glyph_index && entry->ppem == ppem &&
+				entry->raster_flags == raster_flags && entry->x_phase == x_phase) {
+			/* Mark as most recently used. */
+			if (entry != cache->head) {
+				lru_unlink(cache, entry);
+				lru_push_front(cache, entry);
+			}
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Insert a rasterized glyph into the cache, which takes ownership of bitmap.
+ * The returned entry remains valid until the next insertion or budget change,
+ * unless it is pinned. If the glyph is already cached, the existing entry,
+ * which may be pinned, is returned and bitmap is freed.
+ * On failure NULL is returned and bitmap remains owned by the caller.
+ */
+TTF_Cache_Entry *cache_insert(TTF_Glyph_Cache *cache, uint32_t glyph_index, uint16_t ppem, uint32_t raster_flags,
+		uint8_t x_phase, TTF_Bitmap *bitmap, int16_t x_offset, int16_t y_offset) {
+	if (!cache) {
+		return NULL;
+	}
+
+	TTF_Cache_Entry *old = cache_lookup(cache, glyph_index, ppem, raster_flags, x_phase);
+	if (old) {
+		free_bitmap(bitmap);
+		return old;
+	}
+
+	TTF_Cache_Entry *entry = malloc(sizeof(*entry));
+	if (!entry) {
+		warnerr("failed to alloc glyph cache entry");
+		return NULL;
+	}
+	entry->glyph_index = glyph_index;
+	entry->ppem = ppem;
+	entry->raster_flags = raster_flags;
+	entry->x_phase = x_phase;
+	entry->bitmap = bitmap;
+	entry->x_offset = x_offset;
+	entry->y_offset = y_offset;
+	entry->size = entry_size(bitmap);
+	entry->pins = 0;
+	entry->detached = 0;
+
+	/* Make room first so that the new entry itself is never evicted. */
+	evict(cache, entry->size);
+
+	if (cache->num_entries + 1 > cache->num_buckets) {
+		grow_buckets(cache);
+	}
+
+	uint32_t b = hash_key(glyph_index, ppem, raster_flags, x_phase) & (cache->num_buckets - 1);
+	entry->chain = cache->buckets[b];
+	cache->buckets[b] = entry;
+	lru_push_front(cache, entry);
+
+	cache->size += entry->size;
+	cache->num_entries++;
+
+	return entry;
+}
+
+/**
+ * Keep an entry from being evicted until it is unpinned. Pins nest.
+ */
+void cache_pin(TTF_Cache_Entry *entry) {
+	if (entry) {
+		entry->pins++;
+	}
+}
+
+void cache_unpin(TTF_Glyph_Cache *cache, TTF_Cache_Entry *entry) {
+	if (!cache || !entry || entry->pins == 0) {
+		return;
+	}
+	entry->pins--;
+	if (entry->pins == 0 && entry->detached) {
+		/* The cache was cleared while the entry was pinned. */
+		free_entry(entry);
+	} else if (entry->pins == 0) {
+		/* Entries may have been kept over budget while pinned. */
+		evict(cache, 0);
+	}
+}
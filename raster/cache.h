@@ -0,0 +1,20 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "../base/types.h"
+
+TTF_Glyph_Cache *create_glyph_cache(size_t budget);
+void free_glyph_cache(TTF_Glyph_Cache *cache);
+
+int set_glyph_cache_budget(TTF_Glyph_Cache *cache, size_t budget);
+void clear_glyph_cache(TTF_Glyph_Cache *cache);
+
+TTF_Cache_Entry *cache_lookup(TTF_Glyph_Cache *cache, uint32_t glyph_index, uint16_t ppem, uint32_t raster_flags,
+		uint8_t x_phase);
+TTF_Cache_Entry *cache_insert(TTF_Glyph_Cache *cache, uint32_t glyph_index, uint16_t ppem, uint32_t raster_flags,
+		uint8_t x_phase, TTF_Bitmap *bitmap, int16_t x_offset, int16_t y_offset);
+
+void cache_pin(TTF_Cache_Entry *entry);
+void cache_unpin(TTF_Glyph_Cache *cache, TTF_Cache_Entry *entry);
+
+#endif /* CACHE_H */
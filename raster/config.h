@@ -3,4 +3,23 @@
 
 #define DPI 96
 
+/* Maximum distance (1/64 pixels) between a curve and the lines approximating it. */
+#define CURVE_TOLERANCE 13
+
+/* Default memory budget of a font's glyph bitmap cache (bytes). */
+#define GLYPH_CACHE_BUDGET (4 * 1024 * 1024)
+
+/* Strings whose glyph runs a raster keeps, so that text measured and then
+ * drawn is only shaped once. */
+#define RUN_CACHE_ENTRIES 64
+
+/* Blank pixels kept between glyphs in an atlas page, so that filtered
+ * texture lookups don't bleed into neighbouring glyphs. */
+#define ATLAS_PADDING 1
+
+/* Sub-pixel pen offsets a glyph is rasterized at with RENDER_SUBPIXEL (a
+ * power of two). Each is cached separately, so more steps trade memory
+ * for evenness. */
+#define SUBPIXEL_STEPS 4
+
 #endif /* CONFIG_H */
@@ -0,0 +1,39 @@
+#include "fixed.h"
+#include <math.h>
+
+F26Dot6 float_to_f26dot6(float x) {
+	return roundf(x * F26DOT6_ONE);
+}
+
+/**
+ * Multiply by a 16.16 value, rounding half away from zero.
+ */
+int32_t mul_fix(int32_t a, F16Dot16 b) {
+	int64_t p = (int64_t)a * b;
+	if (p < 0) {
+		return -(int32_t)((-p + 0x8000) >> 16);
+	}
+	return (p + 0x8000) >> 16;
+}
+
+/**
+ * Compute a * b / c (c > 0) without overflow, rounding half away from zero.
+ */
+int32_t mul_div(int32_t a, int32_t b, int32_t c) {
+	int64_t p = (int64_t)a * b;
+	if (p < 0) {
+		return -(int32_t)((-p + c / 2) / c);
+	}
+	return (p + c / 2) / c;
+}
+
+/**
+ * Divide rounding towards negative infinity (b > 0).
+ */
+int64_t floor_div(int64_t a, int64_t b) {
+	int64_t q = a / b;
+	if (a % b < 0) {
+		q--;
+	}
+	return q;
+}
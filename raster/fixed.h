@@ -0,0 +1,18 @@
+#ifndef FIXED_H
+#define FIXED_H
+
+#include "../base/types.h"
+
+#define F26DOT6_ONE 64
+#define F26DOT6_FLOOR(x) ((x) & ~63)
+#define F26DOT6_CEIL(x) (((x) + 63) & ~63)
+#define F26DOT6_TRUNC(x) ((x) >> 6)	/* Whole pixels, rounding down. */
+
+#define F16DOT16_ONE 65536
+
+F26Dot6 float_to_f26dot6(float x);
+int32_t mul_fix(int32_t a, F16Dot16 b);
+int32_t mul_div(int32_t a, int32_t b, int32_t c);
+int64_t floor_div(int64_t a, int64_t b);
+
+#endif /* FIXED_H */
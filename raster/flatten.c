@@ -0,0 +1,65 @@
+#include "flatten.h"
+#include "fixed.h"
+#include "../utils/utils.h"
+#include <stdlib.h>
+
+/* Upper bound on lines per curve, keeping the stepping below in range. */
+#define MAX_CURVE_STEPS 1024
+
+/**
+ * Number of lines needed to keep a quadratic curve within tolerance of
+ * its approximation, by Wang's formula: n = sqrt(|P0 - 2*P1 + P2| / 4*tol).
+ * The length is over-estimated as max + min/2 to stay in integers.
+ * Coordinates are in the units the curve is drawn in, so larger curves
+ * at larger sizes get more lines.
+ */
+int curve_steps(F26Dot6 x0, F26Dot6 y0, F26Dot6 x1, F26Dot6 y1, F26Dot6 x2, F26Dot6 y2, F26Dot6 tolerance) {
+	int64_t ddx = llabs((int64_t)x0 - 2*(int64_t)x1 + x2);
+	int64_t ddy = llabs((int64_t)y0 - 2*(int64_t)y1 + y2);
+	int64_t len = MAX(ddx, ddy) + MIN(ddx, ddy) / 2;
+	int64_t tol = 4 * (int64_t)MAX(tolerance, 1);
+
+	int n = 1;
+	while (n < MAX_CURVE_STEPS && tol * n * n < len) {
+		n++;
+	}
+	return n;
+}
+
+/**
+ * Flatten a quadratic curve into lines no further than tolerance from
+ * the curve, passing each line to line(). Points along the curve are
+ * stepped with exact integer forward differences of n^2 * P(i/n).
+ */
+int flatten_curve(F26Dot6 x0, F26Dot6 y0, F26Dot6 x1, F26Dot6 y1, F26Dot6 x2, F26Dot6 y2, F26Dot6 tolerance,
+		Line_Func line, void *data) {
+	int64_t n = curve_steps(x0, y0, x1, y1, x2, y2, tolerance);
+	int64_t nn = n * n;
+
+	/* n^2 * P(i/n) = A*i^2 + B*n*i + n^2*P0 */
+	int64_t ax = (int64_t)x0 - 2*(int64_t)x1 + x2, ay = (int64_t)y0 - 2*(int64_t)y1 + y2;
+	int64_t bx = 2*((int64_t)x1 - x0), by = 2*((int64_t)y1 - y0);
+
+	/* First and second differences over one step. */
+	int64_t px = nn * x0, py = nn * y0;
+	int64_t dx = ax + bx*n, dy = ay + by*n;
+	int64_t ddx = 2*ax, ddy = 2*ay;
+
+	F26Dot6 x = x0, y = y0;
+	for (int i = 1; i < n; i++) {
+		px += dx;
+		py += dy;
+		dx += ddx;
+		dy += ddy;
+
+		F26Dot6 xn = floor_div(px + nn/2, nn);
+		F26Dot6 yn = floor_div(py + nn/2, nn);
+		if (!line(data, x, y, xn, yn)) {
+			return FAILURE;
+		}
+		x = xn;
+		y = yn;
+	}
+
+	return line(data, x, y, x2, y2);
+}
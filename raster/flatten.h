@@ -0,0 +1,13 @@
+#ifndef FLATTEN_H
+#define FLATTEN_H
+
+#include "../base/types.h"
+
+/* Receives each line of a flattened curve. Returns 0 to stop flattening. */
+typedef int (*Line_Func)(void *data, F26Dot6 x0, F26Dot6 y0, F26Dot6 x1, F26Dot6 y1);
+
+int curve_steps(F26Dot6 x0, F26Dot6 y0, F26Dot6 x1, F26Dot6 y1, F26Dot6 x2, F26Dot6 y2, F26Dot6 tolerance);
+int flatten_curve(F26Dot6 x0, F26Dot6 y0, F26Dot6 x1, F26Dot6 y1, F26Dot6 x2, F26Dot6 y2, F26Dot6 tolerance,
+		Line_Func line, void *data);
+
+#endif /* FLATTEN_H */
@@ -0,0 +1,93 @@
+#include "layout.h"
+#include "scale.h"
+#include "run.h"
+#include "../base/font.h"
+#include "../glyph/glyph.h"
+#include "../utils/utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ * Lay out lines of UTF-8 text at the raster's size, once, so that they can be
+ * drawn a band at a time. Lines are split at '\n', shaped as glyph runs
+ * like draw_string() and spaced by the font's ascent, descent and line
+ * gap. The first baseline is one ascent below the top. Returns NULL if
+ * the text cannot be shaped.
+ */
+TTF_Layout *layout_text(TTF_Raster *raster, const char *text) {
+	if (!raster || !text) {
+		return NULL;
+	}
+	TTF_Font *font = raster->font;
+
+	TTF_Layout *layout = calloc(1, sizeof(*layout));
+	TTF_Glyph_Run *run = create_glyph_run();
+	if (!layout || !run) {
+		warnerr("failed to alloc layout");
+		free(layout);
+		free_glyph_run(run);
+		return NULL;
+	}
+	layout->glyphs = malloc((strlen(text) + 1) * sizeof(*layout->glyphs));
+	if (!layout->glyphs) {
+		warnerr("failed to alloc layout glyphs");
+		free_layout(layout);
+		free_glyph_run(run);
+		return NULL;
+	}
+
+	int ascent = funit_to_pixel(raster, get_font_ascent(font));
+	int descent = fabsf(funit_to_pixel(raster, get_font_descent(font)));
+	int line_gap = funit_to_pixel(raster, get_font_line_gap(font));
+
+	int y = ascent;
+	for (const char *line = text;; line++) {
+		size_t len = strcspn(line, "\n");
+		if (!glyph_run_utf8(run, raster, line, len)) {
+			warn("failed to lay out text");
+			free_layout(layout);
+			free_glyph_run(run);
+			return NULL;
+		}
+		layout->w = MAX(layout->w, run->width);
+
+		for (int i = 0; i < run->num_glyphs; i++) {
+			TTF_Glyph *glyph = run->glyphs[i].glyph;
+			TTF_Outline *outline = (glyph) ? get_glyph_outline(font, glyph) : NULL;
+			if (!outline) {
+				/* Nothing to draw. */
+				continue;
+			}
+
+			/* Bound the rows the glyph's bitmap covers, with a pixel to spare
+			 * for the rounding of the render modes. */
+			TTF_Layout_Glyph *placed = &layout->glyphs[layout->num_glyphs++];
+			placed->glyph = glyph;
+			placed->x = pen_to_pixel(raster, run->glyphs[i].x_offset, &placed->x_phase);
+			placed->y = y;
+			placed->top = y - (int)ceilf(funit_to_pixel(raster, ceilf(outline->y_max))) - 1;
+			placed->bottom = y - (int)floorf(funit_to_pixel(raster, floorf(outline->y_min))) + 1;
+		}
+
+		line += len;
+		if (*line == '\0') {
+			break;
+		}
+		y += ascent + descent + line_gap;
+	}
+	layout->h = y + descent;
+
+	free_glyph_run(run);
+	return layout;
+}
+
+void free_layout(TTF_Layout *layout) {
+	if (!layout) {
+		return;
+	}
+	if (layout->glyphs) {
+		free(layout->glyphs);
+	}
+	free(layout);
+}
@@ -0,0 +1,9 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "../base/types.h"
+
+TTF_Layout *layout_text(TTF_Raster *raster, const char *text);
+void free_layout(TTF_Layout *layout);
+
+#endif /* LAYOUT_H */
@@ -0,0 +1,354 @@
+#include "output.h"
+#include "../utils/utils.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <png.h>
+
+static int write_file(void *data, const uint8_t *buf, size_t size) {
+	return fwrite(buf, 1, size, (FILE *)data) == size;
+}
+
+static int has_extension(const char *filename, const char *ext) {
+	const char *dot = strrchr(filename, '.');
+	if (!dot) {
+		return 0;
+	}
+	for (dot++; *dot && *ext; dot++, ext++) {
+		if (tolower((unsigned char)*dot) != *ext) {
+			return 0;
+		}
+	}
+	return *dot == '\0' && *ext == '\0';
+}
+
+static int output_format_from_filename(const char *filename) {
+	if (has_extension(filename, "pgm") || has_extension(filename, "ppm") || has_extension(filename, "pnm")) {
+		return OUTPUT_PNM;
+	} else if (has_extension(filename, "raw")) {
+		return OUTPUT_RAW;
+	}
+	return OUTPUT_PNG;
+}
+
+int init_output_options(TTF_Output_Options *options) {
+	CHECKPTR(options);
+
+	options->format = OUTPUT_AUTO;
+	options->level = -1;
+	options->filters = 0;
+	options->grey = 0;
+	options->title = NULL;
+
+	return SUCCESS;
+}
+
+static void png_write_data(png_structp png, png_bytep buf, png_size_t size) {
+	TTF_Output *output = png_get_io_ptr(png);
+	if (!output->write(output->data, buf, size)) {
+		png_error(png, "failed to write png data");
+	}
+}
+
+static void png_flush_data(png_structp png) {
+	(void)png;
+}
+
+static int png_filter_flags(int filters) {
+	return ((filters & FILTER_NONE) ? PNG_FILTER_NONE : 0) |
+		((filters & FILTER_SUB) ? PNG_FILTER_SUB : 0) |
+		((filters & FILTER_UP) ? PNG_FILTER_UP : 0) |
+		((filters & FILTER_AVG) ? PNG_FILTER_AVG : 0) |
+		((filters & FILTER_PAETH) ? PNG_FILTER_PAETH : 0);
+}
+
+static int begin_png(TTF_Output *output, const TTF_Output_Options *options) {
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (!png) {
+		warn("failed to alloc png write struct");
+		return FAILURE;
+	}
+	output->png = png;
+
+	png_infop info = png_create_info_struct(png);
+	if (!info) {
+		warn("failed to alloc png info struct");
+		return FAILURE;
+	}
+	output->png_info = info;
+
+	// Setup libpng exception handling
+	if (setjmp(png_jmpbuf(png))) {
+		warn("error occurred during png creation");
+		return FAILURE;
+	}
+
+	png_set_write_fn(png, output, png_write_data, png_flush_data);
+
+	/* The zlib level and row filters trade file size for encoding time. */
+	if (options->level >= 0) {
+		png_set_compression_level(png, MIN(options->level, 9));
+	}
+	if (options->filters & FILTER_ALL) {
+		png_set_filter(png, PNG_FILTER_TYPE_BASE, png_filter_flags(options->filters));
+	}
+
+	png_set_IHDR(png, info, output->w, output->h, 8,
+			(output->channels == 3) ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+	// Set png title
+	if (options->title) {
+		png_text png_title;
+		png_title.compression = PNG_TEXT_COMPRESSION_NONE;
+		png_title.key = (png_charp) "Title";
+		png_title.text = (png_charp) options->title;
+		png_set_text(png, info, &png_title, 1);
+	}
+
+	png_write_info(png, info);
+
+	return SUCCESS;
+}
+
+static int begin_pnm(TTF_Output *output, const TTF_Output_Options *options) {
+	char header[64];
+	int n = snprintf(header, sizeof(header), "P%c\n", (output->channels == 3) ? '6' : '5');
+	if (!output->write(output->data, (const uint8_t *)header, n)) {
+		return FAILURE;
+	}
+	if (options->title && !strchr(options->title, '\n')) {
+		if (!output->write(output->data, (const uint8_t *)"# ", 2) ||
+				!output->write(output->data, (const uint8_t *)options->title, strlen(options->title)) ||
+				!output->write(output->data, (const uint8_t *)"\n", 1)) {
+			return FAILURE;
+		}
+	}
+	n = snprintf(header, sizeof(header), "%d %d\n255\n", output->w, output->h);
+	return output->write(output->data, (const uint8_t *)header, n);
+}
+
+/**
+ * Open an image of w x h pixels for writing through write(). Rows
+ * are added with output_rows() and encoded as they arrive.
+ */
+TTF_Output *open_output_stream(TTF_Write_Func write, void *data, int w, int h, Pixel_Format format,
+		const TTF_Output_Options *options) {
+	if (!write || w <= 0 || h <= 0) {
+		warn("failed to open output of size %dx%d", w, h);
+		return NULL;
+	}
+
+	TTF_Output_Options defaults;
+	if (!options) {
+		init_output_options(&defaults);
+		options = &defaults;
+	}
+
+	TTF_Output *output = calloc(1, sizeof(*output));
+	if (!output) {
+		warnerr("failed to alloc output");
+		return NULL;
+	}
+	output->write = write;
+	output->data = data;
+	output->format = (options->format == OUTPUT_AUTO) ? OUTPUT_PNG : options->format;
+	output->w = w;
+	output->h = h;
+	output->channels = (format == PIXEL_RGB32 && !options->grey) ? 3 : 1;
+
+	output->row = malloc(w * output->channels * sizeof(*output->row));
+	if (!output->row) {
+		warnerr("failed to alloc output row");
+		close_output(output);
+		return NULL;
+	}
+
+	int begun;
+	switch (output->format) {
+		case OUTPUT_PNG:
+			begun = begin_png(output, options);
+			break;
+		case OUTPUT_PNM:
+			begun = begin_pnm(output, options);
+			break;
+		case OUTPUT_RAW:
+		default:
+			begun = SUCCESS;
+			break;
+	}
+	if (!begun) {
+		warn("failed to write output header");
+		output->failed = 1;
+		close_output(output);
+		return NULL;
+	}
+
+	return output;
+}
+
+/**
+ * Open an image file for writing. With OUTPUT_AUTO the format comes from
+ * the file name: .pgm, .ppm or .pnm for PNM, .raw for raw, else PNG.
+ */
+TTF_Output *open_output(const char *filename, int w, int h, Pixel_Format format,
+		const TTF_Output_Options *options) {
+	if (!filename) {
+		return NULL;
+	}
+
+	TTF_Output_Options file_options;
+	if (options) {
+		file_options = *options;
+	} else {
+		init_output_options(&file_options);
+	}
+	if (file_options.format == OUTPUT_AUTO) {
+		file_options.format = output_format_from_filename(filename);
+	}
+
+	// Open file for writing (binary mode)
+	FILE *fp = fopen(filename, "wb");
+	if (!fp) {
+		warnerr("failed to open file '%s' for saving bitmap", filename);
+		return NULL;
+	}
+
+	TTF_Output *output = open_output_stream(write_file, fp, w, h, format, &file_options);
+	if (!output) {
+		fclose(fp);
+		return NULL;
+	}
+	output->owns_file = 1;
+
+	return output;
+}
+
+/**
+ * Finish the image and free the output. Fails if not every row was
+ * written, or if writing failed.
+ */
+int close_output(TTF_Output *output) {
+	CHECKPTR(output);
+
+	if (!output->failed && output->y != output->h) {
+		warn("closing output after %d of %d rows", output->y, output->h);
+		output->failed = 1;
+	}
+
+	png_structp png = output->png;
+	png_infop info = output->png_info;
+	if (png && !output->failed) {
+		if (setjmp(png_jmpbuf(png))) {
+			warn("error occurred during png creation");
+			output->failed = 1;
+		} else {
+			png_write_end(png, NULL);
+		}
+	}
+	if (png) {
+		png_destroy_write_struct(&png, (info) ? &info : NULL);
+	}
+
+	if (output->owns_file && fclose(output->data) != 0) {
+		warnerr("failed to close output file");
+		output->failed = 1;
+	}
+
+	int result = output->failed ? FAILURE : SUCCESS;
+	free(output->row);
+	free(output);
+	return result;
+}
+
+/**
+ * Convert row y of a bitmap to 8-bit grey or RGB samples. Coverage is
+ * drawn as black ink on white, like the RGB renders.
+ */
+static void convert_row(TTF_Output *output, TTF_Bitmap *bitmap, int y) {
+	const uint8_t *src = &bitmap->data[y * bitmap->stride];
+	uint8_t *dst = output->row;
+	int x;
+
+	if (bitmap->format == PIXEL_RGB32) {
+		const uint32_t *pixels = (const uint32_t *)src;
+		if (output->channels == 3) {
+			for (x = 0; x < output->w; x++) {
+				dst[x*3] = pixels[x] >> 16;
+				dst[x*3+1] = pixels[x] >> 8;
+				dst[x*3+2] = pixels[x];
+			}
+		} else {
+			for (x = 0; x < output->w; x++) {
+				uint32_t r = (pixels[x] >> 16) & 0xFF, g = (pixels[x] >> 8) & 0xFF, b = pixels[x] & 0xFF;
+				dst[x] = (77 * r + 150 * g + 29 * b + 128) >> 8;
+			}
+		}
+		return;
+	}
+
+	for (x = 0; x < output->w; x++) {
+		uint8_t v;
+		if (bitmap->format == PIXEL_A8) {
+			v = 0xFF - src[x];
+		} else {
+			v = (src[x >> 3] & (0x80 >> (x & 7))) ? 0x00 : 0xFF;
+		}
+		if (output->channels == 3) {
+			dst[x*3] = dst[x*3+1] = dst[x*3+2] = v;
+		} else {
+			dst[x] = v;
+		}
+	}
+}
+
+static int write_png_rows(TTF_Output *output, TTF_Bitmap *bitmap, int y, int num_rows) {
+	if (setjmp(png_jmpbuf((png_structp)output->png))) {
+		warn("error occurred during png creation");
+		return FAILURE;
+	}
+	for (int i = 0; i < num_rows; i++) {
+		convert_row(output, bitmap, y + i);
+		png_write_row(output->png, output->row);
+	}
+	return SUCCESS;
+}
+
+static int write_rows(TTF_Output *output, TTF_Bitmap *bitmap, int y, int num_rows) {
+	size_t size = output->w * output->channels;
+	for (int i = 0; i < num_rows; i++) {
+		convert_row(output, bitmap, y + i);
+		if (!output->write(output->data, output->row, size)) {
+			warnerr("failed to write output row");
+			return FAILURE;
+		}
+	}
+	return SUCCESS;
+}
+
+/**
+ * Encode rows y to y+num_rows-1 of a bitmap as the next rows of the
+ * image. The bitmap must be as wide as the image; it may be the whole
+ * canvas or just one band of it.
+ */
+int output_rows(TTF_Output *output, TTF_Bitmap *bitmap, int y, int num_rows) {
+	CHECKPTR(output);
+	CHECKPTR(bitmap);
+
+	RETINIT(SUCCESS);
+
+	CHECKFAIL(!output->failed, PASS);
+	CHECKFAIL(bitmap->w == output->w, warn("failed to output rows of width %d to image of width %d", bitmap->w, output->w));
+	CHECKFAIL(y >= 0 && num_rows >= 0 && y + num_rows <= bitmap->h, warn("failed to output rows out of bounds"));
+	CHECKFAIL(output->y + num_rows <= output->h, warn("failed to output rows past the end of the image"));
+
+	if (output->format == OUTPUT_PNG) {
+		CHECKFAIL(write_png_rows(output, bitmap, y, num_rows), output->failed = 1);
+	} else {
+		CHECKFAIL(write_rows(output, bitmap, y, num_rows), output->failed = 1);
+	}
+	output->y += num_rows;
+
+	RET;
+}
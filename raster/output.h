@@ -0,0 +1,16 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "../base/types.h"
+
+int init_output_options(TTF_Output_Options *options);
+
+TTF_Output *open_output(const char *filename, int w, int h, Pixel_Format format,
+		const TTF_Output_Options *options);
+TTF_Output *open_output_stream(TTF_Write_Func write, void *data, int w, int h, Pixel_Format format,
+		const TTF_Output_Options *options);
+int close_output(TTF_Output *output);
+
+int output_rows(TTF_Output *output, TTF_Bitmap *bitmap, int y, int num_rows);
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,333 @@
+#include "pool.h"
+#include "raster.h"
+#include "atlas.h"
+#include "bitmap.h"
+#include "cache.h"
+#include "../glyph/glyph.h"
+#include "../utils/utils.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+/* A job's glyph and sub-pixel phase, packed so that jobs sort by glyph.
+ * Glyph indices fit in 16 bits. */
+#define JOB_KEY(glyph_index, x_phase) ((glyph_index) | (uint32_t)(x_phase) << 16)
+#define JOB_GLYPH(key) ((key) & 0xFFFF)
+#define JOB_PHASE(key) ((key) >> 16)
+
+static int cmp_glyph_indices(const void *p1, const void *p2) {
+	uint32_t a = *(const uint32_t *)p1;
+	uint32_t b = *(const uint32_t *)p2;
+	return (a > b) - (a < b);
+}
+
+/**
+ * Hand a finished job's bitmap to the target cache (and atlas).
+ * The commit lock must be held.
+ */
+static void commit_job(TTF_Raster_Pool *pool, TTF_Pool_Job *job) {
+	TTF_Raster *target = pool->target;
+
+	if (job->state < 0) {
+		pool->failed = 1;
+		return;
+	}
+
+	TTF_Cache_Entry *entry = cache_insert(target->cache, job->glyph->index, target->ppem, target->flags,
+			job->x_phase, job->bitmap, job->x_offset, job->y_offset);
+	if (!entry) {
+		free_bitmap(job->bitmap);
+		pool->failed = 1;
+	} else if (pool->atlas && job->x_phase == 0 && !atlas_insert(pool->atlas, target, job->glyph)) {
+		pool->failed = 1;
+	}
+	job->bitmap = NULL;
+}
+
+/**
+ * Record a finished job. In deterministic mode jobs are committed strictly
+ * in order, so the cache and atlas end up the same on every run.
+ */
+static void finish_job(TTF_Raster_Pool *pool, int i, int state) {
+	pthread_mutex_lock(&pool->commit_lock);
+	pool->jobs[i].state = state;
+	if (pool->deterministic) {
+		while (pool->next_commit < pool->num_jobs && pool->jobs[pool->next_commit].state != 0) {
+			commit_job(pool, &pool->jobs[pool->next_commit++]);
+		}
+	} else {
+		commit_job(pool, &pool->jobs[i]);
+	}
+	pthread_mutex_unlock(&pool->commit_lock);
+}
+
+static int take_job(TTF_Pool_Worker *worker) {
+	int i = -1;
+	pthread_mutex_lock(&worker->lock);
+	if (worker->begin < worker->end) {
+		i = worker->begin++;
+	}
+	pthread_mutex_unlock(&worker->lock);
+	return i;
+}
+
+/**
+ * Steal the back half of another worker's remaining jobs, and take the
+ * first of them. Returns -1 once every worker has run dry.
+ */
+static int steal_jobs(TTF_Pool_Worker *worker) {
+	TTF_Raster_Pool *pool = worker->pool;
+
+	for (int k = 1; k < pool->num_workers; k++) {
+		TTF_Pool_Worker *victim = &pool->workers[(worker->id + k) % pool->num_workers];
+
+		pthread_mutex_lock(&victim->lock);
+		int remaining = victim->end - victim->begin;
+		int begin = victim->end - (remaining + 1) / 2;
+		int end = victim->end;
+		if (remaining > 0) {
+			victim->end = begin;
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if (remaining > 0) {
+			pthread_mutex_lock(&worker->lock);
+			worker->begin = begin + 1;
+			worker->end = end;
+			pthread_mutex_unlock(&worker->lock);
+			return begin;
+		}
+	}
+
+	return -1;
+}
+
+static void run_jobs(TTF_Pool_Worker *worker) {
+	TTF_Raster_Pool *pool = worker->pool;
+	TTF_Raster *target = pool->target;
+
+	/* Match the worker's raster to the target's size and mode. */
+	int ready;
+	if (worker->raster) {
+		ready = raster_init(worker->raster, target->font, target->point, target->dpi, target->flags);
+	} else {
+		worker->raster = create_uncached_raster(target->font, target->point, target->dpi, target->flags);
+		ready = worker->raster != NULL;
+	}
+
+	int i;
+	while ((i = take_job(worker)) >= 0 || (i = steal_jobs(worker)) >= 0) {
+		TTF_Pool_Job *job = &pool->jobs[i];
+		int state = -1;
+		if (ready) {
+			job->glyph = get_glyph_by_index(target->font, JOB_GLYPH(pool->glyph_indices[i]));
+			job->x_phase = JOB_PHASE(pool->glyph_indices[i]);
+			if (job->glyph && rasterize_glyph(worker->raster, job->glyph, job->x_phase, &job->bitmap,
+						&job->x_offset, &job->y_offset)) {
+				state = 1;
+			}
+		}
+		finish_job(pool, i, state);
+	}
+}
+
+static void *worker_main(void *arg) {
+	TTF_Pool_Worker *worker = arg;
+	TTF_Raster_Pool *pool = worker->pool;
+	uint32_t generation = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->quit && pool->generation == generation) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+		if (pool->quit) {
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		run_jobs(worker);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0) {
+			pthread_cond_signal(&pool->done);
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+/**
+ * Create a pool of worker threads for rasterizing glyphs in parallel,
+ * one per online CPU if num_threads <= 0. In deterministic mode the
+ * results of a batch are committed in glyph order, at some cost in
+ * memory while out of order glyphs wait.
+ */
+TTF_Raster_Pool *create_raster_pool(int num_threads, int deterministic) {
+	if (num_threads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = (cpus > 0) ? cpus : 1;
+	}
+
+	TTF_Raster_Pool *pool = calloc(1, sizeof(*pool));
+	if (!pool) {
+		warnerr("failed to alloc raster pool");
+		return NULL;
+	}
+	pool->deterministic = deterministic;
+
+	pool->workers = calloc(num_threads, sizeof(*pool->workers));
+	if (!pool->workers) {
+		warnerr("failed to alloc raster pool workers");
+		free(pool);
+		return NULL;
+	}
+
+	if (pthread_mutex_init(&pool->lock, NULL) ||
+			pthread_mutex_init(&pool->commit_lock, NULL) ||
+			pthread_cond_init(&pool->wake, NULL) ||
+			pthread_cond_init(&pool->done, NULL)) {
+		warn("failed to init raster pool locks");
+		free(pool->workers);
+		free(pool);
+		return NULL;
+	}
+
+	for (int i = 0; i < num_threads; i++) {
+		TTF_Pool_Worker *worker = &pool->workers[i];
+		worker->pool = pool;
+		worker->id = i;
+		if (pthread_mutex_init(&worker->lock, NULL)) {
+			warn("failed to init raster pool worker");
+			break;
+		}
+		if (pthread_create(&worker->thread, NULL, worker_main, worker)) {
+			warn("failed to start raster pool worker");
+			pthread_mutex_destroy(&worker->lock);
+			break;
+		}
+		pool->num_workers++;
+	}
+
+	if (pool->num_workers == 0) {
+		free_raster_pool(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+void free_raster_pool(TTF_Raster_Pool *pool) {
+	if (!pool) {
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int i = 0; i < pool->num_workers; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+		pthread_mutex_destroy(&pool->workers[i].lock);
+		free_raster(pool->workers[i].raster);
+	}
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->wake);
+	pthread_mutex_destroy(&pool->commit_lock);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+}
+
+/**
+ * Rasterize a run of glyphs at the raster's size and mode across the
+ * pool's workers, adding them to the raster's cache and, if atlas is not
+ * NULL, to the atlas. If x_phases is not NULL, glyph i is rasterized at
+ * sub-pixel phase x_phases[i]; only whole pixel glyphs go in the atlas.
+ * Glyphs already cached are not rasterized again. Blocks until the whole
+ * run is done.
+ */
+int pool_raster_glyphs(TTF_Raster_Pool *pool, TTF_Raster *raster, TTF_Atlas *atlas,
+		const uint32_t *glyph_indices, const uint8_t *x_phases, int num_glyphs) {
+	CHECKPTR(pool);
+	CHECKPTR(raster);
+	CHECKPTR(glyph_indices);
+
+	RETINIT(SUCCESS);
+
+	uint32_t *indices = NULL;
+	int num_jobs = 0;
+
+	if (num_glyphs <= 0) {
+		return SUCCESS;
+	}
+
+	indices = malloc(num_glyphs * sizeof(*indices));
+	CHECKFAIL(indices, warnerr("failed to alloc glyph run"));
+
+	/* Each distinct glyph and phase is one job, unless it is already cached. */
+	for (int i = 0; i < num_glyphs; i++) {
+		indices[i] = JOB_KEY(glyph_indices[i], (x_phases) ? x_phases[i] : 0);
+	}
+	qsort(indices, num_glyphs, sizeof(*indices), cmp_glyph_indices);
+	int failed = 0;
+	for (int i = 0; i < num_glyphs; i++) {
+		if (i > 0 && indices[i] == indices[i-1]) {
+			continue;
+		}
+		if (cache_lookup(raster->cache, JOB_GLYPH(indices[i]), raster->ppem, raster->flags, JOB_PHASE(indices[i]))) {
+			TTF_Glyph *glyph = get_glyph_by_index(raster->font, JOB_GLYPH(indices[i]));
+			if (atlas && JOB_PHASE(indices[i]) == 0 && !atlas_insert(atlas, raster, glyph)) {
+				failed = 1;
+			}
+			continue;
+		}
+		indices[num_jobs++] = indices[i];
+	}
+
+	if (num_jobs > 0) {
+		pool->jobs = calloc(num_jobs, sizeof(*pool->jobs));
+		CHECKFAIL(pool->jobs, warnerr("failed to alloc raster pool jobs"));
+
+		pool->target = raster;
+		pool->atlas = atlas;
+		pool->glyph_indices = indices;
+		pool->num_jobs = num_jobs;
+		pool->next_commit = 0;
+		pool->failed = 0;
+
+		/* Deal the jobs out in contiguous runs, one per worker. */
+		for (int i = 0; i < pool->num_workers; i++) {
+			TTF_Pool_Worker *worker = &pool->workers[i];
+			worker->begin = (int)((int64_t)num_jobs * i / pool->num_workers);
+			worker->end = (int)((int64_t)num_jobs * (i + 1) / pool->num_workers);
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		pool->running = pool->num_workers;
+		pool->generation++;
+		pthread_cond_broadcast(&pool->wake);
+		while (pool->running > 0) {
+			pthread_cond_wait(&pool->done, &pool->lock);
+		}
+		pthread_mutex_unlock(&pool->lock);
+
+		failed |= pool->failed;
+	}
+
+	CHECKFAIL(!failed, warn("failed to raster some glyphs"));
+
+	RETRELEASE(
+		/* RELEASE */
+		if (indices) free(indices);
+		if (pool->jobs) free(pool->jobs);
+		pool->jobs = NULL;
+		pool->glyph_indices = NULL;
+		pool->target = NULL;
+		pool->atlas = NULL;
+	);
+}
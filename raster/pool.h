@@ -0,0 +1,12 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "../base/types.h"
+
+TTF_Raster_Pool *create_raster_pool(int num_threads, int deterministic);
+void free_raster_pool(TTF_Raster_Pool *pool);
+
+int pool_raster_glyphs(TTF_Raster_Pool *pool, TTF_Raster *raster, TTF_Atlas *atlas,
+		const uint32_t *glyph_indices, const uint8_t *x_phases, int num_glyphs);
+
+#endif /* POOL_H */
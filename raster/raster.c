@@ -2,6 +2,12 @@
 #include "scale.h"
 #include "scan.h"
 #include "bitmap.h"
+#include "blend.h"
+#include "cache.h"
+#include "flatten.h"
+#include "run.h"
+#include "fixed.h"
+#include "config.h"
 #include "../glyph/glyph.h"
 #include "../glyph/outline.h"
 #include "../tables/tables.h"
@@ -12,52 +18,156 @@
 
 #include <stdio.h>
 
-int raster_init(TTF_Font *font, uint16_t point, uint16_t dpi, uint32_t flags) {
+static TTF_Raster *alloc_raster(TTF_Font *font, uint16_t point, uint16_t dpi, uint32_t flags, int cached) {
+	TTF_Raster *raster = (TTF_Raster *) malloc(sizeof(*raster));
+	if (!raster) {
+		warnerr("failed to alloc raster");
+		return NULL;
+	}
+
+	raster->font = NULL;
+	raster->point = -1;
+	raster->dpi = 0;
+	raster->ppem = 0;
+	raster->flags = 0;
+	raster->fg_color = 0x000000;
+	raster->device_widths = NULL;
+	raster->num_device_widths = 0;
+	raster->edges.edges = NULL;
+	raster->edges.num_edges = raster->edges.size = 0;
+	raster->active = NULL;
+	raster->active_size = 0;
+	raster->coverage = NULL;
+	raster->coverage_size = 0;
+	raster->cache = NULL;
+	raster->runs = NULL;
+
+	if (cached) {
+		raster->cache = create_glyph_cache(GLYPH_CACHE_BUDGET);
+		raster->runs = create_run_cache(RUN_CACHE_ENTRIES);
+		if (!raster->cache || !raster->runs) {
+			warn("failed to create glyph cache");
+			free_raster(raster);
+			return NULL;
+		}
+	}
+
+	if (!raster_init(raster, font, point, dpi, flags)) {
+		warn("failed to init raster");
+		free_raster(raster);
+		return NULL;
+	}
+
+	return raster;
+}
+
+TTF_Raster *create_raster(TTF_Font *font, uint16_t point, uint16_t dpi, uint32_t flags) {
+	return alloc_raster(font, point, dpi, flags, 1);
+}
+
+/**
+ * Create a raster without a glyph cache, for rasterize_glyph() only, e.g.
+ * on a worker thread that hands its bitmaps to another raster's cache.
+ */
+TTF_Raster *create_uncached_raster(TTF_Font *font, uint16_t point, uint16_t dpi, uint32_t flags) {
+	return alloc_raster(font, point, dpi, flags, 0);
+}
+
+void free_raster(TTF_Raster *raster) {
+	if (!raster) {
+		return;
+	}
+	free_glyph_cache(raster->cache);
+	free_run_cache(raster->runs);
+	free_edge_list(&raster->edges);
+	if (raster->active) {
+		free(raster->active);
+	}
+	if (raster->coverage) {
+		free(raster->coverage);
+	}
+	free(raster);
+}
+
+int raster_init(TTF_Raster *raster, TTF_Font *font, uint16_t point, uint16_t dpi, uint32_t flags) {
+	CHECKPTR(raster);
 	CHECKPTR(font);
 
-	font->point = point;
-	font->dpi = dpi;
+	if (raster->font && raster->font != font) {
+		/* Cached bitmaps and runs belong to the old font. */
+		clear_glyph_cache(raster->cache);
+		clear_run_cache(raster->runs);
+	}
+	raster->font = font;
 
-	head_Table *head = get_head_table(font);
-	CHECKPTR(head);
-	// Copy units per em from head table
-	font->upem = head->units_per_em;
+	raster->point = point;
+	raster->dpi = dpi;
 
 	// Calculate pixel per em (ppem)
-	font->ppem = (font->point * font->dpi) / 72;
+	raster->ppem = (raster->point * raster->dpi) / 72;
+
+	raster->flags = flags;
+	if (flags & RENDER_LINEAR) {
+		/* Build the blend tables now rather than on a drawing thread. */
+		init_linear_blend();
+	}
 
-	font->raster_flags = flags;
+	/* Whole pixel advances at this size, if the font records them. */
+	hdmx_Table *hdmx = get_hdmx_table(font);
+	raster->device_widths = hdmx_lookup(hdmx, raster->ppem);
+	raster->num_device_widths = (raster->device_widths) ? hdmx->num_glyphs : 0;
 
 	return SUCCESS;
 }
 
-int draw_string(TTF_Font *font, TTF_Bitmap *canvas, int x, int y, const char *string) {
-	CHECKPTR(font);
+int raster_cache_budget(TTF_Raster *raster, size_t budget) {
+	CHECKPTR(raster);
+
+	return set_glyph_cache_budget(raster->cache, budget);
+}
+
+int raster_color(TTF_Raster *raster, uint32_t c) {
+	CHECKPTR(raster);
+
+	raster->fg_color = c & 0xFFFFFF;
+
+	return SUCCESS;
+}
+
+/**
+ * Draw a line of UTF-8 text with its first pen position at (x, y).
+ */
+int draw_string(TTF_Raster *raster, TTF_Bitmap *canvas, int x, int y, const char *string) {
+	CHECKPTR(raster);
 	CHECKPTR(canvas);
 	CHECKPTR(string);
 
 	RETINIT(SUCCESS);
 
+	TTF_Glyph_Run *owned = NULL;
+
 	CHECKFAIL(IN(x, 0, canvas->w-1), warn("failed to draw string out of bounds"));
 	CHECKFAIL(IN(y, 0, canvas->h-1), warn("failed to draw string out of bounds"));
 
-	for (int i = 0; i < (int)strlen(string); i++) {
-		TTF_Glyph *glyph = get_glyph(font, string[i]);
-		if (!glyph) {
-			warn("failed to get glyph for '%c'", string[i]);
-			continue;
-		}
-		draw_glyph(font, canvas, glyph, x, y);
+	TTF_Glyph_Run *run = shape_text(raster, string, strlen(string), &owned);
+	CHECKFAIL(run, warn("failed to get glyphs for string"));
+	CHECKFAIL(draw_glyph_run(raster, canvas, x, y, run), PASS);
 
-		/* Move x forward by the glyph's advance width. */
-		x += roundf(funit_to_pixel(font, get_glyph_advance_width(font, glyph)));
-	}
+	RETRELEASE(
+		/* RELEASE */
+		free_glyph_run(owned);
+	);
+}
 
-	RET;
+int draw_glyph(TTF_Raster *raster, TTF_Bitmap *canvas, TTF_Glyph *glyph, int x, int y) {
+	return draw_glyph_at(raster, canvas, glyph, x, 0, y);
 }
 
-int draw_glyph(TTF_Font *font, TTF_Bitmap *canvas, TTF_Glyph *glyph, int x, int y) {
-	CHECKPTR(font);
+/**
+ * Draw a glyph with its pen at x + x_phase / SUBPIXEL_STEPS, y.
+ */
+int draw_glyph_at(TTF_Raster *raster, TTF_Bitmap *canvas, TTF_Glyph *glyph, int x, uint8_t x_phase, int y) {
+	CHECKPTR(raster);
 	CHECKPTR(canvas);
 	CHECKPTR(glyph);
 
@@ -66,68 +176,216 @@ int draw_glyph(TTF_Font *font, TTF_Bitmap *canvas, TTF_Glyph *glyph, int x, int
 	CHECKFAIL(IN(x, 0, canvas->w-1), warn("failed to draw glyph out of bounds"));
 	CHECKFAIL(IN(y, 0, canvas->h-1), warn("failed to draw glyph out of bounds"));
 
-	/* Prepare glyph for rendering. */
-	raster_glyph(font, glyph);
+	TTF_Cache_Entry *entry = raster_glyph_at(raster, glyph, x_phase);
+	CHECKFAIL(entry, warn("failed to raster glyph"));
 
-	if (glyph->number_of_contours == 0) {
-		/* Glyph has no outline - don't draw anything. */
-		return SUCCESS;
-	} else if (!glyph->bitmap) {
-		warn("failed to draw empty glyph");
-		return FAILURE;
+	// Draw glyph bitmap onto canvas
+	if (entry->bitmap) {
+		blend_bitmap(canvas, entry->bitmap, x + entry->x_offset, y - entry->y_offset,
+				raster->fg_color, raster->flags & RENDER_LINEAR);
 	}
 
-	int16_t lsb = roundf(funit_to_pixel(font, get_glyph_left_side_bearing(font, glyph)));
+	RET;
+}
+
+/**
+ * Rasterize a glyph at the raster's size and mode, with its pen
+ * x_phase / SUBPIXEL_STEPS pixels right of a whole pixel, without going
+ * through the cache. The caller owns the bitmap (NULL for glyphs without
+ * an outline). Only the raster's own state is touched, so separate
+ * rasters may rasterize glyphs of one font concurrently.
+ */
+int rasterize_glyph(TTF_Raster *raster, TTF_Glyph *glyph, uint8_t x_phase, TTF_Bitmap **result,
+		int16_t *x_offset, int16_t *y_offset) {
+	CHECKPTR(raster);
+	CHECKPTR(glyph);
+	CHECKPTR(result);
+
+	TTF_Font *font = raster->font;
+	TTF_Bitmap *bitmap = NULL;
+	int16_t lsb = roundf(funit_to_pixel(raster, get_glyph_left_side_bearing(font, glyph)));
 	int16_t ascent = 0;
 
-	// Position glyph baseline at y
-	if (glyph->outline) {
-		if (font->raster_flags & RENDER_FPAA) {
-			ascent = roundf(glyph->outline->y_max / 2);
+	TTF_Outline *shared = get_glyph_outline(font, glyph);
+	if (shared) {
+		/* Scan the shared outline through the raster's transform. */
+		TTF_Scaled_Outline scaled;
+		if (!scale_outline(raster, shared, x_phase, &scaled)) {
+			warn("failed to scale glyph");
+			return FAILURE;
+		}
+		if (!scan_outline(raster, &scaled, &bitmap)) {
+			warn("failed to scan glyph");
+			return FAILURE;
+		}
+
+		// Position the bitmap's origin (the outline's scaled bounding box) relative to the pen
+		if (raster->flags & RENDER_FPAA) {
+			lsb = floorf(scaled.x_min / 2.0f);
+			ascent = ceilf(scaled.y_max / 2.0f);
+		} else if (raster->flags & RENDER_ASPAA) {
+			lsb = floorf(scaled.x_min / 3.0f);
+			ascent = scaled.y_max;
 		} else {
-			ascent = roundf(glyph->outline->y_max);
+			lsb = scaled.x_min;
+			ascent = scaled.y_max;
 		}
 	}
 
-	// Draw glyph bitmap onto canvas
-	draw_bitmap(canvas, glyph->bitmap, x + lsb, y - ascent);
+	*result = bitmap;
+	if (x_offset) *x_offset = lsb;
+	if (y_offset) *y_offset = ascent;
 
-	RET;
+	return SUCCESS;
 }
 
-int raster_glyph(TTF_Font *font, TTF_Glyph *glyph) {
-	CHECKPTR(font);
-	CHECKPTR(glyph);
+/**
+ * Rasterize a glyph at the raster's size and mode, or find it in the
+ * raster's cache. The returned entry remains valid until the next glyph
+ * is rasterized.
+ */
+TTF_Cache_Entry *raster_glyph(TTF_Raster *raster, TTF_Glyph *glyph) {
+	return raster_glyph_at(raster, glyph, 0);
+}
 
-	if (!scale_glyph(font, glyph)) {
-		warn("failed to scale glyph");
-		return FAILURE;
+/**
+ * Like raster_glyph(), for a pen x_phase / SUBPIXEL_STEPS pixels right of
+ * a whole pixel. Each phase is cached separately.
+ */
+TTF_Cache_Entry *raster_glyph_at(TTF_Raster *raster, TTF_Glyph *glyph, uint8_t x_phase) {
+	if (!raster || !glyph) {
+		return NULL;
 	}
-	if (!scan_glyph(font, glyph)) {
-		warn("failed to scan glyph");
-		return FAILURE;
+
+	TTF_Cache_Entry *entry = cache_lookup(raster->cache, glyph->index, raster->ppem, raster->flags, x_phase);
+	if (entry) {
+		/* Glyph has already been rendered at this size and mode. */
+		return entry;
 	}
 
-	return SUCCESS;
+	TTF_Bitmap *bitmap = NULL;
+	int16_t lsb, ascent;
+	if (!rasterize_glyph(raster, glyph, x_phase, &bitmap, &lsb, &ascent)) {
+		return NULL;
+	}
+
+	/* Hand the bitmap over to the cache. */
+	entry = cache_insert(raster->cache, glyph->index, raster->ppem, raster->flags, x_phase, bitmap, lsb, ascent);
+	if (!entry) {
+		free_bitmap(bitmap);
+	}
+
+	return entry;
 }
 
-TTF_Bitmap *render_glyph(TTF_Glyph *glyph) {
+static int cmp_glyph_indices(const void *p1, const void *p2) {
+	uint32_t a = *(const uint32_t *)p1;
+	uint32_t b = *(const uint32_t *)p2;
+	return (a > b) - (a < b);
+}
+
+/**
+ * Rasterize a run of glyphs at the raster's size and mode in one pass,
+ * e.g. to warm the cache for a page of text. Repeated glyphs are
+ * rasterized once, and all glyphs share the raster's scratch memory.
+ *
+ * Every glyph of the run stays cached until the whole run has been
+ * rasterized. Afterwards, a run larger than the cache budget keeps only
+ * the glyphs that fit, most recently rasterized first.
+ *
+ * If entries is not NULL, entries[i] receives the cache entry of
+ * glyph_indices[i] (NULL if the glyph could not be rasterized). These
+ * entries are pinned in the cache until released with release_glyphs().
+ */
+int raster_glyphs(TTF_Raster *raster, const uint32_t *glyph_indices, int num_glyphs, TTF_Cache_Entry **entries) {
+	CHECKPTR(raster);
+	CHECKPTR(glyph_indices);
+
+	RETINIT(SUCCESS);
+
+	uint32_t *unique = NULL;
+	TTF_Cache_Entry **unique_entries = NULL;
+	int num_unique = 0;
+
+	if (num_glyphs <= 0) {
+		return SUCCESS;
+	}
+
+	/* Sort a copy of the run to find each distinct glyph. */
+	unique = malloc(num_glyphs * sizeof(*unique));
+	CHECKFAIL(unique, warnerr("failed to alloc glyph run"));
+	unique_entries = calloc(num_glyphs, sizeof(*unique_entries));
+	CHECKFAIL(unique_entries, warnerr("failed to alloc glyph run entries"));
+
+	memcpy(unique, glyph_indices, num_glyphs * sizeof(*unique));
+	qsort(unique, num_glyphs, sizeof(*unique), cmp_glyph_indices);
+	for (int i = 0; i < num_glyphs; i++) {
+		if (num_unique == 0 || unique[num_unique-1] != unique[i]) {
+			unique[num_unique++] = unique[i];
+		}
+	}
+
+	int failed = 0;
+	for (int i = 0; i < num_unique; i++) {
+		TTF_Glyph *glyph = get_glyph_by_index(raster->font, unique[i]);
+		TTF_Cache_Entry *entry = (glyph) ? raster_glyph(raster, glyph) : NULL;
+		if (!entry) {
+			warn("failed to raster glyph %u", unique[i]);
+			failed = 1;
+			continue;
+		}
+		/* Keep the glyph cached while the rest of the run is rasterized. */
+		cache_pin(entry);
+		unique_entries[i] = entry;
+	}
+
+	if (entries) {
+		for (int i = 0; i < num_glyphs; i++) {
+			uint32_t *found = bsearch(&glyph_indices[i], unique, num_unique, sizeof(*unique), cmp_glyph_indices);
+			entries[i] = unique_entries[found - unique];
+			cache_pin(entries[i]);
+		}
+	}
+	for (int i = 0; i < num_unique; i++) {
+		cache_unpin(raster->cache, unique_entries[i]);
+	}
+
+	CHECKFAIL(!failed, PASS);
+
+	RETRELEASE(
+		/* RELEASE */
+		if (unique) free(unique);
+		if (unique_entries) free(unique_entries);
+	);
+}
+
+/**
+ * Unpin the entries returned by raster_glyphs().
+ */
+void release_glyphs(TTF_Raster *raster, TTF_Cache_Entry **entries, int num_glyphs) {
+	if (!raster || !entries) {
+		return;
+	}
+	for (int i = 0; i < num_glyphs; i++) {
+		cache_unpin(raster->cache, entries[i]);
+		entries[i] = NULL;
+	}
+}
+
+TTF_Bitmap *render_glyph(TTF_Font *font, TTF_Glyph *glyph) {
 	TTF_Bitmap *bitmap = NULL;
 	TTF_Outline *outline = NULL;
 	int w, h;
 
-	if (!glyph) {
+	if (!font || !glyph) {
 		return NULL;
 	}
 
-	// Get glyph's outline representation
-	if (!glyph->outline) {
-		load_glyph_outline(glyph);
-	}
-	outline = glyph->outline;
+	// Get a private copy of the glyph's outline representation
+	outline = copy_outline(get_glyph_outline(font, glyph));
 	if (!outline) {
 		warn("failed to create glyph outline");
-		return NULL; // FIXME: release
+		return NULL;
 	}
 
 	// Normalize all segment coordinates to bounding box and flip vertically
@@ -150,13 +408,15 @@ TTF_Bitmap *render_glyph(TTF_Glyph *glyph) {
 	h = outline->y_max - outline->y_min + 1;
 
 	// Create bitmap and render outline
-	bitmap = create_bitmap(w, h, 0x000000);
+	bitmap = create_bitmap(w, h, 0x000000, PIXEL_RGB32);
 	if (!bitmap) {
 		warn("failed to create bitmap for glyph");
-		return NULL; // FIXME: release
+		free_outline(outline);
+		return NULL;
 	}
 	render_outline(bitmap, outline, 0xFFFFFF);
 
+	free_outline(outline);
 	return bitmap;
 }
 
@@ -264,63 +524,27 @@ int render_line(TTF_Bitmap *bitmap, TTF_Segment *line, uint32_t c) {
 	return 1;
 }
 
-// Number of control points is n+1
-static inline int bezier(float mu, float *p, int n) {
-	int k, kn, nn, nkn;
-	float blend, muk, munk;
-	int b = 0;
-
-	muk = 1;
-	munk = pow(1 - mu, (float)n);
-
-	for (k = 0; k <= n; k++) {
-		nn = n;
-		kn = k;
-		nkn = n - k;
-		blend = muk * munk;
-		muk *= mu;
-		munk /= (1 - mu);
-		while (nn >= 1) {
-			blend *= nn;
-			nn--;
-			if (kn > 1) {
-				blend /= (float) kn;
-				kn--;
-			}
-			if (nkn > 1) {
-				blend /= (float) nkn;
-				nkn--;
-			}
-		}
-		b += p[k] * blend;
-	}
-
-	return b;
+typedef struct _Stroke {
+	TTF_Bitmap *bitmap;
+	uint32_t c;
+} Stroke;
+
+static int stroke_line(void *data, F26Dot6 x0, F26Dot6 y0, F26Dot6 x1, F26Dot6 y1) {
+	Stroke *stroke = data;
+	float line_x[2] = {F26DOT6_TRUNC(x0), F26DOT6_TRUNC(x1)};
+	float line_y[2] = {F26DOT6_TRUNC(y0), F26DOT6_TRUNC(y1)};
+	TTF_Segment line = { LINE_SEGMENT, line_x, line_y, 2 };
+	return render_line(stroke->bitmap, &line, stroke->c);
 }
 
 int render_curve(TTF_Bitmap *bitmap, TTF_Segment *curve, uint32_t c) {
 	if (!bitmap || !curve) {
 		return 0;
 	}
-	TTF_Segment line;
-	init_segment(&line, 2);
-
-	int n_steps = 100;
-	float t, step = 1.0/n_steps;
-	int i, x, y, xp = curve->x[0], yp = curve->y[0];
-	for (i = 0, t = step; i < n_steps; i++, t += step, xp = x, yp = y) {
-		x = bezier(t, curve->x, curve->num_points-1);
-		y = bezier(t, curve->y, curve->num_points-1);
-
-		line.x[0] = xp;
-		line.y[0] = yp;
-		line.x[1] = x;
-		line.y[1] = y;
-
-		render_line(bitmap, &line, c);
-	}
-
-	free_segment(&line);
 
-	return 1;
+	Stroke stroke = { bitmap, c };
+	return flatten_curve(float_to_f26dot6(curve->x[0]), float_to_f26dot6(curve->y[0]),
+			float_to_f26dot6(curve->x[1]), float_to_f26dot6(curve->y[1]),
+			float_to_f26dot6(curve->x[2]), float_to_f26dot6(curve->y[2]),
+			CURVE_TOLERANCE, stroke_line, &stroke);
 }
@@ -7,14 +7,29 @@ typedef enum _Raster_Opts {
 	RENDER_FP		=	1 << 0,
 	RENDER_FPAA		=	1 << 1,
 	RENDER_ASPAA	=	1 << 2,
+	RENDER_AAA		=	1 << 3,
+	RENDER_LINEAR	=	1 << 4,	/* Blend glyphs onto the canvas in linear light. */
+	RENDER_SUBPIXEL	=	1 << 5,	/* Place glyphs at fractional pen positions. */
 } Raster_Opts;
 
-int raster_init(TTF_Font *font, uint16_t point, uint16_t dpi, uint32_t flags);
-int draw_string(TTF_Font *font, TTF_Bitmap *canvas, int x, int y, const char *string);
-int draw_glyph(TTF_Font *font, TTF_Bitmap *canvas, TTF_Glyph *glyph, int x, int y);
-int raster_glyph(TTF_Font *font, TTF_Glyph *glyph);
+TTF_Raster *create_raster(TTF_Font *font, uint16_t point, uint16_t dpi, uint32_t flags);
+TTF_Raster *create_uncached_raster(TTF_Font *font, uint16_t point, uint16_t dpi, uint32_t flags);
+void free_raster(TTF_Raster *raster);
 
-TTF_Bitmap *render_glyph(TTF_Glyph *glyph);
+int raster_init(TTF_Raster *raster, TTF_Font *font, uint16_t point, uint16_t dpi, uint32_t flags);
+int raster_cache_budget(TTF_Raster *raster, size_t budget);
+int raster_color(TTF_Raster *raster, uint32_t c);
+int draw_string(TTF_Raster *raster, TTF_Bitmap *canvas, int x, int y, const char *string);
+int draw_glyph(TTF_Raster *raster, TTF_Bitmap *canvas, TTF_Glyph *glyph, int x, int y);
+int draw_glyph_at(TTF_Raster *raster, TTF_Bitmap *canvas, TTF_Glyph *glyph, int x, uint8_t x_phase, int y);
+int rasterize_glyph(TTF_Raster *raster, TTF_Glyph *glyph, uint8_t x_phase, TTF_Bitmap **result,
+		int16_t *x_offset, int16_t *y_offset);
+TTF_Cache_Entry *raster_glyph(TTF_Raster *raster, TTF_Glyph *glyph);
+TTF_Cache_Entry *raster_glyph_at(TTF_Raster *raster, TTF_Glyph *glyph, uint8_t x_phase);
+int raster_glyphs(TTF_Raster *raster, const uint32_t *glyph_indices, int num_glyphs, TTF_Cache_Entry **entries);
+void release_glyphs(TTF_Raster *raster, TTF_Cache_Entry **entries, int num_glyphs);
+
+TTF_Bitmap *render_glyph(TTF_Font *font, TTF_Glyph *glyph);
 int render_outline(TTF_Bitmap *bitmap, TTF_Outline *outline, uint32_t c);
 int render_line(TTF_Bitmap *bitmap, TTF_Segment *line, uint32_t c);
 int render_curve(TTF_Bitmap *bitmap, TTF_Segment *curve, uint32_t c);
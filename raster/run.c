@@ -0,0 +1,400 @@
+#include "run.h"
+#include "raster.h"
+#include "scale.h"
+#include "fixed.h"
+#include "../glyph/glyph.h"
+#include "../tables/tables.h"
+#include "../utils/utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+TTF_Glyph_Run *create_glyph_run(void) {
+	TTF_Glyph_Run *run = calloc(1, sizeof(*run));
+	if (!run) {
+		warnerr("failed to alloc glyph run");
+		return NULL;
+	}
+	return run;
+}
+
+void free_glyph_run(TTF_Glyph_Run *run) {
+	if (!run) {
+		return;
+	}
+	if (run->glyphs) {
+		free(run->glyphs);
+	}
+	free(run);
+}
+
+/**
+ * Empty a run for up to n glyphs at the raster's size and mode, keeping
+ * its buffer when it is big enough.
+ */
+static int begin_run(TTF_Glyph_Run *run, TTF_Raster *raster, size_t n) {
+	if (n > (size_t)run->size) {
+		if (n > INT32_MAX / sizeof(*run->glyphs)) {
+			warn("failed to alloc glyph run of %zu glyphs", n);
+			return FAILURE;
+		}
+		TTF_Run_Glyph *glyphs = realloc(run->glyphs, n * sizeof(*glyphs));
+		if (!glyphs) {
+			warnerr("failed to alloc glyph run");
+			return FAILURE;
+		}
+		run->glyphs = glyphs;
+		run->size = n;
+	}
+
+	run->num_glyphs = 0;
+	run->width = 0;
+	run->x_min = run->y_min = INT32_MAX;
+	run->x_max = run->y_max = INT32_MIN;
+	run->font = raster->font;
+	run->ppem = raster->ppem;
+	run->raster_flags = raster->flags;
+
+	return SUCCESS;
+}
+
+static void end_run(TTF_Glyph_Run *run) {
+	if (run->x_min > run->x_max) {
+		/* No ink at all. */
+		run->x_min = run->y_min = run->x_max = run->y_max = 0;
+	}
+}
+
+/**
+ * Append the glyph for code point c, kerning it against the glyph
+ * before it.
+ */
+static inline int push_glyph(TTF_Glyph_Run *run, TTF_Raster *raster, kern_Table *kern, uint32_t c) {
+	int32_t glyph_index = get_glyph_index(raster->font, c);
+	if (glyph_index < 0) {
+		return FAILURE;
+	}
+
+	int n = run->num_glyphs;
+	F26Dot6 pen = 0;
+	if (n > 0) {
+		TTF_Run_Glyph *prev = &run->glyphs[n-1];
+		int16_t kerning = kern_lookup(kern, prev->index, glyph_index);
+		if (kerning) {
+			prev->x_advance = advance_to_f26dot6(raster, prev->index, kerning);
+		}
+		pen = prev->x_offset + prev->x_advance;
+	}
+
+	TTF_Run_Glyph *g = &run->glyphs[n];
+	g->glyph = get_glyph_by_index(raster->font, glyph_index);
+	g->index = glyph_index;
+	g->x_offset = pen;
+	g->x_advance = advance_to_f26dot6(raster, glyph_index, 0);
+	g->bearing = 0;
+	run->width = F26DOT6_TRUNC(F26DOT6_CEIL(pen + g->x_advance));
+	run->num_glyphs++;
+
+	/* Grow the ink bounds by the glyph's bounding box, rounded outwards. */
+	if (g->glyph && g->glyph->number_of_contours != 0) {
+		float x = pen / (float)F26DOT6_ONE;
+		float x_min = funit_to_pixel(raster, g->glyph->x_min);
+		g->bearing = floorf(x_min);
+		run->x_min = MIN(run->x_min, (int)floorf(x + x_min));
+		run->x_max = MAX(run->x_max, (int)ceilf(x + funit_to_pixel(raster, g->glyph->x_max)));
+		run->y_min = MIN(run->y_min, (int)floorf(funit_to_pixel(raster, g->glyph->y_min)));
+		run->y_max = MAX(run->y_max, (int)ceilf(funit_to_pixel(raster, g->glyph->y_max)));
+	}
+
+	return SUCCESS;
+}
+
+/**
+ * Shape len bytes of UTF-8 text at the raster's size and mode, decoding
+ * and looking up each character once. The run's buffer is reused.
+ */
+int glyph_run_utf8(TTF_Glyph_Run *run, TTF_Raster *raster, const char *text, size_t len) {
+	CHECKPTR(run);
+	CHECKPTR(raster);
+	CHECKPTR(text);
+
+	/* A character takes at least one byte. */
+	if (!begin_run(run, raster, len)) {
+		return FAILURE;
+	}
+
+	kern_Table *kern = get_kern_table(raster->font);
+	size_t pos = 0;
+	while (pos < len) {
+		uint8_t b = text[pos];
+		uint32_t c = (b < 0x80) ? (pos++, b) : utf8_next(text, len, &pos);
+		if (!push_glyph(run, raster, kern, c)) {
+			warn("failed to get glyph index");
+			return FAILURE;
+		}
+	}
+	end_run(run);
+
+	return SUCCESS;
+}
+
+/**
+ * Shape len UTF-32 code points at the raster's size and mode.
+ */
+int glyph_run_utf32(TTF_Glyph_Run *run, TTF_Raster *raster, const uint32_t *text, size_t len) {
+	CHECKPTR(run);
+	CHECKPTR(raster);
+	CHECKPTR(text);
+
+	if (!begin_run(run, raster, len)) {
+		return FAILURE;
+	}
+
+	kern_Table *kern = get_kern_table(raster->font);
+	for (size_t i = 0; i < len; i++) {
+		uint32_t c = (text[i] > 0x10FFFF || (text[i] >= 0xD800 && text[i] <= 0xDFFF)) ? REPLACEMENT_CHAR : text[i];
+		if (!push_glyph(run, raster, kern, c)) {
+			warn("failed to get glyph index");
+			return FAILURE;
+		}
+	}
+	end_run(run);
+
+	return SUCCESS;
+}
+
+/**
+ * Get the glyph run for len bytes of UTF-8 text at the raster's font, size
+ * and mode, from the raster's run cache. A raster without one shapes the
+ * text into a new run, which is also returned in *owned for the caller
+ * to free. Returns NULL if the text cannot be shaped.
+ */
+TTF_Glyph_Run *shape_text(TTF_Raster *raster, const char *text, size_t len, TTF_Glyph_Run **owned) {
+	*owned = NULL;
+	if (raster->runs) {
+		return run_cache_get(raster->runs, raster, text, len);
+	}
+
+	TTF_Glyph_Run *run = create_glyph_run();
+	if (!run || !glyph_run_utf8(run, raster, text, len)) {
+		free_glyph_run(run);
+		return NULL;
+	}
+	*owned = run;
+	return run;
+}
+
+/**
+ * Draw a glyph run with its first pen position at (x, y). The raster
+ * must be at the font, size and mode the run was shaped at.
+ */
+int draw_glyph_run(TTF_Raster *raster, TTF_Bitmap *canvas, int x, int y, TTF_Glyph_Run *run) {
+	CHECKPTR(raster);
+	CHECKPTR(canvas);
+	CHECKPTR(run);
+
+	RETINIT(SUCCESS);
+
+	CHECKFAIL(run->font == raster->font && run->ppem == raster->ppem && run->raster_flags == raster->flags,
+			warn("glyph run was shaped for another font, size or mode"));
+	CHECKFAIL(IN(x, 0, canvas->w-1), warn("failed to draw glyph run out of bounds"));
+	CHECKFAIL(IN(y, 0, canvas->h-1), warn("failed to draw glyph run out of bounds"));
+
+	for (int i = 0; i < run->num_glyphs; i++) {
+		TTF_Run_Glyph *g = &run->glyphs[i];
+		if (!g->glyph) {
+			warn("failed to get glyph %u", g->index);
+			continue;
+		}
+		uint8_t x_phase;
+		int pen = pen_to_pixel(raster, x * F26DOT6_ONE + g->x_offset, &x_phase);
+		draw_glyph_at(raster, canvas, g->glyph, pen, x_phase, y);
+	}
+
+	RET;
+}
+
+#define INITIAL_BUCKETS 64
+
+static inline uint32_t hash_text(const char *text, size_t len, TTF_Raster *raster) {
+	/* FNV-1a over the text, then mixed with the size and mode. */
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; i++) {
+		h = (h ^ (uint8_t)text[i]) * 16777619u;
+	}
+	h ^= ((uint32_t)(uintptr_t)raster->font * 0x9E3779B1u) + (h << 6) + (h >> 2);
+	h ^= (raster->ppem * 0x85EBCA77u) + (h << 6) + (h >> 2);
+	h ^= (raster->flags * 0xC2B2AE3Du) + (h << 6) + (h >> 2);
+	return h;
+}
+
+static void lru_unlink(TTF_Run_Cache *cache, TTF_Run_Cache_Entry *entry) {
+	if (entry->prev) {
+		entry->prev->next = entry->next;
+	} else {
+		cache->head = entry->next;
+	}
+	if (entry->next) {
+		entry->next->prev = entry->prev;
+	} else {
+		cache->tail = entry->prev;
+	}
+	entry->prev = entry->next = NULL;
+}
+
+static void lru_push_front(TTF_Run_Cache *cache, TTF_Run_Cache_Entry *entry) {
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head) {
+		cache->head->prev = entry;
+	} else {
+		cache->tail = entry;
+	}
+	cache->head = entry;
+}
+
+static void remove_entry(TTF_Run_Cache *cache, TTF_Run_Cache_Entry *entry) {
+	/* Unlink from hash bucket. */
+	TTF_Run_Cache_Entry **p = &cache->buckets[entry->hash & (cache->num_buckets - 1)];
+	while (*p && *p != entry) {
+		p = &(*p)->chain;
+	}
+	if (*p) {
+		*p = entry->chain;
+	}
+
+	lru_unlink(cache, entry);
+	cache->num_entries--;
+
+	free_glyph_run(entry->run);
+	free(entry->text);
+	free(entry);
+}
+
+static int grow_buckets(TTF_Run_Cache *cache) {
+	uint32_t num_buckets = cache->num_buckets * 2;
+	TTF_Run_Cache_Entry **buckets = calloc(num_buckets, sizeof(*buckets));
+	if (!buckets) {
+		warnerr("failed to grow run cache");
+		return FAILURE;
+	}
+
+	/* Rehash every entry into the new buckets. */
+	for (TTF_Run_Cache_Entry *entry = cache->head; entry; entry = entry->next) {
+		uint32_t b = entry->hash & (num_buckets - 1);
+		entry->chain = buckets[b];
+		buckets[b] = entry;
+	}
+
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->num_buckets = num_buckets;
+
+	return SUCCESS;
+}
+
+/**
+ * Create a cache of glyph runs for strings that are drawn over and over,
+ * such as UI labels. At most max_entries runs are kept.
+ */
+TTF_Run_Cache *create_run_cache(uint32_t max_entries) {
+	TTF_Run_Cache *cache = malloc(sizeof(*cache));
+	if (!cache) {
+		warnerr("failed to alloc run cache");
+		return NULL;
+	}
+
+	cache->num_buckets = INITIAL_BUCKETS;
+	cache->buckets = calloc(cache->num_buckets, sizeof(*cache->buckets));
+	if (!cache->buckets) {
+		warnerr("failed to alloc run cache buckets");
+		free(cache);
+		return NULL;
+	}
+	cache->num_entries = 0;
+	cache->max_entries = MAX(max_entries, 1);
+	cache->head = cache->tail = NULL;
+
+	return cache;
+}
+
+void free_run_cache(TTF_Run_Cache *cache) {
+	if (!cache) {
+		return;
+	}
+	clear_run_cache(cache);
+	if (cache->buckets) {
+		free(cache->buckets);
+	}
+	free(cache);
+}
+
+void clear_run_cache(TTF_Run_Cache *cache) {
+	if (!cache) {
+		return;
+	}
+	while (cache->tail) {
+		remove_entry(cache, cache->tail);
+	}
+}
+
+/**
+ * Get the glyph run for len bytes of UTF-8 text at the raster's font,
+ * size and mode, shaping it only if it is not cached yet. The run belongs
+ * to the cache, and remains valid until max_entries other strings have
+ * been shaped into it since it was last used.
+ */
+TTF_Glyph_Run *run_cache_get(TTF_Run_Cache *cache, TTF_Raster *raster, const char *text, size_t len) {
+	if (!cache || !raster || !text) {
+		return NULL;
+	}
+
+	uint32_t hash = hash_text(text, len, raster);
+	for (TTF_Run_Cache_Entry *entry = cache->buckets[hash & (cache->num_buckets - 1)]; entry; entry = entry->chain) {
+		TTF_Glyph_Run *run = entry->run;
+		if (entry->hash == hash && entry->len == len && run->font == raster->font &&
+				run->ppem == raster->ppem && run->raster_flags == raster->flags &&
+				memcmp(entry->text, text, len) == 0) {
+			/* Mark as most recently used. */
+			if (entry != cache->head) {
+				lru_unlink(cache, entry);
+				lru_push_front(cache, entry);
+			}
+			return run;
+		}
+	}
+
+	TTF_Run_Cache_Entry *entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		warnerr("failed to alloc run cache entry");
+		return NULL;
+	}
+	entry->text = malloc(len + 1);
+	entry->run = create_glyph_run();
+	if (!entry->text || !entry->run || !glyph_run_utf8(entry->run, raster, text, len)) {
+		warn("failed to cache glyph run");
+		free_glyph_run(entry->run);
+		free(entry->text);
+		free(entry);
+		return NULL;
+	}
+	memcpy(entry->text, text, len);
+	entry->text[len] = '\0';
+	entry->len = len;
+	entry->hash = hash;
+
+	while (cache->num_entries >= cache->max_entries) {
+		remove_entry(cache, cache->tail);
+	}
+	if (cache->num_entries + 1 > cache->num_buckets) {
+		grow_buckets(cache);
+	}
+
+	uint32_t b = hash & (cache->num_buckets - 1);
+	entry->chain = cache->buckets[b];
+	cache->buckets[b] = entry;
+	lru_push_front(cache, entry);
+	cache->num_entries++;
+
+	return entry->run;
+}
@@ -0,0 +1,21 @@
+#ifndef RUN_H
+#define RUN_H
+
+#include "../base/types.h"
+
+TTF_Glyph_Run *create_glyph_run(void);
+void free_glyph_run(TTF_Glyph_Run *run);
+
+int glyph_run_utf8(TTF_Glyph_Run *run, TTF_Raster *raster, const char *text, size_t len);
+int glyph_run_utf32(TTF_Glyph_Run *run, TTF_Raster *raster, const uint32_t *text, size_t len);
+TTF_Glyph_Run *shape_text(TTF_Raster *raster, const char *text, size_t len, TTF_Glyph_Run **owned);
+
+int draw_glyph_run(TTF_Raster *raster, TTF_Bitmap *canvas, int x, int y, TTF_Glyph_Run *run);
+
+TTF_Run_Cache *create_run_cache(uint32_t max_entries);
+void free_run_cache(TTF_Run_Cache *cache);
+void clear_run_cache(TTF_Run_Cache *cache);
+
+TTF_Glyph_Run *run_cache_get(TTF_Run_Cache *cache, TTF_Raster *raster, const char *text, size_t len);
+
+#endif /* RUN_H */
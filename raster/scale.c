@@ -1,19 +1,34 @@
 #include "scale.h"
 #include "raster.h"
-#include "../glyph/outline.h"
+#include "fixed.h"
+#include "config.h"
+#include "../tables/tables.h"
 #include "../utils/utils.h"
 #include <math.h>
 
-#include <stdio.h>
-
-static int scale_outline(TTF_Font *font, TTF_Outline *outline) {
+/**
+ * Place an unscaled outline on the sample grid of the raster's size and
+ * mode, shifted right by x_phase / SUBPIXEL_STEPS pixels. The outline's
+ * bounding box is rounded outwards to whole samples to give the bitmap's
+ * extent, and the transform maps font units into that bitmap with y
+ * pointing down.
+ */
+int scale_outline(TTF_Raster *raster, TTF_Outline *outline, uint8_t x_phase, TTF_Scaled_Outline *scaled) {
+	CHECKPTR(raster);
 	CHECKPTR(outline);
+	CHECKPTR(scaled);
+
+	if (raster->point < 0) {
+		/* raster_init() has not been called yet */
+		warn("rasterizer has not been initialized");
+		return FAILURE;
+	}
 
 	int scale_x, scale_y;
-	if (font->raster_flags & RENDER_FPAA) {
+	if (raster->flags & RENDER_FPAA) {
 		/* 4 samples / pixel */
 		scale_x = scale_y = 2;
-	} else if (font->raster_flags & RENDER_ASPAA) {
+	} else if (raster->flags & RENDER_ASPAA) {
 		/* 3 samples / pixel */
 		scale_x = 3;
 		scale_y = 1;
@@ -22,63 +37,84 @@ static int scale_outline(TTF_Font *font, TTF_Outline *outline) {
 		scale_x = scale_y = 1;
 	}
 
-	for (int i = 0; i < outline->num_contours; i++) {
-		TTF_Contour *contour = &outline->contours[i];
-		CHECKPTR(contour);
-		for (int j = 0; j < contour->num_segments; j++) {
-			TTF_Segment *segment = &contour->segments[j];
-			CHECKPTR(segment);
-			int k;
-			for (k = 0; k < segment->num_points; k++) {
-				segment->x[k] = round_pixel(scale_x * funit_to_pixel(font, segment->x[k]));
-				segment->y[k] = round_pixel(scale_y * funit_to_pixel(font, segment->y[k]));
-			}
-		}
-	}
+	/* Samples per font unit */
+	F16Dot16 sx = mul_div(scale_x * raster->ppem, F16DOT16_ONE, raster->font->upem);
+	F16Dot16 sy = mul_div(scale_y * raster->ppem, F16DOT16_ONE, raster->font->upem);
+
+	/* Sub-pixel pen offset, in 26.6 samples */
+	F26Dot6 shift = x_phase * scale_x * F26DOT6_ONE / SUBPIXEL_STEPS;
 
-	/* Round outline bounding box to nearest whole pixel value */
-	outline->x_min = symroundf(scale_x * funit_to_pixel(font, outline->x_min));
-	outline->y_min = symroundf(scale_y * funit_to_pixel(font, outline->y_min));
-	outline->x_max = symroundf(scale_x * funit_to_pixel(font, outline->x_max));
-	outline->y_max = symroundf(scale_y * funit_to_pixel(font, outline->y_max));
+	/* Round outline bounding box outwards to whole samples */
+	int x_min = F26DOT6_TRUNC(mul_fix(float_to_f26dot6(outline->x_min), sx) + shift);
+	int y_min = F26DOT6_TRUNC(mul_fix(float_to_f26dot6(outline->y_min), sy));
+	int x_max = F26DOT6_TRUNC(F26DOT6_CEIL(mul_fix(float_to_f26dot6(outline->x_max), sx) + shift));
+	int y_max = F26DOT6_TRUNC(F26DOT6_CEIL(mul_fix(float_to_f26dot6(outline->y_max), sy)));
 
-	outline->point = font->point;
+	if (raster->flags & RENDER_SUBPIXEL) {
+		/* Start the bitmap on a whole pixel, so that the samples of each
+		 * pixel are the ones the sub-pixel offset moved the outline into. */
+		int r = x_min % scale_x;
+		x_min -= (r < 0) ? r + scale_x : r;
+	}
+
+	scaled->outline = outline;
+	scaled->transform = (TTF_Transform){
+		sx, 0,
+		0, -sy,
+		shift - x_min * F26DOT6_ONE, y_max * F26DOT6_ONE
+	};
+	scaled->x_min = x_min;
+	scaled->y_max = y_max;
+	scaled->w = x_max - x_min;
+	scaled->h = y_max - y_min;
 
 	return SUCCESS;
 }
 
-int scale_glyph(TTF_Font *font, TTF_Glyph *glyph) {
-	CHECKPTR(font);
-	CHECKPTR(glyph);
+float funit_to_pixel(TTF_Raster *raster, int32_t funit) {
+	return mul_div(funit, raster->ppem * F26DOT6_ONE, raster->font->upem) / (float)F26DOT6_ONE;
+}
 
-	if (font->point < 0) {
-		/* raster_init() has not been called yet */
-		warn("font rasterizer has not been initialized");
-		return FAILURE;
-	}
-	if (!glyph->outline) {
-		load_glyph_outline(glyph);
-	} else if (glyph->outline->point == font->point) {
-		/* glyph is already scaled */
-		return SUCCESS;
+/**
+ * Get a glyph's advance in whole pixels, adjusted by a kerning value in
+ * font units. Uses the font's hdmx advances at this size if it has them.
+ */
+int advance_to_pixel(TTF_Raster *raster, uint32_t glyph_index, int16_t kerning) {
+	if (glyph_index < raster->num_device_widths) {
+		int advance = raster->device_widths[glyph_index];
+		return (kerning) ? advance + (int)roundf(funit_to_pixel(raster, kerning)) : advance;
 	}
-	scale_outline(font, glyph->outline);
 
-	return SUCCESS;
+	int32_t advance = hmtx_advance_width(get_hmtx_table(raster->font), glyph_index);
+	return roundf(funit_to_pixel(raster, advance + kerning));
 }
 
-float funit_to_pixel(TTF_Font *font, int16_t funit) {
-	return round_pixel(((float)(funit * font->ppem)) / font->upem);
-}
+/**
+ * Get a glyph's advance in 26.6 pixels, adjusted by a kerning value in
+ * font units. With RENDER_SUBPIXEL the advance is not rounded, and the
+ * font's whole pixel hdmx advances are not used.
+ */
+F26Dot6 advance_to_f26dot6(TTF_Raster *raster, uint32_t glyph_index, int16_t kerning) {
+	if (!(raster->flags & RENDER_SUBPIXEL)) {
+		return advance_to_pixel(raster, glyph_index, kerning) * F26DOT6_ONE;
+	}
 
-int16_t pixel_to_funit(TTF_Font *font, float pixel) {
-	return (pixel * font->upem) / font->ppem;
+	int32_t advance = hmtx_advance_width(get_hmtx_table(raster->font), glyph_index);
+	return mul_div(advance + kerning, raster->ppem * F26DOT6_ONE, raster->font->upem);
 }
 
 /**
- * Round a pixel coordinate to the nearest
- * sixty-fourth of a pixel.
+ * Split a 26.6 pen position into the whole pixel to draw a glyph at and,
+ * with RENDER_SUBPIXEL, the nearest of the SUBPIXEL_STEPS offsets from
+ * it. Without RENDER_SUBPIXEL the pen is rounded to the nearest pixel.
  */
-float round_pixel(float pixel) {
-	return roundf(pixel * 64) / 64;
+int pen_to_pixel(TTF_Raster *raster, F26Dot6 pen, uint8_t *x_phase) {
+	int steps = (raster->flags & RENDER_SUBPIXEL) ? SUBPIXEL_STEPS : 1;
+	int32_t q = (pen * steps + F26DOT6_ONE / 2) >> 6;
+	*x_phase = q & (steps - 1);
+	return (q - *x_phase) / steps;
+}
+
+int16_t pixel_to_funit(TTF_Raster *raster, float pixel) {
+	return (pixel * raster->font->upem) / raster->ppem;
 }
@@ -4,11 +4,12 @@
 #include "../base/consts.h"
 #include "../base/types.h"
 
-int scale_glyph(TTF_Font *font, TTF_Glyph *glyph);
+int scale_outline(TTF_Raster *raster, TTF_Outline *outline, uint8_t x_phase, TTF_Scaled_Outline *scaled);
 
-float funit_to_pixel(TTF_Font *font, int16_t funit);
-int16_t pixel_to_funit(TTF_Font *font, float pixel);
-
-float round_pixel(float pixel);
+float funit_to_pixel(TTF_Raster *raster, int32_t funit);
+int advance_to_pixel(TTF_Raster *raster, uint32_t glyph_index, int16_t kerning);
+F26Dot6 advance_to_f26dot6(TTF_Raster *raster, uint32_t glyph_index, int16_t kerning);
+int pen_to_pixel(TTF_Raster *raster, F26Dot6 pen, uint8_t *x_phase);
+int16_t pixel_to_funit(TTF_Raster *raster, float pixel);
 
 #endif /* SCALE_H */
@@ -2,319 +2,483 @@
 #include "raster.h"
 #include "scale.h"
 #include "bitmap.h"
+#include "flatten.h"
+#include "fixed.h"
+#include "config.h"
 #include "../base/consts.h"
 #include "../utils/utils.h"
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include <stdio.h>
+static int add_edge(TTF_Edge_List *list, F26Dot6 x0, F26Dot6 y0, F26Dot6 x1, F26Dot6 y1) {
+	CHECKPTR(list);
 
-static inline float quad_bezier(float t, float p0, float p1, float p2) {
-	return (1-t)*(1-t)*p0 + 2*(1-t)*t*p1 + t*t*p2;
-}
+	RETINIT(SUCCESS);
+
+	if (y0 == y1) {
+		/* Horizontal edges never cross a sample row. */
+		return SUCCESS;
+	}
 
-static int add_intersection(TTF_Scan_Line *scanline, float x) {
-	CHECKPTR(scanline);
+	if (list->num_edges+1 > list->size) {
+		/* Increase size of edge storage for new edge. */
+		int size = (list->size > 0) ? list->size * 2 : 64;
+		TTF_Edge *edges = realloc(list->edges, size * sizeof(*list->edges));
+		CHECKFAIL(edges, warnerr("failed to adjust edge list size"));
 
-	RETINIT(SUCCESS);
+		list->edges = edges;
+		list->size = size;
+	}
 
-	if (scanline->num_intersections+1 > scanline->size_x) {
-		/* Increase size of scan-line storage for new intersection. */
-		scanline->x = realloc(scanline->x, (scanline->size_x * 2) * sizeof(*scanline->x));
-		CHECKFAIL(scanline->x, warnerr("failed to adjust scanline size"));
+	TTF_Edge *edge = &list->edges[list->num_edges++];
 
-		scanline->size_x *= 2;
+	/* Store edges top-down, remembering their original direction. */
+	if (y0 < y1) {
+		edge->dir = 1;
+	} else {
+		F26Dot6 t;
+		t = x0; x0 = x1; x1 = t;
+		t = y0; y0 = y1; y1 = t;
+		edge->dir = -1;
 	}
+	edge->x_top = edge->x = x0;
+	edge->y_top = y0;
+	edge->x_bottom = x1;
+	edge->y_bottom = y1;
 
-	scanline->x[scanline->num_intersections++] = x;
+	/* Split the change in x over one row into whole and remainder parts. */
+	int64_t dx_row = (int64_t)(x1 - x0) * F26DOT6_ONE;
+	edge->step = floor_div(dx_row, y1 - y0);
+	edge->lift = dx_row - (int64_t)edge->step * (y1 - y0);
+	edge->err = 0;
 
 	RET;
 }
 
-static int cmp_intersections(const void *p1, const void *p2) {
-	float f1 = *(float *)p1;
-	float f2 = *(float *)p2;
-	if (f1 < f2) {
-		return -1;
-	} else if (f1 == f2) {
-		return 0;
-	} else {
-		return 1;
+/**
+ * Move an edge's x to where it crosses y, rounded down.
+ */
+static inline void edge_start(TTF_Edge *edge, F26Dot6 y) {
+	int32_t dy = edge->y_bottom - edge->y_top;
+	int64_t num = (int64_t)(y - edge->y_top) * (edge->x_bottom - edge->x_top);
+	int64_t q = floor_div(num, dy);
+	edge->x = edge->x_top + q;
+	edge->err = num - q * dy;
+}
+
+/**
+ * Move an edge's x down one row.
+ */
+static inline void edge_step(TTF_Edge *edge) {
+	edge->x += edge->step;
+	edge->err += edge->lift;
+	if (edge->err >= edge->y_bottom - edge->y_top) {
+		edge->x++;
+		edge->err -= edge->y_bottom - edge->y_top;
 	}
 }
 
-static int intersect_line_segment(TTF_Segment *segment, TTF_Scan_Line *scanline) {
-	if (!segment || !scanline) {
-		return 0;
+static int curve_edge(void *list, F26Dot6 x0, F26Dot6 y0, F26Dot6 x1, F26Dot6 y1) {
+	return add_edge(list, x0, y0, x1, y1);
+}
+
+/**
+ * Convert an outline into edges in bitmap space: the origin is the top-left
+ * corner of the outline's bounding box and y increases downwards.
+ */
+static int build_edges(TTF_Scaled_Outline *scaled, TTF_Edge_List *list) {
+	CHECKPTR(scaled);
+	CHECKPTR(list);
+
+	TTF_Outline *outline = scaled->outline;
+	TTF_Transform *t = &scaled->transform;
+
+	list->num_edges = 0;
+
+	for (int i = 0; i < outline->num_contours; i++) {
+		TTF_Contour *contour = &outline->contours[i];
+		for (int j = 0; j < contour->num_segments; j++) {
+			TTF_Segment *segment = &contour->segments[j];
+			if (!segment->x || !segment->y) {
+				warn("failed to scan uninitialized contour segment");
+				continue;
+			}
+
+			/* Transform points onto the 26.6 sample grid. */
+			F26Dot6 x[3], y[3];
+			for (int k = 0; k < segment->num_points && k < 3; k++) {
+				F26Dot6 fx = float_to_f26dot6(segment->x[k]);
+				F26Dot6 fy = float_to_f26dot6(segment->y[k]);
+				x[k] = mul_fix(fx, t->xx) + mul_fix(fy, t->xy) + t->dx;
+				y[k] = mul_fix(fx, t->yx) + mul_fix(fy, t->yy) + t->dy;
+			}
+
+			switch (segment->type) {
+				case LINE_SEGMENT:
+					if (!add_edge(list, x[0], y[0], x[1], y[1])) {
+						return FAILURE;
+					}
+					break;
+				case CURVE_SEGMENT:
+					if (!flatten_curve(x[0], y[0], x[1], y[1], x[2], y[2], CURVE_TOLERANCE, curve_edge, list)) {
+						return FAILURE;
+					}
+					break;
+				default:
+					break;
+			}
+		}
 	}
-	float y = scanline->y;
-	float x0 = segment->x[0], x1 = segment->x[1];
-	float y0 = segment->y[0], y1 = segment->y[1];
 
-	if ((fabsf(y - y0) + fabsf(y - y1) - fabsf(y1 - y0)) != 0) {
-		/* The scan-line at y is not within the y-bounds of the line segment. */
-		return 0;
+	return SUCCESS;
+}
+
+static int cmp_edges(const void *p1, const void *p2) {
+	F26Dot6 y1 = ((TTF_Edge *)p1)->y_top;
+	F26Dot6 y2 = ((TTF_Edge *)p2)->y_top;
+	return (y1 > y2) - (y1 < y2);
+}
+
+/**
+ * Fill the pixels of a row whose centres lie in [xa, xb).
+ */
+static inline void fill_span(TTF_Bitmap *bitmap, int y, F26Dot6 xa, F26Dot6 xb, uint32_t c) {
+	int x0 = F26DOT6_TRUNC(xa + 31);
+	int x1 = F26DOT6_TRUNC(xb + 31);
+	x0 = MAX(x0, 0);
+	x1 = MIN(x1, bitmap->w);
+	if (x0 >= x1) {
+		return;
 	}
 
-	if (y0 == y1) {
-		/* Intersecting with horizontal line (degenerate case). */
-		if (y == y0) {
-			 /* There are two intersections, x0 and x1. */
-			add_intersection(scanline, x0);
-			add_intersection(scanline, x1);
-			return 2;
-		} else {
-			/* No intersections. */
-			return 0;
+	uint8_t *row = &bitmap->data[y * bitmap->stride];
+	if (bitmap->format == PIXEL_A8) {
+		memset(&row[x0], c & 0xFF, x1 - x0);
+	} else if (bitmap->format == PIXEL_RGB32) {
+		for (int x = x0; x < x1; x++) {
+			((uint32_t *)row)[x] = c;
+		}
+	} else {
+		for (int x = x0; x < x1; x++) {
+			bitmap_set(bitmap, x, y, c);
 		}
 	}
+}
 
-	/* Calculate x-intersection of scan-line and line segment. */
-	float x = ((x0*y1 - x1*y0) + y*(x1 - x0)) / (y1 - y0);
+/**
+ * Scan-convert edges into a bitmap with the non-zero winding rule,
+ * sampling every pixel at its centre.
+ */
+static int fill_edges(TTF_Raster *raster, TTF_Edge_List *list, TTF_Bitmap *bitmap, uint32_t c) {
+	CHECKPTR(raster);
+	CHECKPTR(list);
+	CHECKPTR(bitmap);
 
-	if ((fabsf(x - x0) + fabsf(x - x1) - fabsf(x1 - x0)) != 0) {
-		/* The x-intersection is not within the x-bounds of the line segment. */
-		return 0;
+	if (list->num_edges == 0) {
+		return SUCCESS;
 	}
 
-	add_intersection(scanline, x);
-	return 1;
-}
+	/* Edges enter the active list in order of their top y. */
+	qsort(list->edges, list->num_edges, sizeof(*list->edges), cmp_edges);
 
-static int intersect_curve_segment(TTF_Segment *segment, TTF_Scan_Line *scanline) {
-	if (!segment || !scanline) {
-		return 0;
+	/* The active list is kept between glyphs, and only grows. */
+	if ((size_t)list->num_edges > raster->active_size) {
+		TTF_Edge **active = realloc(raster->active, list->num_edges * sizeof(*active));
+		if (!active) {
+			warnerr("failed to alloc active edge list");
+			return FAILURE;
+		}
+		raster->active = active;
+		raster->active_size = list->num_edges;
 	}
-	float t;
-	float y = scanline->y;
-	float y0 = segment->y[0], y1 = segment->y[1], y2 = segment->y[2];
-	float x0 = segment->x[0], x1 = segment->x[1], x2 = segment->x[2];
-
-	float a = y0 - 2*y1 + y2;
-	float b = 2*y1 - 2*y0;
-	float c = y0 - y;
-
-	/* Handle degenerate cases first. */
-	if (a == 0) {
-		/* Curve is a straight line. */
-		if (b == 0) {
-			/* Curve is a horizontal line. */
-			if (c == 0) {
-				/* There are two intersections, x0 and x2. */
-				add_intersection(scanline, x0);
-				add_intersection(scanline, x2);
-				return 2;
-			} else {
-				/* No intersections. */
-				return 0;
+	TTF_Edge **active = raster->active;
+
+	int num_active = 0, next = 0;
+	for (int y = 0; y < bitmap->h; y++) {
+		F26Dot6 sample_y = y * F26DOT6_ONE + F26DOT6_ONE / 2;
+
+		/* Drop edges that end above this row and step the rest down to it. */
+		int k = 0;
+		for (int i = 0; i < num_active; i++) {
+			if (active[i]->y_bottom > sample_y) {
+				edge_step(active[i]);
+				active[k++] = active[i];
 			}
-		} else {
-			t = -c / b;
-			if (IN(t, 0.0, 1.0)) {
-				/* One intersection. */
-				add_intersection(scanline, quad_bezier(t, x0, x1, x2));
-				return 1;
-			} else {
-				/* No intersections. */
-				return 0;
+		}
+		num_active = k;
+
+		/* Add edges that start above this row. */
+		for (; next < list->num_edges && list->edges[next].y_top <= sample_y; next++) {
+			TTF_Edge *edge = &list->edges[next];
+			if (edge->y_bottom <= sample_y) {
+				/* Edge lies entirely between two sample rows. */
+				continue;
 			}
+			edge_start(edge, sample_y);
+			active[num_active++] = edge;
 		}
-	}
 
-	/* Test discriminant for number of roots. */
-	float D = b*b - 4*a*c;
-	if (D < 0) {
-		/* No roots. */
-		return 0;
-	} else if (D == 0) {
-		/* One distinct root. */
-		t = -b / (2*a);
-		if (IN(t, 0.0, 1.0)) {
-			/* One intersection. */
-			add_intersection(scanline, quad_bezier(t, x0, x1, x2));
-			return 1;
-		} else {
-			/* No intersections. */
-			return 0;
+		/* Keep the active list sorted by x. It is nearly sorted already,
+		 * so insertion sort runs in close to linear time. */
+		for (int i = 1; i < num_active; i++) {
+			TTF_Edge *edge = active[i];
+			int j = i - 1;
+			while (j >= 0 && active[j]->x > edge->x) {
+				active[j+1] = active[j];
+				j--;
+			}
+			active[j+1] = edge;
 		}
-	} else {
-		/* Two distinct roots. */
-		int num_intersections = 0;
-
-		t = (-b + sqrt(D)) / (2*a);
-		if (IN(t, 0.0, 1.0)) {
-			/* Intersection point is within curve endpoints. */
-			add_intersection(scanline, quad_bezier(t, x0, x1, x2));
-			num_intersections++;
+
+		/* Fill spans between edges where the winding number is non-zero. */
+		int winding = 0;
+		F26Dot6 span_start = 0;
+		for (int i = 0; i < num_active; i++) {
+			int prev = winding;
+			winding += active[i]->dir;
+			if (prev == 0 && winding != 0) {
+				span_start = active[i]->x;
+			} else if (prev != 0 && winding == 0) {
+				fill_span(bitmap, y, span_start, active[i]->x, c);
+			}
 		}
+	}
+
+	return SUCCESS;
+}
+
+/*
+ * Exact-area coverage is accumulated in units of 1/(64*128) of a pixel:
+ * the height an edge spans in a pixel (26.6) times twice the width of
+ * the pixel to its right (so that the midpoint of two 26.6 values is
+ * still whole).
+ */
+#define FULL_COVERAGE (F26DOT6_ONE * 2 * F26DOT6_ONE)
+
+/**
+ * Add a piece of edge lying in pixel x of a row: d is its signed height
+ * and fx2 twice its mean distance from the pixel's left side.
+ */
+static inline void add_cell(int32_t *row, int x, int32_t d, int32_t fx2) {
+	row[x] += d * (2 * F26DOT6_ONE - fx2);
+	row[x+1] += d * fx2;
+}
+
+/**
+ * Accumulate the piece of an edge running from xa to xb within one row,
+ * with signed height d. Where the piece crosses several pixels, its
+ * height is shared between them in proportion to the width in each,
+ * stepping with whole and remainder parts so that the shares sum to d.
+ */
+static void accumulate_row(int32_t *row, int w, F26Dot6 xa, F26Dot6 xb, int32_t d) {
+	/* Edges never leave the bounding box, but guard against rounding. */
+	xa = MIN(MAX(xa, 0), w * F26DOT6_ONE);
+	xb = MIN(MAX(xb, 0), w * F26DOT6_ONE);
+	if (xa > xb) {
+		F26Dot6 t = xa; xa = xb; xb = t;
+	}
+
+	int x0 = F26DOT6_TRUNC(xa);
+	int x1 = (xb > xa) ? F26DOT6_TRUNC(xb - 1) : x0;
+	if (x0 == x1) {
+		/* Piece stays within one pixel. */
+		add_cell(row, x0, d, xa + xb - 2 * x0 * F26DOT6_ONE);
+		return;
+	}
 
-		t = (-b - sqrt(D)) / (2*a);
-		if (IN(t, 0.0, 1.0)) {
-			/* Intersection point is within curve endpoints. */
-			add_intersection(scanline, quad_bezier(t, x0, x1, x2));
-			num_intersections++;
+	int64_t dx = xb - xa;
+
+	/* First pixel, from xa to its right side. */
+	F26Dot6 right = (x0 + 1) * F26DOT6_ONE;
+	int64_t num = (int64_t)d * (right - xa);
+	int32_t sum = floor_div(num, dx);
+	int64_t rem = num - sum * dx;
+	add_cell(row, x0, sum, xa + right - 2 * x0 * F26DOT6_ONE);
+
+	/* Whole pixels in between. */
+	int64_t num_step = (int64_t)d * F26DOT6_ONE;
+	int32_t step = floor_div(num_step, dx);
+	int64_t lift = num_step - step * dx;
+	for (int x = x0 + 1; x < x1; x++) {
+		int32_t share = step;
+		rem += lift;
+		if (rem >= dx) {
+			share++;
+			rem -= dx;
 		}
-		return num_intersections;
+		add_cell(row, x, share, F26DOT6_ONE);
+		sum += share;
 	}
+
+	/* Last pixel, from its left side to xb. */
+	add_cell(row, x1, d - sum, xb - x1 * F26DOT6_ONE);
 }
 
-static int intersect_segment(TTF_Segment *segment, TTF_Scan_Line *scanline) {
-	if (!segment || !segment->x || !segment->y) {
-		warn("failed to intersect uninitialized contour segment");
-		return 0;
+/**
+ * Accumulate the signed area an edge covers in each pixel it crosses.
+ * Each pixel receives the area between the edge and the pixel's left
+ * side; the remainder of the row's area goes to the pixel to its right,
+ * so a running sum along a row yields the winding-weighted coverage.
+ */
+static void accumulate_edge(int32_t *acc, int w, int h, TTF_Edge *edge) {
+	F26Dot6 y_top = MAX(edge->y_top, 0);
+	F26Dot6 y_bottom = MIN(edge->y_bottom, h * F26DOT6_ONE);
+	if (y_top >= y_bottom) {
+		return;
 	}
-	switch (segment->type) {
-		case LINE_SEGMENT:
-			return intersect_line_segment(segment, scanline);
-			break;
-		case CURVE_SEGMENT:
-			return intersect_curve_segment(segment, scanline);
-			break;
-		default:
-			break;
+
+	F26Dot6 ya = y_top;
+	F26Dot6 xa = edge->x_top;
+	if (y_top != edge->y_top) {
+		edge_start(edge, y_top);
+		xa = edge->x;
 	}
 
-	return 0;
+	/* Step x down the pixel row boundaries the edge crosses. */
+	int y = F26DOT6_TRUNC(y_top);
+	F26Dot6 yb = (y + 1) * F26DOT6_ONE;
+	edge_start(edge, yb);
+
+	for (;;) {
+		F26Dot6 xb;
+		if (yb >= y_bottom) {
+			yb = y_bottom;
+			if (y_bottom == edge->y_bottom) {
+				xb = edge->x_bottom;
+			} else {
+				edge_start(edge, y_bottom);
+				xb = edge->x;
+			}
+		} else {
+			xb = edge->x;
+		}
+
+		accumulate_row(&acc[y * (w + 2)], w, xa, xb, (yb - ya) * edge->dir);
+		if (yb >= y_bottom) {
+			break;
+		}
+
+		xa = xb;
+		ya = yb;
+		yb += F26DOT6_ONE;
+		y++;
+		edge_step(edge);
+	}
 }
 
-int scan_glyph(TTF_Font *font, TTF_Glyph *glyph) {
-	CHECKPTR(font);
-	CHECKPTR(glyph);
+/**
+ * Render edges with exact per-pixel area coverage. Signed areas are
+ * accumulated into an integer buffer, then summed along each row to give
+ * the coverage written to the A8 bitmap.
+ */
+static int fill_edges_exact(TTF_Raster *raster, TTF_Edge_List *list, TTF_Bitmap *bitmap) {
+	CHECKPTR(raster);
+	CHECKPTR(list);
+	CHECKPTR(bitmap);
 
 	RETINIT(SUCCESS);
 
-	if (!glyph->outline) {
-		warn("failed to scan uninitialized glyph outline");
-		return FAILURE;
-	} else if (glyph->outline->point < 0) {
-		warn("failed to scan unscaled glyph outline");
-		return FAILURE;
-	} else if (glyph->number_of_contours == 0) {
-		/* Zero-length glyph with no outline. */
-		return SUCCESS;
+	/* Each row has two extra cells for area spilling past the right edge. */
+	size_t size = (bitmap->w + 2) * bitmap->h;
+	if (size > raster->coverage_size) {
+		int32_t *coverage = realloc(raster->coverage, size * sizeof(*coverage));
+		CHECKFAIL(coverage, warnerr("failed to alloc coverage buffer"));
+
+		raster->coverage = coverage;
+		raster->coverage_size = size;
 	}
+	int32_t *acc = raster->coverage;
+	memset(acc, 0, size * sizeof(*acc));
 
-	TTF_Outline *outline = glyph->outline;
+	for (int i = 0; i < list->num_edges; i++) {
+		accumulate_edge(acc, bitmap->w, bitmap->h, &list->edges[i]);
+	}
+
+	for (int y = 0; y < bitmap->h; y++) {
+		int32_t *row = &acc[y * (bitmap->w + 2)];
+		uint8_t *out = &bitmap->data[y * bitmap->stride];
+		int32_t sum = 0;
+		for (int x = 0; x < bitmap->w; x++) {
+			sum += row[x];
+			int32_t coverage = MIN(abs(sum), FULL_COVERAGE);
+			out[x] = (coverage * 0xFF + FULL_COVERAGE / 2) / FULL_COVERAGE;
+		}
+	}
+
+	RET;
+}
+
+/**
+ * Scan-convert an outline placed on the raster's sample grid into a new
+ * bitmap, which is returned in *result.
+ */
+int scan_outline(TTF_Raster *raster, TTF_Scaled_Outline *scaled, TTF_Bitmap **result) {
+	CHECKPTR(raster);
+	CHECKPTR(scaled);
+	CHECKPTR(result);
+
+	RETINIT(SUCCESS);
+
+	*result = NULL;
+
+	TTF_Edge_List *edges = &raster->edges;
+	TTF_Bitmap *out = NULL;
 	TTF_Bitmap *bitmap = NULL;
 	uint32_t bg, fg;
 
-	if (font->raster_flags & RENDER_FPAA) {
+	if (raster->flags & RENDER_FPAA) {
 		/* Anti-aliased rendering - oversample outline then downsample. */
-		bg = 0xFFFFFF;
-		fg = 0x000000;
-		if (!glyph->bitmap) {
-			glyph->bitmap = create_bitmap((outline->x_max - outline->x_min) / 2,
-					(outline->y_max - outline->y_min) / 2, bg);
-		}
+		bg = 0x00;
+		fg = 0xFF;
+		out = create_bitmap((scaled->w + 1) / 2, (scaled->h + 1) / 2, bg, PIXEL_A8);
 
 		/* Intermediate oversampled bitmap. */
-		bitmap = create_bitmap(outline->x_max - outline->x_min,
-				outline->y_max - outline->y_min, bg);
-	} else if (font->raster_flags & RENDER_ASPAA) {
+		bitmap = create_bitmap(scaled->w, scaled->h, bg, PIXEL_A8);
+	} else if (raster->flags & RENDER_ASPAA) {
 		/* Sub-pixel rendering - oversample in x-direction then downsample. */
 		bg = 0xFFFFFF;
 		fg = 0x000000;
-		if (!glyph->bitmap) {
-			glyph->bitmap = create_bitmap((outline->x_max - outline->x_min) / 3,
-					outline->y_max - outline->y_min, bg);
-		}
+		out = create_bitmap((scaled->w + 2) / 3, scaled->h, bg, PIXEL_RGB32);
 
 		/* Intermediate oversampled bitmap. */
-		bitmap = create_bitmap(outline->x_max - outline->x_min,
-				outline->y_max - outline->y_min, bg);
+		bitmap = create_bitmap(scaled->w, scaled->h, bg, PIXEL_RGB32);
 	} else {
-		/* Normal rendering - write directly to glyph bitmap. */
-		bg = 0xFFFFFF;
-		fg = 0x000000;
-		if (!glyph->bitmap) {
-			glyph->bitmap = create_bitmap(outline->x_max - outline->x_min,
-					outline->y_max - outline->y_min, bg);
-		}
+		/* Normal or analytic rendering - write coverage directly to glyph bitmap. */
+		bg = 0x00;
+		fg = 0xFF;
+		out = create_bitmap(scaled->w, scaled->h, bg, PIXEL_A8);
 
-		bitmap = glyph->bitmap;
+		bitmap = out;
 	}
+	CHECKFAIL(out && bitmap, warn("failed to create glyph bitmap"));
 
-	/* Create a scan-line for each row in the scaled outline. */
-	int num_scanlines = outline->y_max - outline->y_min;
-	TTF_Scan_Line *scanlines = malloc(num_scanlines * sizeof(*scanlines));
-	CHECKFAIL(scanlines, warnerr("failed to alloc glyph scan lines"));
-
-	/* Find intersections of each scan-line with contour segments. */
-	for (int i = 0; i < num_scanlines; i++) {
-		TTF_Scan_Line *scanline = &scanlines[i];
-		init_scanline(scanline, outline->num_contours * 2);
-		scanline->y = outline->y_max - i;
-
-		for (int j = 0; j < outline->num_contours; j++) {
-			TTF_Contour *contour = &outline->contours[j];
-			int k;
-			for (k = 0; k < contour->num_segments; k++) {
-				TTF_Segment *segment = &contour->segments[k];
-				intersect_segment(segment, scanline);
-			}
-		}
-
-		/* Round pixel intersection values to 1/64 of a pixel. */
-		for (int j = 0; j < scanline->num_intersections; j++) {
-			scanline->x[j] = round_pixel(scanline->x[j]);
-		}
-
-		/* Sort intersections from left to right. */
-		qsort(scanline->x, scanline->num_intersections, sizeof(*scanline->x), cmp_intersections);
-
-//		printf("Intersections: ");
-//		char *sep = "";
-//		for (int j = 0; j < scanline->num_intersections; j++) {
-//			printf("%s%f", sep, scanline->x[j]);
-//			sep = ", ";
-//		}
-//		printf("\n");
-
-		int int_index = 0, fill = 0;
-		for (int j = 0; j < bitmap->w; j++) {
-			if (int_index < scanline->num_intersections) {
-				if ((outline->x_min + j) >= scanline->x[int_index]) {
-					fill = !fill;
-
-					/* Skip over duplicate intersections. */
-					int k;
-					for (k = 1; int_index+k < scanline->num_intersections; k++) {
-						if (scanline->x[int_index] != scanline->x[int_index+k]) {
-							break;
-						}
-					}
-					int_index += k;
-				}
-			}
-			if (fill) {
-				bitmap_set(bitmap, j, i, fg);
-			}
-		}
+	/* Scan-convert the outline with an active edge list. */
+	CHECKFAIL(build_edges(scaled, edges), warn("failed to build glyph edges"));
+	if (raster->flags & RENDER_AAA) {
+		CHECKFAIL(fill_edges_exact(raster, edges, bitmap), warn("failed to fill glyph edges"));
+	} else {
+		CHECKFAIL(fill_edges(raster, edges, bitmap, fg), warn("failed to fill glyph edges"));
 	}
 
-	if (font->raster_flags & RENDER_FPAA) {
+	if (raster->flags & RENDER_FPAA) {
 		/* Downsample intermediate bitmap. */
-		for (int y = 0; y < glyph->bitmap->h; y++) {
-			for (int x = 0; x < glyph->bitmap->w; x++) {
+		for (int y = 0; y < out->h; y++) {
+			for (int x = 0; x < out->w; x++) {
 				/* Calculate pixel coverage:
-				 * 	coverage = number filled samples / number samples */
-				float coverage = 0;
-				if (bitmap_get(bitmap, (2*x), (2*y)) == 0x000000) coverage++;
-				if (bitmap_get(bitmap, (2*x)+1, (2*y)) == 0x000000) coverage++;
-				if (bitmap_get(bitmap, (2*x), (2*y)+1) == 0x000000) coverage++;
-				if (bitmap_get(bitmap, (2*x)+1, (2*y)+1) == 0x000000) coverage++;
-				coverage /= 4;
-				uint8_t shade = 0xFF*(1-coverage);
-				uint32_t pixel = (shade << 16) | (shade << 8) | (shade << 0);
-
-				bitmap_set(glyph->bitmap, x, y, pixel);
+				 * 	coverage = filled sample coverage / number samples */
+				uint32_t coverage = 0;
+				coverage += bitmap_get(bitmap, (2*x), (2*y));
+				coverage += bitmap_get(bitmap, (2*x)+1, (2*y));
+				coverage += bitmap_get(bitmap, (2*x), (2*y)+1);
+				coverage += bitmap_get(bitmap, (2*x)+1, (2*y)+1);
+
+				bitmap_set(out, x, y, (coverage + 2) / 4);
 			}
 		}
-
-		free_bitmap(bitmap);
-	} else if (font->raster_flags & RENDER_ASPAA) {
+	} else if (raster->flags & RENDER_ASPAA) {
 		/* Perform five element low-pass filter. */
-		TTF_Bitmap *temp = create_bitmap(bitmap->w, bitmap->h, bg);
+		TTF_Bitmap *temp = create_bitmap(bitmap->w, bitmap->h, bg, PIXEL_RGB32);
 
 		for (int y = 0; y < bitmap->h; y++) {
 			for (int x = 0; x < bitmap->w; x++) {
@@ -334,54 +498,36 @@ int scan_glyph(TTF_Font *font, TTF_Glyph *glyph) {
 		bitmap = temp;
 
 		/* Downsample intermediate bitmap. */
-		for (int y = 0; y < glyph->bitmap->h; y++) {
-			for (int x = 0; x < glyph->bitmap->w; x++) {
+		for (int y = 0; y < out->h; y++) {
+			for (int x = 0; x < out->w; x++) {
 				uint8_t r, g, b;
 				r = (bitmap_get(bitmap, (3*x), y) * 0xFF) / 0xFFFFFF;
 				g = (bitmap_get(bitmap, (3*x)+1, y) * 0xFF) / 0xFFFFFF;
 				b = (bitmap_get(bitmap, (3*x)+2, y) * 0xFF) / 0xFFFFFF;
 				uint32_t pixel = (r << 16) | (g << 8) | (b << 0);
 
-				bitmap_set(glyph->bitmap, x, y, pixel);
+				bitmap_set(out, x, y, pixel);
 			}
 		}
-
-		free_bitmap(bitmap);
 	}
 
-	RETRELEASE(free_scanlines(scanlines, num_scanlines));
-}
-
-int init_scanline(TTF_Scan_Line *scanline, int base_size) {
-	CHECKPTR(scanline);
-
-	RETINIT(SUCCESS);
-
-	scanline->x = malloc(base_size * sizeof(*scanline->x));
-	CHECKFAIL(scanline->x, warnerr("failed to alloc scanline"));
-
-	scanline->size_x = base_size;
-	scanline->num_intersections = 0;
-
-	RETFAIL(free_scanline(scanline));
-}
+	*result = out;
 
-void free_scanline(TTF_Scan_Line *scanline) {
-	if (!scanline) {
-		return;
-	}
-	if (scanline->x) {
-		free(scanline->x);
-	}
+	RETFAILRELEASE(
+		/* FAIL */
+		free_bitmap(out),
+		/* RELEASE */
+		if (bitmap != out) free_bitmap(bitmap)
+	);
 }
 
-void free_scanlines(TTF_Scan_Line *scanlines, int num_scanlines) {
-	if (!scanlines) {
+void free_edge_list(TTF_Edge_List *list) {
+	if (!list) {
 		return;
 	}
-	int i;
-	for (i = 0; i < num_scanlines; i++) {
-		free_scanline(&scanlines[i]);
+	if (list->edges) {
+		free(list->edges);
 	}
-	free(scanlines);
+	list->edges = NULL;
+	list->num_edges = list->size = 0;
 }
@@ -3,17 +3,8 @@
 
 #include "../base/types.h"
 
-typedef struct _TTF_Scan_Line {
-	float y;
-	float *x;
-	int size_x;
-	int num_intersections;
-} TTF_Scan_Line;
+int scan_outline(TTF_Raster *raster, TTF_Scaled_Outline *scaled, TTF_Bitmap **result);
 
-int scan_glyph(TTF_Font *font, TTF_Glyph *glyph);
-
-int init_scanline(TTF_Scan_Line *scanline, int base_size);
-void free_scanline(TTF_Scan_Line *scanline);
-void free_scanlines(TTF_Scan_Line *scanlines, int num_scanlines);
+void free_edge_list(TTF_Edge_List *list);
 
 #endif /* SCAN_H */
@@ -1,12 +1,51 @@
 #include "tables.h"
 #include "../glyph/glyph.h"
 #include "../parse/parse.h"
+#include "../utils/utils.h"
 #include <stdlib.h>
 
+int get_table_slot(uint32_t tag) {
+	switch (tag) {
+		case 0x70616d63:	/* cmap */
+			return TABLE_CMAP;
+		case 0x20747663:	/* cvt  */
+			return TABLE_CVT;
+		case 0x6d677066:	/* fpgm */
+			return TABLE_FPGM;
+		case 0x66796c67:	/* glyf */
+			return TABLE_GLYF;
+		case 0x786d6468:	/* hdmx */
+			return TABLE_HDMX;
+		case 0x64616568:	/* head */
+			return TABLE_HEAD;
+		case 0x61656868:	/* hhea */
+			return TABLE_HHEA;
+		case 0x78746d68:	/* hmtx */
+			return TABLE_HMTX;
+		case 0x6e72656b:	/* kern */
+			return TABLE_KERN;
+		case 0x61636f6c:	/* loca */
+			return TABLE_LOCA;
+		case 0x4853544c:	/* LTSH */
+			return TABLE_LTSH;
+		case 0x7078616d:	/* maxp */
+			return TABLE_MAXP;
+		case 0x74736f70:	/* post */
+			return TABLE_POST;
+		default:
+			return -1;
+	}
+}
+
 TTF_Table *get_table(TTF_Font *font, uint32_t tag) {
 	if (!font) {
 		return NULL;
 	}
+	int slot = get_table_slot(tag);
+	if (slot >= 0) {
+		return font->table_index[slot];
+	}
+	/* Tables that are not indexed are rarely accessed - search the directory. */
 	if (font->tables) {
 		int i;
 		for (i = 0; i < font->num_tables; i++) {
@@ -23,11 +62,128 @@ TTF_Table *get_table_by_name(TTF_Font *font, const char *name) {
 	return get_table(font, s_to_tag(name));
 }
 
+uint16_t cmap_subtable_lookup(cmap_subTable *subtable, uint32_t c) {
+	if (!subtable || subtable->num_segments == 0) {
+		return 0;
+	}
+
+	/* Binary search for the first segment ending at or after c. */
+	uint32_t lo = 0, hi = subtable->num_segments;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		if (subtable->segments[mid].end_code < c) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == subtable->num_segments || subtable->segments[lo].start_code > c) {
+		/* c is not covered by any segment. */
+		return 0;
+	}
+
+	cmap_Segment *segment = &subtable->segments[lo];
+	if (segment->id_offset < 0) {
+		return (uint16_t)(c + segment->id_delta);
+	}
+
+	int64_t i = (int64_t)segment->id_offset + (c - segment->start_code);
+	if (i < 0 || i >= subtable->num_glyph_ids) {
+		return 0;
+	}
+	uint16_t glyph_index = subtable->glyph_ids[i];
+	return (glyph_index != 0) ? (uint16_t)(glyph_index + segment->id_delta) : 0;
+}
+
+static inline uint32_t kern_hash(kern_Table *kern, uint32_t key) {
+	/* Fibonacci hashing: the top bits of the product are well mixed. */
+	return (key * 2654435769u) >> kern->slot_shift;
+}
+
+/**
+ * Build the hash index of a kern table's pairs, at most half full so
+ * that a lookup rarely probes more than one slot.
+ */
+int build_kern_index(kern_Table *kern) {
+	CHECKPTR(kern);
+
+	uint32_t num_slots = 16;
+	uint8_t bits = 4;
+	while (num_slots < 2 * kern->num_pairs) {
+		num_slots <<= 1;
+		bits++;
+	}
+
+	kern->slots = calloc(num_slots, sizeof(*kern->slots));
+	if (!kern->slots) {
+		warnerr("failed to alloc kern index");
+		return FAILURE;
+	}
+	kern->slot_mask = num_slots - 1;
+	kern->slot_shift = 32 - bits;
+
+	uint32_t i;
+	for (i = 0; i < kern->num_pairs; i++) {
+		uint32_t h = kern_hash(kern, kern->pairs[i].key);
+		while (kern->slots[h]) {
+			h = (h + 1) & kern->slot_mask;
+		}
+		kern->slots[h] = i + 1;
+	}
+
+	return SUCCESS;
+}
+
+int16_t kern_lookup(kern_Table *kern, uint32_t left, uint32_t right) {
+	if (!kern || !kern->slots) {
+		return 0;
+	}
+
+	uint32_t key = left << 16 | right;
+	uint32_t h = kern_hash(kern, key);
+	uint32_t i;
+	while ((i = kern->slots[h]) != 0) {
+		if (kern->pairs[i-1].key == key) {
+			return kern->pairs[i-1].value;
+		}
+		h = (h + 1) & kern->slot_mask;
+	}
+	return 0;
+}
+
+/**
+ * Get a glyph's advance width in font units. Glyphs past the last long
+ * metric share its advance width. Returns 0 if the font has no metrics.
+ */
+uint16_t hmtx_advance_width(hmtx_Table *hmtx, uint32_t glyph_index) {
+	if (!hmtx || hmtx->num_h_metrics == 0 || !hmtx->advance_width) {
+		return 0;
+	}
+	return hmtx->advance_width[MIN(glyph_index, (uint32_t)hmtx->num_h_metrics - 1)];
+}
+
+/**
+ * Get the advance widths in pixels of every glyph at ppem, if the font
+ * has a device record for that size.
+ */
+const uint8_t *hdmx_lookup(hdmx_Table *hdmx, uint16_t ppem) {
+	if (!hdmx) {
+		return NULL;
+	}
+	int i;
+	for (i = 0; i < hdmx->num_records; i++) {
+		if (hdmx->records[i].pixel_size == ppem) {
+			return hdmx->records[i].widths;
+		}
+	}
+	return NULL;
+}
+
 cmap_Table *get_cmap_table(TTF_Font *font) {
 	if (!font) {
 		return NULL;
 	}
-	TTF_Table *table = get_table(font, 0x70616d63);
+	TTF_Table *table = font->table_index[TABLE_CMAP];
 	return (table) ? &table->data.cmap : NULL;
 }
 
@@ -35,7 +191,7 @@ cvt_Table *get_cvt_table(TTF_Font *font) {
 	if (!font) {
 		return NULL;
 	}
-	TTF_Table *table = get_table(font, 0x20747663);
+	TTF_Table *table = font->table_index[TABLE_CVT];
 	return (table) ? &table->data.cvt : NULL;
 }
 
@@ -43,7 +199,7 @@ fpgm_Table *get_fpgm_table(TTF_Font *font) {
 	if (!font) {
 		return NULL;
 	}
-	TTF_Table *table = get_table(font, 0x6d677066);
+	TTF_Table *table = font->table_index[TABLE_FPGM];
 	return (table) ? &table->data.fpgm : NULL;
 }
 
@@ -51,15 +207,23 @@ glyf_Table *get_glyf_table(TTF_Font *font) {
 	if (!font) {
 		return NULL;
 	}
-	TTF_Table *table = get_table(font, 0x66796c67);
+	TTF_Table *table = font->table_index[TABLE_GLYF];
 	return (table) ? &table->data.glyf : NULL;
 }
 
+hdmx_Table *get_hdmx_table(TTF_Font *font) {
+	if (!font) {
+		return NULL;
+	}
+	TTF_Table *table = font->table_index[TABLE_HDMX];
+	return (table) ? &table->data.hdmx : NULL;
+}
+
 head_Table *get_head_table(TTF_Font *font) {
 	if (!font) {
 		return NULL;
 	}
-	TTF_Table *table = get_table(font, 0x64616568);
+	TTF_Table *table = font->table_index[TABLE_HEAD];
 	return (table) ? &table->data.head : NULL;
 }
 
@@ -67,7 +231,7 @@ hhea_Table *get_hhea_table(TTF_Font *font) {
 	if (!font) {
 		return NULL;
 	}
-	TTF_Table *table = get_table(font, 0x61656868);
+	TTF_Table *table = font->table_index[TABLE_HHEA];
 	return (table) ? &table->data.hhea : NULL;
 }
 
@@ -75,23 +239,39 @@ hmtx_Table *get_hmtx_table(TTF_Font *font) {
 	if (!font) {
 		return NULL;
 	}
-	TTF_Table *table = get_table(font, 0x78746d68);
+	TTF_Table *table = font->table_index[TABLE_HMTX];
 	return (table) ? &table->data.hmtx : NULL;
 }
 
+kern_Table *get_kern_table(TTF_Font *font) {
+	if (!font) {
+		return NULL;
+	}
+	TTF_Table *table = font->table_index[TABLE_KERN];
+	return (table) ? &table->data.kern : NULL;
+}
+
 loca_Table *get_loca_table(TTF_Font *font) {
 	if (!font) {
 		return NULL;
 	}
-	TTF_Table *table = get_table(font, 0x61636f6c);
+	TTF_Table *table = font->table_index[TABLE_LOCA];
 	return (table) ? &table->data.loca : NULL;
 }
 
+ltsh_Table *get_ltsh_table(TTF_Font *font) {
+	if (!font) {
+		return NULL;
+	}
+	TTF_Table *table = font->table_index[TABLE_LTSH];
+	return (table) ? &table->data.ltsh : NULL;
+}
+
 maxp_Table *get_maxp_table(TTF_Font *font) {
 	if (!font) {
 		return NULL;
 	}
-	TTF_Table *table = get_table(font, 0x7078616d);
+	TTF_Table *table = font->table_index[TABLE_MAXP];
 	return (table) ? &table->data.maxp : NULL;
 }
 
@@ -99,7 +279,7 @@ post_Table *get_post_table(TTF_Font *font) {
 	if (!font) {
 		return NULL;
 	}
-	TTF_Table *table = get_table(font, 0x74736f70);
+	TTF_Table *table = font->table_index[TABLE_POST];
 	return (table) ? &table->data.post : NULL;
 }
 
@@ -120,6 +300,9 @@ void free_table(TTF_Table *table) {
 		case 0x66796c67:	/* glyf */
 			free_glyf_table(&table->data.glyf);
 			break;
+		case 0x786d6468:	/* hdmx */
+			free_hdmx_table(&table->data.hdmx);
+			break;
 		case 0x64616568:	/* head */
 			free_head_table(&table->data.head);
 			break;
@@ -129,9 +312,15 @@ void free_table(TTF_Table *table) {
 		case 0x78746d68:	/* hmtx */
 			free_hmtx_table(&table->data.hmtx);
 			break;
+		case 0x6e72656b:	/* kern */
+			free_kern_table(&table->data.kern);
+			break;
 		case 0x61636f6c:	/* loca */
 			free_loca_table(&table->data.loca);
 			break;
+		case 0x4853544c:	/* LTSH */
+			free_ltsh_table(&table->data.ltsh);
+			break;
 		case 0x7078616d:	/* maxp */
 			free_maxp_table(&table->data.maxp);
 			break;
@@ -151,8 +340,11 @@ void free_cmap_table(cmap_Table *cmap) {
 		int i;
 		for (i = 0; i < cmap->num_subtables; i++) {
 			cmap_subTable *subtable = &cmap->subtables[i];
-			if (subtable && subtable->glyph_index_array) {
-				free(subtable->glyph_index_array);
+			if (subtable->segments) {
+				free(subtable->segments);
+			}
+			if (subtable->glyph_ids) {
+				free(subtable->glyph_ids);
 			}
 		}
 		free(cmap->subtables);
@@ -184,13 +376,25 @@ void free_glyf_table(glyf_Table *glyf) {
 	if (glyf->glyphs) {
 		int i;
 		for (i = 0; i < glyf->num_glyphs; i++) {
-			TTF_Glyph *glyph = &glyf->glyphs[i];
-			free_glyph(glyph);
+			TTF_Glyph *glyph = glyf->glyphs[i];
+			if (glyph) {
+				free_glyph(glyph);
+				free(glyph);
+			}
 		}
 		free(glyf->glyphs);
 	}
 }
 
+void free_hdmx_table(hdmx_Table *hdmx) {
+	if (!hdmx) {
+		return;
+	}
+	if (hdmx->records) {
+		free(hdmx->records);
+	}
+}
+
 void free_head_table(head_Table *head) {
 	if (!head) {
 		return;
@@ -218,6 +422,18 @@ void free_hmtx_table(hmtx_Table *hmtx) {
 	}
 }
 
+void free_kern_table(kern_Table *kern) {
+	if (!kern) {
+		return;
+	}
+	if (kern->pairs) {
+		free(kern->pairs);
+	}
+	if (kern->slots) {
+		free(kern->slots);
+	}
+}
+
 void free_loca_table(loca_Table *loca) {
 	if (!loca) {
 		return;
@@ -227,6 +443,12 @@ void free_loca_table(loca_Table *loca) {
 	}
 }
 
+void free_ltsh_table(ltsh_Table *ltsh) {
+	if (!ltsh) {
+		return;
+	}
+}
+
 void free_maxp_table(maxp_Table *maxp) {
 	if (!maxp) {
 		return;
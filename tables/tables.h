@@ -3,17 +3,27 @@
 
 #include "../base/types.h"
 
+int get_table_slot(uint32_t tag);
 TTF_Table *get_table(TTF_Font *font, uint32_t tag);
 TTF_Table *get_table_by_name(TTF_Font *font, const char *name);
 
+uint16_t cmap_subtable_lookup(cmap_subTable *subtable, uint32_t c);
+int build_kern_index(kern_Table *kern);
+int16_t kern_lookup(kern_Table *kern, uint32_t left, uint32_t right);
+uint16_t hmtx_advance_width(hmtx_Table *hmtx, uint32_t glyph_index);
+const uint8_t *hdmx_lookup(hdmx_Table *hdmx, uint16_t ppem);
+
 cmap_Table *get_cmap_table(TTF_Font *font);
 cvt_Table *get_cvt_table(TTF_Font *font);
 fpgm_Table *get_fpgm_table(TTF_Font *font);
 glyf_Table *get_glyf_table(TTF_Font *font);
+hdmx_Table *get_hdmx_table(TTF_Font *font);
 head_Table *get_head_table(TTF_Font *font);
 hhea_Table *get_hhea_table(TTF_Font *font);
 hmtx_Table *get_hmtx_table(TTF_Font *font);
+kern_Table *get_kern_table(TTF_Font *font);
 loca_Table *get_loca_table(TTF_Font *font);
+ltsh_Table *get_ltsh_table(TTF_Font *font);
 maxp_Table *get_maxp_table(TTF_Font *font);
 post_Table *get_post_table(TTF_Font *font);
 
@@ -23,10 +33,13 @@ void free_cmap_table(cmap_Table *cmap);
 void free_cvt_table(cvt_Table *cvt);
 void free_fpgm_table(fpgm_Table *fpgm);
 void free_glyf_table(glyf_Table *glyf);
+void free_hdmx_table(hdmx_Table *hdmx);
 void free_head_table(head_Table *head);
 void free_hhea_table(hhea_Table *hhea);
 void free_hmtx_table(hmtx_Table *hmtx);
+void free_kern_table(kern_Table *kern);
 void free_loca_table(loca_Table *loca);
+void free_ltsh_table(ltsh_Table *ltsh);
 void free_maxp_table(maxp_Table *maxp);
 void free_post_table(post_Table *post);
 
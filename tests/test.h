@@ -0,0 +1,34 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Minimal assertions for the programs run by `make check`. A failed
+ * expectation is reported and counted, and the test carries on so that
+ * one run shows every failure.
+ */
+
+static int test_failures = 0;
+
+#define EXPECT(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+		test_failures++; \
+	} \
+} while (0)
+
+#define EXPECT_EQ(a, b) do { \
+	long long a_ = (long long)(a), b_ = (long long)(b); \
+	if (a_ != b_) { \
+		fprintf(stderr, "%s:%d: expected %s == %s, got %lld != %lld\n", \
+				__FILE__, __LINE__, #a, #b, a_, b_); \
+		test_failures++; \
+	} \
+} while (0)
+
+/* Exit status of a test program. */
+#define TEST_RESULT() ((test_failures) ? EXIT_FAILURE : EXIT_SUCCESS)
+
+#endif /* TEST_H */
@@ -0,0 +1,51 @@
+#include "test.h"
+#include "raster/cache.h"
+#include "raster/bitmap.h"
+
+static TTF_Cache_Entry *insert(TTF_Glyph_Cache *cache, uint32_t glyph_index) {
+	TTF_Bitmap *bitmap = create_bitmap(8, 8, 0x00, PIXEL_A8);
+	return cache_insert(cache, glyph_index, 16, 0, 0, bitmap, 0, 0);
+}
+
+int main(void) {
+	TTF_Glyph_Cache *cache = create_glyph_cache(1 << 20);
+	EXPECT(cache != NULL);
+	if (!cache) {
+		return TEST_RESULT();
+	}
+
+	/* Inserting a cached glyph again keeps the entry its users hold. */
+	TTF_Cache_Entry *entry = insert(cache, 1);
+	EXPECT(entry != NULL);
+	cache_pin(entry);
+	EXPECT(insert(cache, 1) == entry);
+	EXPECT_EQ(cache->num_entries, 1);
+
+	/* Pinned entries outlive a budget below their size... */
+	set_glyph_cache_budget(cache, 0);
+	EXPECT(cache_lookup(cache, 1, 16, 0, 0) == entry);
+	TTF_Cache_Entry *other = insert(cache, 2);
+	EXPECT(other != NULL);
+	EXPECT(cache_lookup(cache, 1, 16, 0, 0) == entry);
+
+	/* ...and clearing the cache, though they can no longer be found. */
+	clear_glyph_cache(cache);
+	EXPECT_EQ(cache->num_entries, 0);
+	EXPECT_EQ(cache->size, 0);
+	EXPECT(cache_lookup(cache, 1, 16, 0, 0) == NULL);
+	EXPECT_EQ(entry->bitmap->w, 8);
+	cache_unpin(cache, entry);
+
+	/* Unpinning lets the cache evict down to its budget. */
+	set_glyph_cache_budget(cache, 1 << 20);
+	entry = insert(cache, 3);
+	cache_pin(entry);
+	set_glyph_cache_budget(cache, 0);
+	EXPECT_EQ(cache->num_entries, 1);
+	cache_unpin(cache, entry);
+	EXPECT_EQ(cache->num_entries, 0);
+
+	free_glyph_cache(cache);
+
+	return TEST_RESULT();
+}
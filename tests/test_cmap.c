@@ -0,0 +1,166 @@
+#include "test.h"
+#include "base/font.h"
+#include "parse/parse.h"
+#include "tables/tables.h"
+#include <string.h>
+
+static uint8_t data[1024];
+static size_t size;
+
+static void put16(uint16_t v) {
+	data[size++] = v >> 8;
+	data[size++] = v;
+}
+
+static void put32(uint32_t v) {
+	put16(v >> 16);
+	put16(v);
+}
+
+/* Parse the subtable written to data. */
+static int load(cmap_subTable *subtable) {
+	TTF_Font font;
+	init_font(&font);
+	init_buffer(&font.buf, data, size);
+	memset(subtable, 0, sizeof(*subtable));
+	return load_cmap_subtable(&font, subtable);
+}
+
+static void release(cmap_subTable *subtable) {
+	free(subtable->segments);
+	free(subtable->glyph_ids);
+}
+
+static void test_format0(void) {
+	size = 0;
+	put16(0);
+	put16(262);
+	put16(0);
+	int i;
+	for (i = 0; i < 256; i++) {
+		data[size++] = 255 - i;
+	}
+
+	cmap_subTable subtable;
+	EXPECT(load(&subtable));
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x00), 255);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 'A'), 255 - 'A');
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0xFF), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x100), 0);
+	release(&subtable);
+}
+
+static void test_format4(void) {
+	/**
+	 * U+0020..U+007E map by delta onto glyphs 1..95, U+0100..U+0102
+	 * through glyphIdArray, and the 0xFFFF segment ends the list.
+	 */
+	const uint16_t start[] = { 0x0020, 0x0100, 0xFFFF };
+	const uint16_t end[] = { 0x007E, 0x0102, 0xFFFF };
+	const uint16_t delta[] = { 1 - 0x20, 5, 1 };
+	const uint16_t range_offset[] = { 0, 4, 0 };
+	const uint16_t glyph_ids[] = { 200, 0, 202 };
+	const uint16_t seg_count = 3;
+
+	size = 0;
+	put16(4);
+	put16(16 + 8 * seg_count + 2 * 3);
+	put16(0);
+	put16(seg_count * 2);
+	put16(4);
+	put16(1);
+	put16(2);
+	int i;
+	for (i = 0; i < seg_count; i++) put16(end[i]);
+	put16(0);
+	for (i = 0; i < seg_count; i++) put16(start[i]);
+	for (i = 0; i < seg_count; i++) put16(delta[i]);
+	for (i = 0; i < seg_count; i++) put16(range_offset[i]);
+	for (i = 0; i < 3; i++) put16(glyph_ids[i]);
+
+	cmap_subTable subtable;
+	EXPECT(load(&subtable));
+	EXPECT_EQ(subtable.num_segments, 2);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x1F), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x20), 1);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 'A'), 'A' - 0x1F);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x7E), 95);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x7F), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x100), 205);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x101), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x102), 207);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x103), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0xFFFF), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x10000), 0);
+
+	/* An offset past the end of glyphIdArray does not map. */
+	subtable.segments[1].id_offset = 2;
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x100), 202 + 5);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x101), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x102), 0);
+	release(&subtable);
+}
+
+static void test_format6(void) {
+	size = 0;
+	put16(6);
+	put16(10 + 2 * 3);
+	put16(0);
+	put16(0x30);
+	put16(3);
+	put16(7);
+	put16(8);
+	put16(9);
+
+	cmap_subTable subtable;
+	EXPECT(load(&subtable));
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x2F), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x30), 7);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x32), 9);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x33), 0);
+	release(&subtable);
+}
+
+static void test_format12(void) {
+	size = 0;
+	put16(12);
+	put16(0);
+	put32(16 + 12 * 2);
+	put32(0);
+	put32(2);
+	put32('A');
+	put32('Z');
+	put32(10);
+	put32(0x1F600);
+	put32(0x1F64F);
+	put32(500);
+
+	cmap_subTable subtable;
+	EXPECT(load(&subtable));
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, '@'), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 'A'), 10);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 'Z'), 35);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, '['), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x1F600), 500);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x1F64F), 579);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x1F650), 0);
+	EXPECT_EQ(cmap_subtable_lookup(&subtable, 0x10FFFF), 0);
+	release(&subtable);
+
+	/* A group count that cannot fit in the data is rejected. */
+	size = 12;
+	put32(0x10000000);
+	EXPECT(!load(&subtable));
+	release(&subtable);
+}
+
+int main(void) {
+	test_format0();
+	test_format4();
+	test_format6();
+	test_format12();
+
+	EXPECT_EQ(cmap_subtable_lookup(NULL, 'A'), 0);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,285 @@
+#include "test.h"
+#include "base/font.h"
+#include "raster/raster.h"
+#include "raster/run.h"
+#include <string.h>
+
+#define NUM_TABLES	8
+#define NUM_GLYPHS	96	/* .notdef, then U+0020..U+007E */
+#define UPEM		1000
+
+static uint8_t data[2048];
+static size_t size;
+static size_t table_start;
+static int num_tables;
+
+static void put16(uint16_t v) {
+	data[size++] = v >> 8;
+	data[size++] = v;
+}
+
+static void put32(uint32_t v) {
+	put16(v >> 16);
+	put16(v);
+}
+
+static void pad(size_t n) {
+	while (n--) {
+		data[size++] = 0;
+	}
+}
+
+static void begin_table(void) {
+	table_start = size;
+}
+
+/* Add the table written since begin_table() to the table directory. */
+static void end_table(const char *tag) {
+	size_t length = size - table_start;
+	size = 12 + 16 * num_tables++;
+	memcpy(&data[size], tag, 4);
+	size += 4;
+	put32(0);
+	put32(table_start);
+	put32(length);
+	size = (table_start + length + 3) & ~(size_t)3;
+}
+
+/**
+ * Build a font whose glyphs are all empty and advance by half an em,
+ * except 'W' which advances by a whole em. hhea claims num_h_metrics
+ * long metrics.
+ */
+static TTF_Font *build_font(uint16_t num_h_metrics) {
+	size = 12 + 16 * NUM_TABLES;
+	num_tables = 0;
+
+	begin_table();
+	put16(0);
+	put16(1);
+	put16(3);
+	put16(1);
+	put32(12);
+	put16(4);
+	put16(32);
+	put16(0);
+	put16(2 * 2);
+	put16(4);
+	put16(1);
+	put16(0);
+	put16(0x7E);
+	put16(0xFFFF);
+	put16(0);
+	put16(0x20);
+	put16(0xFFFF);
+	put16(1 - 0x20);
+	put16(1);
+	put16(0);
+	put16(0);
+	end_table("cmap");
+
+	begin_table();
+	pad(4);
+	end_table("glyf");
+
+	begin_table();
+	put32(0x00010000);
+	put32(0);
+	put32(0);
+	put32(0x5F0F3CF5);
+	put16(0);
+	put16(UPEM);
+	pad(16 + 8);
+	put16(0);
+	put16(8);
+	put16(2);
+	put16(0);
+	put16(0);
+	end_table("head");
+
+	begin_table();
+	put32(0x00010000);
+	put16(800);
+	put16(-200);
+	put16(0);
+	put16(UPEM);
+	pad(22);
+	put16(num_h_metrics);
+	end_table("hhea");
+
+	begin_table();
+	int i;
+	for (i = 0; i < NUM_GLYPHS; i++) {
+		put16((i == 'W' - 0x1F) ? UPEM : UPEM / 2);
+		put16(0);
+	}
+	end_table("hmtx");
+
+	begin_table();
+	pad(2 * (NUM_GLYPHS + 1));
+	end_table("loca");
+
+	begin_table();
+	put32(0x00010000);
+	put16(NUM_GLYPHS);
+	pad(26);
+	end_table("maxp");
+
+	begin_table();
+	put32(0x00030000);
+	pad(28);
+	end_table("post");
+
+	size_t end = size;
+	size = 0;
+	put32(0x00010000);
+	put16(NUM_TABLES);
+	put16(128);
+	put16(3);
+	put16(0);
+	size = end;
+
+	return load_font_buffer(data, size);
+}
+
+static void test_shaping(TTF_Font *font) {
+	TTF_Raster *raster = create_uncached_raster(font, 20, 72, RENDER_AAA);
+	TTF_Glyph_Run *run = create_glyph_run();
+	EXPECT(raster && run);
+
+	/* 20 ppem: half an em is 10 pixels. */
+	EXPECT(glyph_run_utf8(run, raster, "AW.", 3));
+	EXPECT_EQ(run->num_glyphs, 3);
+	EXPECT_EQ(run->glyphs[0].index, 'A' - 0x1F);
+	EXPECT_EQ(run->glyphs[1].index, 'W' - 0x1F);
+	EXPECT_EQ(run->glyphs[1].x_offset, 10 * 64);
+	EXPECT_EQ(run->glyphs[2].x_offset, 30 * 64);
+	EXPECT_EQ(run->width, 40);
+
+	/* Malformed UTF-8 and unmapped characters shape as .notdef. */
+	EXPECT(glyph_run_utf8(run, raster, "\xC3" "A\x7F", 3));
+	EXPECT_EQ(run->num_glyphs, 3);
+	EXPECT_EQ(run->glyphs[0].index, 0);
+	EXPECT_EQ(run->glyphs[1].index, 'A' - 0x1F);
+	EXPECT_EQ(run->glyphs[2].index, 0);
+
+	free_glyph_run(run);
+	free_raster(raster);
+}
+
+static void test_run_cache_lru(TTF_Font *font) {
+	TTF_Raster *raster = create_uncached_raster(font, 20, 72, RENDER_AAA);
+	TTF_Run_Cache *cache = create_run_cache(2);
+	EXPECT(raster && cache);
+
+	TTF_Glyph_Run *aw = run_cache_get(cache, raster, "AW", 2);
+	EXPECT(aw && aw->num_glyphs == 2 && aw->width == 30);
+	EXPECT(run_cache_get(cache, raster, "AW", 2) == aw);
+	EXPECT_EQ(cache->num_entries, 1);
+
+	/* The length is part of the key. */
+	TTF_Glyph_Run *a = run_cache_get(cache, raster, "AW", 1);
+	EXPECT(a && a != aw && a->num_glyphs == 1);
+	EXPECT_EQ(cache->num_entries, 2);
+
+	/* Using "AW" again makes "A" the least recently used, and evicted. */
+	EXPECT(run_cache_get(cache, raster, "AW", 2) == aw);
+	TTF_Glyph_Run *xyz = run_cache_get(cache, raster, "xyz", 3);
+	EXPECT(xyz && xyz->num_glyphs == 3);
+	EXPECT_EQ(cache->num_entries, 2);
+	EXPECT(cache->head->run == xyz && cache->tail->run == aw);
+	EXPECT(run_cache_get(cache, raster, "AW", 2) == aw);
+	EXPECT(cache->head->run == aw && cache->tail->run == xyz);
+
+	/* So is the raster's size and mode. */
+	TTF_Raster *large = create_uncached_raster(font, 40, 72, RENDER_AAA);
+	TTF_Glyph_Run *large_aw = run_cache_get(cache, large, "AW", 2);
+	EXPECT(large_aw && large_aw != aw && large_aw->width == 60);
+	EXPECT(cache->head->run == large_aw && cache->tail->run == aw);
+	raster_init(large, font, 20, 72, RENDER_AAA | RENDER_SUBPIXEL);
+	TTF_Glyph_Run *subpixel_aw = run_cache_get(cache, large, "AW", 2);
+	EXPECT(subpixel_aw && subpixel_aw != aw && subpixel_aw != large_aw);
+	EXPECT_EQ(subpixel_aw->raster_flags, RENDER_AAA | RENDER_SUBPIXEL);
+	EXPECT_EQ(cache->num_entries, 2);
+
+	clear_run_cache(cache);
+	EXPECT_EQ(cache->num_entries, 0);
+	EXPECT(!cache->head && !cache->tail);
+
+	free_raster(large);
+	free_run_cache(cache);
+	free_raster(raster);
+}
+
+static void test_run_cache_rehash(TTF_Font *font) {
+	enum { NUM_STRINGS = 200 };
+	TTF_Raster *raster = create_uncached_raster(font, 20, 72, RENDER_AAA);
+	TTF_Run_Cache *cache = create_run_cache(NUM_STRINGS);
+	EXPECT(raster && cache);
+
+	uint32_t num_buckets = cache->num_buckets;
+	TTF_Glyph_Run *runs[NUM_STRINGS];
+	char text[16];
+	int i;
+	for (i = 0; i < NUM_STRINGS; i++) {
+		int len = sprintf(text, "run %d", i);
+		runs[i] = run_cache_get(cache, raster, text, len);
+		EXPECT(runs[i] && runs[i]->num_glyphs == len);
+	}
+	EXPECT_EQ(cache->num_entries, NUM_STRINGS);
+	EXPECT(cache->num_buckets > num_buckets);
+	EXPECT(cache->num_buckets >= cache->num_entries);
+
+	/* Every run is still found after the buckets grew. */
+	for (i = 0; i < NUM_STRINGS; i++) {
+		int len = sprintf(text, "run %d", i);
+		EXPECT(run_cache_get(cache, raster, text, len) == runs[i]);
+	}
+	EXPECT_EQ(cache->num_entries, NUM_STRINGS);
+
+	free_run_cache(cache);
+	free_raster(raster);
+}
+
+/**
+ * A font without long horizontal metrics has no advances, rather than
+ * reading before the start of the advance widths.
+ */
+static void test_no_metrics(void) {
+	TTF_Font *font = build_font(0);
+	EXPECT(font != NULL);
+	if (!font) {
+		return;
+	}
+
+	TTF_Raster *raster = create_uncached_raster(font, 20, 72, RENDER_AAA);
+	TTF_Glyph_Run *run = create_glyph_run();
+	EXPECT(glyph_run_utf8(run, raster, "AW", 2));
+	EXPECT_EQ(run->glyphs[1].x_offset, 0);
+	EXPECT_EQ(run->width, 0);
+	raster_init(raster, font, 20, 72, RENDER_AAA | RENDER_SUBPIXEL);
+	EXPECT(glyph_run_utf8(run, raster, "AW", 2));
+	EXPECT_EQ(run->width, 0);
+
+	free_glyph_run(run);
+	free_raster(raster);
+	free_font(font);
+}
+
+int main(void) {
+	test_no_metrics();
+
+	TTF_Font *font = build_font(NUM_GLYPHS);
+	EXPECT(font != NULL);
+	if (!font) {
+		return TEST_RESULT();
+	}
+
+	test_shaping(font);
+	test_run_cache_lru(font);
+	test_run_cache_rehash(font);
+
+	free_font(font);
+
+	return TEST_RESULT();
+}
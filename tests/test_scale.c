@@ -0,0 +1,54 @@
+#include "test.h"
+#include "raster/raster.h"
+#include "raster/scale.h"
+#include "raster/fixed.h"
+#include "raster/config.h"
+
+/**
+ * Check that pen_to_pixel splits every pen position in [-8, 8] pixels into
+ * the nearest whole pixel and offset. Ties round towards +x.
+ */
+static void test_pen_to_pixel_nearest(uint32_t flags, int steps) {
+	TTF_Raster raster = { .flags = flags };
+	int step = F26DOT6_ONE / steps;
+
+	int failures = 0;
+	F26Dot6 pen;
+	for (pen = -8 * F26DOT6_ONE; pen <= 8 * F26DOT6_ONE; pen++) {
+		uint8_t x_phase = 0xFF;
+		int x = pen_to_pixel(&raster, pen, &x_phase);
+		F26Dot6 placed = x * F26DOT6_ONE + x_phase * step;
+		if (x_phase >= steps || placed - pen > step / 2 || pen - placed >= step / 2) {
+			fprintf(stderr, "pen %d placed at %d + %d/%d\n", (int)pen, x, x_phase, steps);
+			failures++;
+		}
+	}
+	EXPECT_EQ(failures, 0);
+}
+
+int main(void) {
+	test_pen_to_pixel_nearest(RENDER_AAA, 1);
+	test_pen_to_pixel_nearest(RENDER_AAA | RENDER_SUBPIXEL, SUBPIXEL_STEPS);
+
+	TTF_Raster raster = { .flags = RENDER_AAA | RENDER_SUBPIXEL };
+	uint8_t x_phase;
+
+	/* Negative pens borrow from the pixel to their left. */
+	EXPECT_EQ(pen_to_pixel(&raster, -F26DOT6_ONE / SUBPIXEL_STEPS, &x_phase), -1);
+	EXPECT_EQ(x_phase, SUBPIXEL_STEPS - 1);
+	EXPECT_EQ(pen_to_pixel(&raster, -F26DOT6_ONE / 2, &x_phase), -1);
+	EXPECT_EQ(x_phase, SUBPIXEL_STEPS / 2);
+	EXPECT_EQ(pen_to_pixel(&raster, -3 * F26DOT6_ONE, &x_phase), -3);
+	EXPECT_EQ(x_phase, 0);
+
+	/* Just short of the next pixel rounds up into it. */
+	EXPECT_EQ(pen_to_pixel(&raster, 5 * F26DOT6_ONE - 1, &x_phase), 5);
+	EXPECT_EQ(x_phase, 0);
+
+	raster.flags = RENDER_AAA;
+	EXPECT_EQ(pen_to_pixel(&raster, -F26DOT6_ONE / 2, &x_phase), 0);
+	EXPECT_EQ(pen_to_pixel(&raster, -F26DOT6_ONE / 2 - 1, &x_phase), -1);
+	EXPECT_EQ(x_phase, 0);
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,68 @@
+#include "test.h"
+#include "base/consts.h"
+#include "utils/utils.h"
+#include <string.h>
+
+/**
+ * Decode s completely and compare the code points with expected,
+ * a list ending in 0.
+ */
+static int decodes_to(const char *s, size_t len, const uint32_t *expected) {
+	size_t pos = 0;
+	while (pos < len) {
+		size_t last = pos;
+		uint32_t c = utf8_next(s, len, &pos);
+		if (c != *expected++ || pos <= last || pos > len) {
+			return 0;
+		}
+	}
+	return *expected == 0;
+}
+
+#define DECODES_TO(s, ...) \
+	EXPECT(decodes_to(s, sizeof(s) - 1, (const uint32_t[]){ __VA_ARGS__, 0 }))
+
+int main(void) {
+	/* One to four byte sequences, at the ends of their ranges. */
+	DECODES_TO("A\x7F", 'A', 0x7F);
+	DECODES_TO("\xC2\x80\xDF\xBF", 0x80, 0x7FF);
+	DECODES_TO("\xE0\xA0\x80\xE2\x82\xAC\xEF\xBF\xBF", 0x800, 0x20AC, 0xFFFF);
+	DECODES_TO("\xF0\x90\x80\x80\xF0\x9F\x98\x80\xF4\x8F\xBF\xBF", 0x10000, 0x1F600, 0x10FFFF);
+
+	/* Overlong forms. */
+	DECODES_TO("\xC0\xAF", REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+	DECODES_TO("\xC1\xBF", REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+	DECODES_TO("\xE0\x80\xAF", REPLACEMENT_CHAR, REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+	DECODES_TO("\xF0\x8F\xBF\xBF", REPLACEMENT_CHAR, REPLACEMENT_CHAR, REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+
+	/* UTF-16 surrogates. */
+	DECODES_TO("\xED\x9F\xBF", 0xD7FF);
+	DECODES_TO("\xED\xA0\x80", REPLACEMENT_CHAR, REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+	DECODES_TO("\xED\xBF\xBF", REPLACEMENT_CHAR, REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+	DECODES_TO("\xEE\x80\x80", 0xE000);
+
+	/* Code points past U+10FFFF, and bytes that never start a sequence. */
+	DECODES_TO("\xF4\x90\x80\x80", REPLACEMENT_CHAR, REPLACEMENT_CHAR, REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+	DECODES_TO("\xF8\x88\x80\x80\x80", REPLACEMENT_CHAR, REPLACEMENT_CHAR, REPLACEMENT_CHAR,
+			REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+	DECODES_TO("\xFE\xFF", REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+
+	/* A bad continuation byte only replaces the lead byte. */
+	DECODES_TO("\xC3" "A", REPLACEMENT_CHAR, 'A');
+	DECODES_TO("\xE2\x82" "A", REPLACEMENT_CHAR, REPLACEMENT_CHAR, 'A');
+	DECODES_TO("\xF0\x9F\xC3\xA9", REPLACEMENT_CHAR, REPLACEMENT_CHAR, 0xE9);
+
+	/* Sequences cut short by the end of the string. */
+	DECODES_TO("\xC3", REPLACEMENT_CHAR);
+	DECODES_TO("\xE2\x82", REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+	DECODES_TO("\xF0\x9F\x98", REPLACEMENT_CHAR, REPLACEMENT_CHAR, REPLACEMENT_CHAR);
+
+	/* The length bounds decoding, not a terminating NUL. */
+	const char *euro = "\xE2\x82\xAC";
+	EXPECT(decodes_to(euro, 2, (const uint32_t[]){ REPLACEMENT_CHAR, REPLACEMENT_CHAR, 0 }));
+	size_t pos = 1;
+	EXPECT_EQ(utf8_next("a\0b", 3, &pos), 0);
+	EXPECT_EQ(pos, 2);
+
+	return TEST_RESULT();
+}
@@ -15,6 +15,11 @@
 #include "raster/scale.h"
 #include "raster/scan.h"
 #include "raster/bitmap.h"
+#include "raster/output.h"
+#include "raster/run.h"
+#include "raster/layout.h"
+#include "raster/band.h"
+#include "raster/pool.h"
 
 #include "utils/utils.h"
 
@@ -1,13 +1,107 @@
 #include "utils.h"
 #include "../glyph/glyph.h"
 #include "../tables/tables.h"
-#include "../raster/scale.h"
+#include "../raster/run.h"
+#include <stdlib.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
 
+/* Alignment of every arena allocation. */
+#define ARENA_ALIGN sizeof(void *)
+
+int init_arena(TTF_Arena *arena, size_t size) {
+	CHECKPTR(arena);
+
+	arena->base = malloc(size);
+	if (!arena->base) {
+		warnerr("failed to alloc arena");
+		arena->size = arena->used = 0;
+		return FAILURE;
+	}
+	arena->size = size;
+	arena->used = 0;
+
+	return SUCCESS;
+}
+
+/**
+ * Bump-allocate size bytes from the arena. Returns NULL once the arena is
+ * exhausted - arenas are sized up front and never grow.
+ */
+void *arena_alloc(TTF_Arena *arena, size_t size) {
+	if (!arena || !arena->base) {
+		return NULL;
+	}
+	size_t start = (arena->used + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if (start > arena->size || size > arena->size - start) {
+		warn("arena exhausted");
+		return NULL;
+	}
+	arena->used = start + size;
+	return arena->base + start;
+}
+
+void free_arena(TTF_Arena *arena) {
+	if (!arena) {
+		return;
+	}
+	if (arena->base) {
+		free(arena->base);
+	}
+	arena->base = NULL;
+	arena->size = arena->used = 0;
+}
+
+/**
+ * Decode the UTF-8 sequence at *pos in the len byte string s, and move
+ * *pos past it. Malformed sequences decode as REPLACEMENT_CHAR, one byte
+ * at a time.
+ */
+uint32_t utf8_next(const char *s, size_t len, size_t *pos) {
+	const uint8_t *p = (const uint8_t *)&s[*pos];
+	size_t left = len - *pos;
+
+	if (p[0] < 0x80) {
+		(*pos)++;
+		return p[0];
+	}
+
+	size_t n;
+	uint32_t c, min;
+	if ((p[0] & 0xE0) == 0xC0) {
+		n = 2, c = p[0] & 0x1F, min = 0x80;
+	} else if ((p[0] & 0xF0) == 0xE0) {
+		n = 3, c = p[0] & 0x0F, min = 0x800;
+	} else if ((p[0] & 0xF8) == 0xF0) {
+		n = 4, c = p[0] & 0x07, min = 0x10000;
+	} else {
+		(*pos)++;
+		return REPLACEMENT_CHAR;
+	}
+	if (n > left) {
+		(*pos)++;
+		return REPLACEMENT_CHAR;
+	}
+	for (size_t i = 1; i < n; i++) {
+		if ((p[i] & 0xC0) != 0x80) {
+			(*pos)++;
+			return REPLACEMENT_CHAR;
+		}
+		c = (c << 6) | (p[i] & 0x3F);
+	}
+	/* Reject overlong forms, surrogates and code points past U+10FFFF. */
+	if (c < min || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) {
+		(*pos)++;
+		return REPLACEMENT_CHAR;
+	}
+
+	*pos += n;
+	return c;
+}
+
 int mod(int a, int b) {
 	return ((a & b) + b) % b;
 }
@@ -41,26 +135,20 @@ void warnerr(const char *fmt, ...) {
 	}
 }
 
-int get_text_width(TTF_Font *font, const char *text) {
-	if (!font || !text) {
+/**
+ * Get the width in pixels of a line of UTF-8 text, or 0 if it cannot be
+ * shaped. The text's glyph run stays in the raster's run cache, so text
+ * drawn right after being measured is not shaped again.
+ */
+int get_text_width(TTF_Raster *raster, const char *text) {
+	if (!raster || !text) {
 		return 0;
 	}
 
-	hmtx_Table *hmtx = get_hmtx_table(font);
-	if (!hmtx) {
-		warn("failed to calculate text width");
-		return 0;
-	}
-
-	int width = 0;
-	/* Get advance width of each character's glyph. */
-	for (int i = 0; i < (int)strlen(text); i++) {
-		int32_t glyph_index = get_glyph_index(font, text[i]);
-		if (glyph_index < 0) {
-			continue;
-		}
-		width += roundf(funit_to_pixel(font, hmtx->advance_width[glyph_index]));
-	}
+	TTF_Glyph_Run *owned = NULL;
+	TTF_Glyph_Run *run = shape_text(raster, text, strlen(text), &owned);
+	int width = (run) ? run->width : 0;
+	free_glyph_run(owned);
 
 	return width;
 }
@@ -42,15 +42,22 @@ _release:								\
 	RETFAILRELEASE(PASS, RELEASE)
 
 #define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
 #define IN(x, a, b) ((x) >= (a) && (x) <= (b))
 
+int init_arena(TTF_Arena *arena, size_t size);
+void *arena_alloc(TTF_Arena *arena, size_t size);
+void free_arena(TTF_Arena *arena);
+
+uint32_t utf8_next(const char *s, size_t len, size_t *pos);
+
 int mod(int a, int b);
 float symroundf(float f);
 
 void warn(const char *fmt, ...);
 void warnerr(const char *fmt, ...);
 
-int get_text_width(TTF_Font *font, const char *text);
+int get_text_width(TTF_Raster *raster, const char *text);
 
 #endif /* UTILS_H */